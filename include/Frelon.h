@@ -59,8 +59,43 @@ enum Reg {
 	SeqTimEShutH,		SeqTimEShutL,
 	SeqTimExposureH,	SeqTimExposureL,
 	SeqTimFramePeriodH,	SeqTimFramePeriodL,
+	NbRegs,
 };
 
+// RegDerived registers are recomputed by the camera when a register
+// in one of the Reg*Cfg groups they depend on changes, see RegDependMap
+enum RegFlag {
+	RegCacheable	= (1 << 0),
+	RegFloat	= (1 << 1),
+	RegSigned	= (1 << 2),
+	RegRoiCfg	= (1 << 3),
+	RegBinCfg	= (1 << 4),
+	RegChanCfg	= (1 << 5),
+	RegTimingCfg	= (1 << 6),
+	RegDerived	= (1 << 7),
+	RegReadoutCfg	= (RegRoiCfg | RegBinCfg | RegChanCfg | RegTimingCfg),
+};
+
+// Static register properties, RegPropList is indexed by Reg
+struct RegProp {
+	Reg reg;
+	const char *str;
+	int flags;
+	double sleep_time;
+	double timeout;
+};
+extern const RegProp RegPropList[NbRegs];
+
+inline const RegProp& GetRegProp(Reg reg)
+{
+	return RegPropList[reg];
+}
+
+inline bool HasRegFlag(Reg reg, RegFlag flag)
+{
+	return (RegPropList[reg].flags & flag);
+}
+
 typedef std::map<Reg, std::string> RegStrMapType;
 extern RegStrMapType RegStrMap;
 
@@ -69,6 +104,10 @@ extern RegListType CacheableRegList;
 extern RegListType FloatRegList;
 extern RegListType SignedRegList;
 
+// input register -> list of RegDerived registers to invalidate on write
+typedef std::map<Reg, RegListType> RegListMapType;
+extern RegListMapType RegDependMap;
+
 typedef std::map<Reg, double> RegDoubleMapType;
 extern RegDoubleMapType RegSleepMap;
 extern RegDoubleMapType RegTimeoutMap;
@@ -78,6 +117,7 @@ extern const int MaxRegVal;
 enum Cmd {
 	Reset,		Start,		Stop,		Save,		Reload,
 	SendEOF,
+	NbCmds,
 };
 
 typedef std::map<Cmd, std::string> CmdStrMapType;
@@ -91,11 +131,17 @@ enum MultiLineCmd {
 	ConfigDAC,	ConfigADC,	ConfigPLL,	ConfigSWeight,
 	ConfigVCXO,	ConfigAlarm,	ConfigAoi,	UserInfo,
 	MonitorADC,
+	NbMultiLineCmds,
 };
 
 typedef std::map<MultiLineCmd, std::string> MultiLineCmdStrMapType;
 extern MultiLineCmdStrMapType MultiLineCmdStrMap;
 
+// Mnemonic -> command/register lookup, binary search on a packed key
+bool FindRegByStr(const std::string& str, Reg& reg);
+bool FindCmdByStr(const std::string& str, Cmd& cmd);
+bool FindMultiLineCmdByStr(const std::string& str, MultiLineCmd& cmd);
+
 
 enum FrameTransferMode {
 	FFM = 0, FTM = 1,
@@ -305,6 +351,31 @@ struct SeqTimValues {
 
 std::ostream& operator <<(std::ostream& os, const SeqTimValues& tm);
 
+struct FrameTiming {
+	double readout_time;
+	double transfer_time;
+	double dead_time;
+	double frame_period;
+	double max_frame_rate;
+	bool predicted;
+	// bound of the readout & transfer time error: 0 if measured,
+	// -1 if unknown (not a confident estimate)
+	double error;
+};
+
+std::ostream& operator <<(std::ostream& os, const FrameTiming& ft);
+
+// sequencer configs swept by the background SeqTim calibration
+struct SeqTimCalibRange {
+	int chan_mode;
+	int bin_vert_first, bin_vert_last;
+	RoiMode roi_mode;
+	int roi_line_begin;
+	int roi_line_width_first, roi_line_width_last, roi_line_width_step;
+};
+
+std::ostream& operator <<(std::ostream& os, const SeqTimCalibRange& range);
+
 } // namespace Frelon
 
 } // namespace lima
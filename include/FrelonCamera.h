@@ -64,7 +64,37 @@ class Camera
 		Camera& m_cam;
 	};
 
-	Camera(Espia::SerialLine& espia_ser_line);
+	// 64-bit image count since acq. start, extended across wraps
+	struct ImageCountSample {
+		unsigned long long count;
+		Timestamp timestamp;
+	};
+
+	// hardware readout mode candidate and its predicted timing
+	struct ReadoutMode {
+		FrameTransferMode ftm;
+		InputChan input_chan;
+		RoiMode roi_mode;
+		FrameTiming timing;
+	};
+
+	// Cost of the last waitStatus; wake_latency is the time between
+	// the last two polls, an upper bound of the detection delay.
+	// cpu_time is the waiting thread's, nb_bytes the serial bytes of
+	// its own status register reads
+	struct WaitStatusStats {
+		int nb_polls;
+		double wait_time;
+		double sleep_time;
+		double wake_latency;
+		double cpu_time;
+		unsigned long nb_bytes;
+	};
+
+	Camera(Espia::SerialLine& espia_ser_line, 
+	       const std::string& cache_file = "");
+	Camera(HwSerialLine& hw_ser_line, 
+	       const std::string& cache_file = "");
 	~Camera();
 
 	SerialLine& getSerialLine();
@@ -73,6 +103,11 @@ class Camera
 	void readRegister (Reg reg, int& val);
 	void readFloatRegister(Reg reg, double& val);
 
+	void commitTransaction(SerialLine::Transaction& trans);
+
+	void getCacheFile(std::string& cache_file);
+	void saveCacheFile();
+
 	TempRegVal getTempRegVal(Reg reg, int val);
 
 	void hardReset();
@@ -106,6 +141,7 @@ class Camera
 	void setRoiMode(RoiMode  roi_mode);
 	void getRoiMode(RoiMode& roi_mode);
 
+	void getGeometryState(GeometryState& state);
 	void checkRoi(const Roi& set_roi, Roi& hw_roi);
 	void setRoi(const Roi& set_roi);
 	void getRoi(Roi& hw_roi);
@@ -133,6 +169,18 @@ class Camera
 	void setTotalLatTime(double  lat_time);
 	void getTotalLatTime(double& lat_time);
 
+	// timing model: no hardware access for the candidate config
+	void calcFrameTiming(FrameTransferMode ftm, InputChan input_chan,
+			     const Bin& bin, const Roi& roi, RoiMode roi_mode,
+			     double exp_time, double lat_time, 
+			     FrameTiming& ft);
+	void getFrameTiming(FrameTiming& ft);
+	void getMaxFrameRate(double& max_frame_rate);
+
+	// fastest FTM/channel/RoiMode covering the (binned) image roi
+	void calcFastestReadoutMode(const Roi& roi, ReadoutMode& mode);
+	void setFastestReadoutMode(const Roi& roi, Roi& hw_roi);
+
 	void setNbFrames(int  nb_frames);
 	void getNbFrames(int& nb_frames);
 
@@ -145,11 +193,22 @@ class Camera
 	void getExtSyncEnable(ExtSync& ext_sync_ena);
 
 	void getStatus(Status& status, bool use_ser_line=false,
-		       bool read_spb=false);
+		       bool read_spb=false, bool force_read=false);
 	bool waitStatus(Status& status, Status mask, double timeout,
 			bool use_ser_line=false, bool read_spb=false);
+	void getWaitStatusStats(WaitStatusStats& stats);
+
+	void setStatusMaxAge(double  max_age);
+	void getStatusMaxAge(double& max_age);
+	// the reads in progress are not published, and not joined
+	void invalidateStatusCache();
+
+	// IntTrigMult re-triggers can skip waiting for the camera answer
+	void setTrigAck(bool  trig_ack);
+	void getTrigAck(bool& trig_ack);
 
 	void getImageCount(unsigned int& img_count, bool only_lsw=false);
+	void getImageCountSample(ImageCountSample& sample);
 	void getMissingExtStartPulses(int& missing_pulses);
 
 	void prepare();
@@ -164,6 +223,13 @@ class Camera
 	void measureSeqTimValues(SeqTimValues& st, double timeout = -1);
 	void setAutoSeqTimMeasure(bool  auto_measure);
 	void getAutoSeqTimMeasure(bool& auto_measure);
+	void exportSeqTimMeasures(const std::string& fname);
+	void importSeqTimMeasures(const std::string& fname);
+
+	void addSeqTimCalibRange(const SeqTimCalibRange& range);
+	void startSeqTimCalib();
+	void stopSeqTimCalib();
+	void getSeqTimCalibPending(int& nb_pending);
 
 	void registerDeadTimeChangedCallback(DeadTimeChangedCallback& cb);
 	void unregisterDeadTimeChangedCallback(DeadTimeChangedCallback& cb);
@@ -178,10 +244,46 @@ class Camera
 	static const double UpdateCcdStatusTime;
 	static const double MaxIdleWaitTime;
 	static const double MaxBusyRetryTime;
+	static const double ReconfigPollTime;
+	static const double ReconfigMaxPollTime;
+	static const double WaitStatusPollTime;
+	static const double WaitStatusMaxPollTime;
+	static const double WaitStatusGuardTime;
+	static const double WaitStatusGuardFactor;
+	static const double DefStatusMaxAge;
+	static const int MaxImageCountRetries;
+	static const double ReadoutModeMinGain;
+	static const double ReadoutModePredMargin;
+	static const std::string SeqTimFileExt;
+
+	// status read shared by concurrent getStatus callers
+	struct StatusCacheEntry {
+		Status status;
+		Timestamp timestamp;
+		Timestamp read_start;
+		bool reading;
+		// bumped by invalidateStatusCache
+		unsigned long gen;
+		unsigned long read_gen;
+	};
 
+	class ReconfigWaiter : public SerialLine::ReconfigWaiter
+	{
+		DEB_CLASS_NAMESPC(DebModCamera, "Camera::ReconfigWaiter", 
+				  "Frelon");
+	public:
+		ReconfigWaiter(Camera& cam);
+		virtual bool waitReconfig(double max_wait);
+	private:
+		Camera& m_cam;
+	};
+	friend class ReconfigWaiter;
+
+	bool hasEspiaDev();
 	Espia::Dev& getEspiaDev();
 	Geometry& getGeometry();
 
+	void init();
 	void sync();
 	void syncRegs();
 	void syncRegsGoodHTD();
@@ -189,19 +291,45 @@ class Camera
 
 	void sendCmd(Cmd cmd);
 
+	bool loadCacheFile(const std::string& ver, int complex_ser_nb);
+
+	template <class Op>
+	void writeWithRetry(Op& op);
+
 	void setTimeUnitFactor(TimeUnitFactor  time_unit_factor);
 	void getTimeUnitFactor(TimeUnitFactor& time_unit_factor);
 	int  calcTimeUnits(double time_sec, TimeUnitFactor time_unit_factor);
 
 	double getMaxIdleWaitTime();
+	void setReadoutMode(const ReadoutMode& mode, const Roi& roi);
+
+	void estimateAcqEnd(TrigMode trig_mode);
+	void restartAcqEnd();
+	void clearAcqEnd();
+	double sleepUntilAcqEnd(Timestamp end);
 	bool waitIdleStatus(Status& status, bool use_ser_line=false,
 			    bool read_spb=false);
 
-	Status getSPBStatus();
+	void getCachedStatus(Status& status, bool use_ser_line, 
+			     bool read_spb, bool force_read, 
+			     unsigned long& nb_bytes);
+	void readStatus(Status& status, bool use_ser_line, bool read_spb,
+			unsigned long& nb_bytes);
+	void readCachedStatus(StatusCacheEntry& entry, AutoMutex& l,
+			      bool use_ser_line, bool read_spb, 
+			      unsigned long& nb_bytes);
+	unsigned int readImageCount(Timestamp& timestamp);
+	void resetImageCount(bool restart);
+	Status getSPBStatus(bool use_queue = true, 
+			    unsigned long *nb_bytes = NULL);
+	void readStatusRegister(Reg reg, int& val, bool use_queue = true,
+				unsigned long *nb_bytes = NULL);
 
 	AutoMutex lock();
 
 	SerialLine m_ser_line;
+	ReconfigWaiter m_reconfig_waiter;
+	std::string m_cache_file;
 	Model m_model;
 	bool m_auto_seq_tim_measure;
 	AutoPtr<TimingCtrl> m_timing_ctrl;
@@ -210,6 +338,18 @@ class Camera
 	int m_nb_frames;
 	Mutex m_lock;
 	bool m_started;
+	Cond m_status_cond;
+	Timestamp m_acq_start;
+	Timestamp m_acq_end_est;
+	double m_acq_time_est;
+	WaitStatusStats m_wait_stats;
+	Cond m_status_cache_cond;
+	StatusCacheEntry m_status_cache[2][2];	// [ser_line][read_spb]
+	double m_status_max_age;
+	Mutex m_img_count_lock;
+	unsigned long long m_img_count_base;
+	unsigned int m_img_count_last;
+	bool m_trig_ack;
 };
 
 inline AutoMutex Camera::lock()
@@ -50,6 +50,107 @@ class DeadTimeChangedCallback
 	Geometry *m_geom;
 };
 
+/*******************************************************************
+ * \struct ChanXform
+ * \brief Channel <-> image coordinate transform
+ *
+ * Depends only on the channel mode, the flip mode and the CCD size.
+ * In the directions read by two channels (mirror) the reference corner
+ * depends on the half where the point is, otherwise it is given by
+ * the effective (user & readout) flip.
+ *******************************************************************/
+
+struct ChanXform {
+	Flip mirror;
+	Point nb_chan;
+	Size chan_size;
+	Flip flip;
+};
+
+std::ostream& operator <<(std::ostream& os, const ChanXform& xform);
+
+
+/*******************************************************************
+ * \class GeometryState
+ * \brief Snapshot of the settings the ROI computations depend on
+ *
+ * The channel coordinate transformations and the hw_roi, chan_roi and
+ * roi offset calculations are pure functions of this value: they do
+ * not access the camera, so ROIs can be validated in dry-run (scan
+ * planning, tests). Geometry::getState fills it from the camera.
+ * The methods without a ChanXform calculate it from the state; the
+ * others use the one passed, which must match frelon16, spb_con_xy,
+ * ccd_size, input_chan and flip (Geometry passes its cached table).
+ *******************************************************************/
+
+class GeometryState
+{
+	DEB_CLASS_NAMESPC(DebModCamera, "GeometryState", "Frelon");
+
+ public:
+	GeometryState();
+
+	bool frelon16;
+	bool spb_con_xy;
+	Size ccd_size;
+	InputChan input_chan;
+	Flip flip;
+	Bin bin;
+	Point roi_bin_offset;
+	Point chan_roi_offset;
+
+	void calcChanXform(ChanXform& chan_xform) const;
+
+	Flip  getMirror() const;
+	Point getNbChan() const;
+	Size  getChanSize() const;
+	Flip  getRoiInsideMirror() const;
+
+	void checkRoi(const Roi& set_roi, Roi& hw_roi) const;
+	void checkRoi(const ChanXform& xform, const Roi& set_roi, 
+		      Roi& hw_roi) const;
+	void calcSetRoi(const Roi& set_roi, Roi& hw_roi, Roi& chan_roi, 
+			Point& chan_roi_offset) const;
+	void calcSetRoi(const ChanXform& xform, const Roi& set_roi, 
+			Roi& hw_roi, Roi& chan_roi, 
+			Point& chan_roi_offset) const;
+	void calcHwRoi(const Roi& chan_roi, Roi& hw_roi) const;
+	void calcHwRoi(const ChanXform& xform, const Roi& chan_roi, 
+		       Roi& hw_roi) const;
+	void calcRoiBinOffset(const Roi& chan_roi, Point& roi_bin_offset) const;
+	void calcRoiBinOffset(const ChanXform& xform, const Roi& chan_roi, 
+			      Point& roi_bin_offset) const;
+	void calcRoiBinOffsetChanRoi(const Roi& chan_roi, 
+				     const Point& roi_bin_offset,
+				     Roi& new_chan_roi) const;
+	void calcRoiBinOffsetChanRoi(const ChanXform& xform, 
+				     const Roi& chan_roi, 
+				     const Point& roi_bin_offset,
+				     Roi& new_chan_roi) const;
+
+	void xformChanCoords(const ChanXform& xform, const Point& point, 
+			     Point& chan_point, Corner& ref_corner) const;
+	void calcImageRoi(const ChanXform& xform, const Roi& chan_roi, 
+			  const Flip& roi_inside_mirror,
+			  Roi& image_roi, Point& roi_bin_offset) const;
+	void calcFinalRoi(const ChanXform& xform, const Roi& image_roi, 
+			  const Point& roi_offset, Roi& final_roi) const;
+	void calcChanRoi(const ChanXform& xform, const Roi& image_roi, 
+			 Roi& chan_roi, Flip& roi_inside_mirror) const;
+	void calcChanRoiOffset(const Roi& req_roi, const Roi& image_roi,
+			       Point& roi_offset) const;
+
+	static bool isChanActive(InputChan curr, InputChan chan);
+};
+
+std::ostream& operator <<(std::ostream& os, const GeometryState& state);
+
+inline bool GeometryState::isChanActive(InputChan curr, InputChan chan)
+{
+	return (curr & chan) == chan;
+}
+
+
 class Geometry : public HwMaxImageSizeCallbackGen
 {
 	DEB_CLASS_NAMESPC(DebModCamera, "Geometry", "Frelon");
@@ -60,6 +161,7 @@ class Geometry : public HwMaxImageSizeCallbackGen
 
 	void sync();
 
+	bool isInputChanAvail(FrameTransferMode ftm, InputChan input_chan);
 	bool getDefInputChan(FrameTransferMode ftm,
 			     InputChan& input_chan);
 	void setInputChan(InputChan  input_chan);
@@ -73,6 +175,7 @@ class Geometry : public HwMaxImageSizeCallbackGen
 
 	void getMaxFrameDim(FrameDim& max_frame_dim);
 	void getFrameDim(FrameDim& frame_dim);
+	void calcFrameDim(FrameTransferMode ftm, FrameDim& frame_dim);
 
 	bool isChanActive(InputChan curr, InputChan chan);
 
@@ -88,6 +191,9 @@ class Geometry : public HwMaxImageSizeCallbackGen
 	void getRoiMode(RoiMode& roi_mode);
 
 	void checkRoi(const Roi& set_roi, Roi& hw_roi);
+	// throws if set_roi is not covered in another channel mode/binning
+	void checkRoi(int chan_mode, const Bin& bin, const Roi& set_roi, 
+		      Roi& hw_roi);
 	void setRoi(const Roi& set_roi);
 	void getRoi(Roi& hw_roi);
 
@@ -104,11 +210,23 @@ class Geometry : public HwMaxImageSizeCallbackGen
 	void registerDeadTimeChangedCallback(DeadTimeChangedCallback& cb);
 	void unregisterDeadTimeChangedCallback(DeadTimeChangedCallback& cb);
 
+	void getState(GeometryState& state);
+	// state for another channel mode & binning, with the current ROI
+	void calcState(int chan_mode, const Bin& bin, GeometryState& state);
+
+	// the channel transforms depend on the model: call on re-detection
+	void clearChanXformMap();
+
 	Flip  getMirror();
 	Point getNbChan();
 	Size  getCcdSize();
 	Size  getChanSize();
 
+	void calcChanMode(FrameTransferMode ftm, InputChan input_chan,
+			  int& chan_mode);
+	void calcFTMInputChan(int chan_mode, FrameTransferMode& ftm, 
+			      InputChan& input_chan);
+
  protected:
 	virtual void setMaxImageSizeCallbackActive(bool cb_active);
 
@@ -123,36 +241,31 @@ class Geometry : public HwMaxImageSizeCallbackGen
 	void getChanMode(int& chan_mode);
 	
 	void calcBaseChanMode(FrameTransferMode ftm, int& base_chan_mode);
-	void calcChanMode(FrameTransferMode ftm, InputChan input_chan,
-			  int& chan_mode);
-	void calcFTMInputChan(int chan_mode, FrameTransferMode& ftm, 
-			      InputChan& input_chan);
 
 	void setFlipMode(int  flip_mode);
 	void getFlipMode(int& flip_mode);
 
-        Flip getRoiInsideMirror();
+	void buildChanXformMap();
+	void getChanXform(int chan_mode, int flip_mode, 
+			  const GeometryState& state, ChanXform& xform);
+
+	void getState(GeometryState& state, ChanXform& xform);
+	void calcState(int chan_mode, const Bin& bin, GeometryState& state,
+		       ChanXform& xform);
 
 	void writeChanRoi(const Roi& chan_roi);
 	void readChanRoi(Roi& chan_roi);
 
-	void xformChanCoords(const Point& point, Point& chan_point, 
-			     Corner& ref_corner);
-	void calcImageRoi(const Roi& chan_roi, const Flip& roi_inside_mirror,
-			  Roi& image_roi, Point& roi_bin_offset);
-	void calcFinalRoi(const Roi& image_roi, const Point& roi_offset,
-			  Roi& final_roi);
-	void calcChanRoi(const Roi& image_roi, Roi& chan_roi,
-			 Flip& roi_inside_mirror);
-	void calcChanRoiOffset(const Roi& req_roi, const Roi& image_roi,
-			       Point& roi_offset);
         void checkRoiMode(const Roi& roi);
-	void processSetRoi(const Roi& req_roi, Roi& hw_roi, Roi& chan_roi, 
-			   Point& roi_offset);
 	void resetRoiBinOffset();
 
+	// indexed by (chan_mode, flip_mode)
+	typedef std::pair<int, int> ChanXformKey;
+	typedef std::map<ChanXformKey, ChanXform> ChanXformMap;
+
 	Camera& m_cam;
 	Model& m_model;
+	ChanXformMap m_chan_xform_map;
 	Point m_chan_roi_offset;
 	Point m_roi_bin_offset;
 	bool m_mis_cb_act;
@@ -162,7 +275,7 @@ class Geometry : public HwMaxImageSizeCallbackGen
 
 inline bool Geometry::isChanActive(InputChan curr, InputChan chan)
 {
-	return (curr & chan) == chan;
+	return GeometryState::isChanActive(curr, chan);
 };
 
 inline bool Geometry::isFrelon16()
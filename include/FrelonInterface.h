@@ -382,7 +382,17 @@ class Interface : public HwInterface
 
 	void resetDefaults();
 
+	// compare the camera image counter with the Espia DMA frames
+	void setCheckHwFrames(bool  check_hw_frames);
+	void getCheckHwFrames(bool& check_hw_frames);
+	void getHwFrameLag(int& frame_lag, int& max_frame_lag);
+
  private:
+	static const double HwFrameCheckPeriod;
+	static const int MaxHwFrameLag;
+
+	void checkHwFrames(int nb_dma_frames, bool force);
+
 	Espia::Acq&    m_acq;
 	BufferCtrlMgr& m_buffer_mgr;
 	Camera&        m_cam;
@@ -399,6 +409,12 @@ class Interface : public HwInterface
 
 	Frelon::AcqEndCallback m_acq_end_cb;
 	Frelon::EventCallback  m_event_cb;
+
+	Mutex m_hw_frames_lock;
+	bool m_check_hw_frames;
+	Timestamp m_hw_frames_check;
+	int m_hw_frame_lag;
+	int m_max_hw_frame_lag;
 };
 
 
@@ -25,6 +25,8 @@
 #include "Frelon.h"
 #include "lima/ThreadUtils.h"
 
+#include <deque>
+
 namespace lima
 {
 
@@ -38,6 +40,7 @@ class SerialLine : public HwSerialLine
  public:
 	enum MsgPart {
 		MsgSync, MsgCmd, MsgVal, MsgDec, MsgReq, MsgTerm, MsgSign,
+		NbMsgParts,
 	};
 	
 	enum AnsPart {
@@ -46,18 +49,172 @@ class SerialLine : public HwSerialLine
 	
 	enum {
 		MaxReadLen = 10000,
+		MaxPendingAcks = 4,
 	};
 
 	typedef std::map<MsgPart, std::string> MsgPartStrMapType;
 	typedef std::vector<std::string> StrList;
 
+	// Position of each message part inside the parsed string
+	struct MsgPartPos {
+		std::string::size_type beg[NbMsgParts];
+		std::string::size_type len[NbMsgParts];
+
+		void clear()
+		{ 
+			for (int i = 0; i < NbMsgParts; ++i)
+				beg[i] = len[i] = 0;
+		}
+		void set(MsgPart part, std::string::size_type b, 
+			 std::string::size_type e)
+		{ beg[part] = b; len[part] = e - b; }
+
+		bool empty(MsgPart part) const
+		{ return (len[part] == 0); }
+		std::string str(const std::string& msg, MsgPart part) const
+		{ return msg.substr(beg[part], len[part]); }
+	};
+
 	static const double TimeoutSingle, TimeoutNormal, TimeoutMultiLine, 
-			    TimeoutReset;
+			    TimeoutReset, TimeoutLineGapMin, 
+			    TimeoutLineGapConfirm;
 	
+	/***************************************************************
+	 * \class Transaction
+	 * \brief Batch of register writes committed in a single burst
+	 *
+	 * Writes matching the cache are skipped, the others are sent in
+	 * the order they were added: consecutive writes needing a camera
+	 * reconfiguration (RegSleepMap) share a single sleep, done before
+	 * the next write. The serial line is kept locked during the 
+	 * commit. On error, commit throws and the failed
+	 * entry, as well as the following ones, can be retried by
+	 * calling commit again.
+	 ***************************************************************/
+	class Transaction
+	{
+		DEB_CLASS_NAMESPC(DebModCameraCom, "SerialLine::Transaction", 
+				  "Frelon");
+
+	public:
+		enum Result {
+			Pending, Skipped, Written, Failed,
+		};
+
+		struct RegResult {
+			Reg reg;
+			int val;
+			Result result;
+			std::string err_msg;
+		};
+		typedef std::vector<RegResult> ResultList;
+
+		Transaction(SerialLine& ser_line);
+
+		void writeRegister(Reg reg, int val);
+		void commit();
+
+		bool isDone() const;
+		const ResultList& getResults() const;
+
+	private:
+		friend class SerialLine;
+		SerialLine& m_ser_line;
+		ResultList m_list;
+	};
+
+	/***************************************************************
+	 * \class Request
+	 * \brief Future of a command queued on the serial line I/O thread
+	 *
+	 * The queued requests are executed by a dedicated I/O thread,
+	 * strictly in queue order, so the caller does not block on the
+	 * camera round-trip. The Request must stay alive until it is
+	 * done: the destructor waits for it. wait throws if the command
+	 * failed.
+	 *
+	 * Each priority has its own lane: High requests (reads only) are
+	 * executed first between commands, Low ones (multi-line dumps,
+	 * reads) only when the other lanes are empty and low priority
+	 * traffic is not deferred (setDeferLowPrio, during acquisition).
+	 * Writes always go to the Normal lane to keep their order.
+	 ***************************************************************/
+	class Request
+	{
+		DEB_CLASS_NAMESPC(DebModCameraCom, "SerialLine::Request", 
+				  "Frelon");
+
+	public:
+		enum State {
+			Idle, Queued, Running, Done,
+		};
+
+		enum Priority {
+			High, Normal, Low, NbPriorities,
+		};
+
+		Request();
+		~Request();
+
+		State getState();
+		bool isDone();
+		bool wait(double timeout = -1);
+
+		const std::string& getResp() const;
+		int getVal() const;
+		double getFloatVal() const;
+		// serial bytes of a FmtCmd or register read, 0 if cached
+		unsigned long getNbBytes() const;
+
+	private:
+		friend class SerialLine;
+
+		enum Type {
+			FmtCmd, MultiLine, ReadReg, ReadFloatReg, WriteReg,
+		};
+
+		void waitDone();
+
+		SerialLine *m_ser_line;
+		Type m_type;
+		Priority m_prio;
+		State m_state;
+		Timestamp m_queue_ts;
+		std::string m_cmd;
+		MultiLineCmd m_ml_cmd;
+		Reg m_reg;
+		int m_val;
+		double m_float_val;
+		std::string m_resp;
+		unsigned long m_nb_bytes;
+		bool m_failed;
+		std::string m_err_msg;
+	};
+
+	/***************************************************************
+	 * \class ReconfigWaiter
+	 * \brief Polls the camera readiness after a reconfiguration
+	 *
+	 * Used instead of the fixed RegSleepMap sleep after writing a
+	 * register that reconfigures the camera. waitReconfig is called
+	 * with the serial line locked and can send commands; it returns
+	 * false if the readiness cannot be polled, and the fixed sleep is
+	 * then done.
+	 ***************************************************************/
+	class ReconfigWaiter
+	{
+	public:
+		virtual ~ReconfigWaiter() {}
+		virtual bool waitReconfig(double max_wait) = 0;
+	};
+
 	SerialLine(Espia::SerialLine& espia_ser_line);
+	SerialLine(HwSerialLine& hw_ser_line);
 	virtual ~SerialLine();
 
+	bool hasEspiaSerialLine();
 	Espia::SerialLine& getEspiaSerialLine();
+	HwSerialLine& getHwSerialLine();
 
 	virtual void write(const std::string& buffer, 
 			   bool no_wait = false);
@@ -83,31 +240,144 @@ class SerialLine : public HwSerialLine
 	virtual void setTimeout(double timeout);
 	virtual void getTimeout(double& timeout) const;
 
+	void parseMsg(const std::string& msg, MsgPartPos& msg_pos) const;
 	void splitMsg(const std::string& msg, 
 		      MsgPartStrMapType& msg_parts) const;
 	void decodeFmtResp(const std::string& ans, std::string& fmt_resp);
 
 	void sendFmtCmd(const std::string& cmd, std::string& resp);
+	// pre-encoded command without parsing nor cache handling;
+	// without wait_ack the answer is read before the next command
+	void sendFastCmd(Cmd cmd, bool wait_ack = true);
+	void getNbPendingAcks(int& nb_pending_acks);
+	// reads the available acks, throws if one of them was an error
+	void flushPendingAcks();
 
 	void writeRegister(Reg reg, int  val);
 	void readRegister (Reg reg, int& val);
 	void readFloatRegister(Reg reg, double& val);
 
+	// Serial line usage counters of a register or a command
+	struct CmdStats {
+		enum {
+			NbAckDelayBins = 8,
+		};
+		// upper limit of each ack. delay bin but the last one
+		static const double AckDelayBinLimit[NbAckDelayBins - 1];
+
+		unsigned long nb_calls;
+		unsigned long nb_cache_hits;
+		unsigned long nb_cache_misses;
+		unsigned long nb_bytes_written;
+		unsigned long nb_bytes_read;
+		unsigned long ack_delay_hist[NbAckDelayBins];
+		double ack_delay_total;
+		double sleep_time;
+		unsigned long nb_busy_retries;
+		unsigned long nb_fail_retries;
+
+		CmdStats();
+		void reset();
+		void addAckDelay(double ack_delay);
+	};
+
+	struct LatencyStats {
+		int nb_samples;
+		double p50;
+		double p90;
+		double p99;
+		double max;
+	};
+
+	void queueFmtCmd(const std::string& cmd, Request& req,
+			 Request::Priority prio = Request::Normal);
+	void queueMultiLineCmd(MultiLineCmd cmd, Request& req,
+			       Request::Priority prio = Request::Low);
+	void queueWriteRegister(Reg reg, int  val, Request& req);
+	void queueReadRegister (Reg reg, Request& req,
+				Request::Priority prio = Request::Normal);
+	void queueReadFloatRegister(Reg reg, Request& req,
+				    Request::Priority prio = Request::Normal);
+
+	void setDeferLowPrio(bool  defer_low_prio);
+	void getDeferLowPrio(bool& defer_low_prio);
+
+	void getLatencyStats(Request::Priority prio, LatencyStats& stats);
+	void resetLatencyStats();
+
+	void getRegStats(Reg reg, CmdStats& stats);
+	void getCmdStats(Cmd cmd, CmdStats& stats);
+	void getMultiLineCmdStats(MultiLineCmd cmd, CmdStats& stats);
+	void resetStats();
+	void getTotalBytes(unsigned long& nb_written, unsigned long& nb_read);
+	void addWriteRetry(Reg reg, bool busy);
+
 	int getLastWarning();
 
 	void clearCache();
 	void setCacheActive(bool  cache_act);
 	void getCacheActive(bool& cache_act);
 
+	void getCacheSnapshot(RegDoubleMapType& snapshot);
+	void setCacheSnapshot(const RegDoubleMapType& snapshot);
+
+	// changes when any RegReadoutCfg register cache entry changes
+	unsigned long getReadoutCfgGen();
+
 	void getResetTraceLog(StrList& reset_trace_log);
 
+	void setReconfigWaiter(ReconfigWaiter *reconfig_waiter);
+
  private:
 	enum RegOp {
 		None, DoCmd, ReadReg, WriteReg, DoReset, MultiRead
 	};
 	friend std::ostream& operator <<(std::ostream& os, RegOp op);
 
-	typedef std::map<Reg, int> RegValMapType;
+	// int registers are exactly represented in a double;
+	// written with both the line lock and m_cache_lock held
+	struct RegCacheEntry {
+		bool valid;
+		double val;
+	};
+
+	// Learned shape of a multi-line command response
+	struct MultiLineTiming {
+		int nb_reads;
+		int nb_lines;
+		int nb_same_lines;
+		double max_line_gap;
+	};
+
+	enum {
+		LineGapFactor = 4,
+		MultiLineStableReads = 2,
+	};
+
+	typedef std::deque<Request *> RequestQueue;
+	typedef std::vector<double> LatencyList;
+
+	enum {
+		MaxLatencySamples = 1000,
+	};
+
+	class IOThread : public Thread
+	{
+		DEB_CLASS_NAMESPC(DebModCameraCom, "SerialLine::IOThread", 
+				  "Frelon");
+	public:
+		IOThread(SerialLine& ser_line);
+		virtual ~IOThread();
+
+	protected:
+		virtual void threadFunction();
+
+	private:
+		SerialLine& m_ser_line;
+	};
+	friend class IOThread;
+
+	void init();
 
 	AutoMutex lock(int mode);
 
@@ -133,10 +403,23 @@ class SerialLine : public HwSerialLine
 
 	void readRespCleanup();
 
+	static const double AvailPollTime;
+	bool waitAvailBytes(double timeout);
+
+	void readPendingAcks(int max_pending);
+	void checkPendingErr();
+
+	static bool findAns(const std::string& ans, AnsPart& part,
+			    std::string::size_type& beg, 
+			    std::string::size_type& len);
+
 	bool isFloatReg(Reg reg);
 	template <class T>
 	void checkRegType(Reg reg);
 
+	void clearRegCache();
+	void invalidateDerivedRegs();
+	void invalidateDependRegs(Reg reg);
 	bool isRegCacheable(Reg reg);
 	template <class T>
 	bool getRegCacheVal(Reg reg, T& val);
@@ -145,35 +428,96 @@ class SerialLine : public HwSerialLine
 
 	double getRegSleepTime(Reg reg);
 
-	template <class T>
-	void readCameraRegister(Reg reg, T& val);
+	void doDeferredSleep();
+	void waitReconfig(Reg reg, double sleep_time);
+
+	void commitTransaction(Transaction& trans);
+	void writeTransactionReg(Transaction::RegResult& entry);
 
-	Espia::SerialLine& m_espia_ser_line;
+	template <class T>
+	void readCameraRegister(Reg reg, T& val, unsigned long& nb_bytes);
+	void execFmtCmd(const std::string& cmd, std::string& resp,
+			unsigned long& nb_bytes);
+
+	void countCacheHit(Reg reg);
+
+	void queueRequest(Request& req, Request::Priority prio);
+	bool isQueueIdle();
+	Request *getNextRequest();
+	void addLatencySample(Request& req);
+	bool getCachedResult(Request& req);
+	void execRequest(Request& req);
+	void ioThreadFunction();
+
+	HwSerialLine& m_hw_ser_line;
+	Espia::SerialLine *m_espia_ser_line;
 	Cond m_cond;
 	int m_last_warn;
+	// code of the last error answer, like BSY or FAI
+	std::string m_last_err_code;
 
-	RegValMapType m_reg_cache;
+	// only held during the cache updates, never while waiting
+	// for the camera: cache hits do not need the line lock
+	Mutex m_cache_lock;
+	RegCacheEntry m_reg_cache[NbRegs];
 	bool m_cache_act;
+	unsigned long m_readout_cfg_gen;
+	unsigned long m_cache_hits[NbRegs];
 	RegOp m_curr_op;
 	Reg m_curr_reg;
 	Cmd m_curr_cmd;
+	MultiLineCmd m_curr_ml_cmd;
 	bool m_curr_cache;
 	std::string m_curr_resp;
 	std::string m_curr_fmt_resp;
+	bool m_defer_sleep;
+	double m_deferred_sleep;
+	Reg m_deferred_reg;
+	ReconfigWaiter *m_reconfig_waiter;
 	StrList m_reset_trace_log;
+	std::string m_cmd_msg[NbCmds];
+	std::deque<Cmd> m_pending_acks;
+	std::string m_pending_err;
+
+	CmdStats m_reg_stats[NbRegs];
+	CmdStats m_cmd_stats[NbCmds];
+	CmdStats m_ml_cmd_stats[NbMultiLineCmds];
+	CmdStats *m_curr_stats;
+	// bytes written and read by the command in progress
+	unsigned long m_cmd_nb_bytes;
+	MultiLineTiming m_ml_timing[NbMultiLineCmds];
+
+	Cond m_queue_cond;
+	RequestQueue m_req_queue[Request::NbPriorities];
+	bool m_defer_low_prio;
+	LatencyList m_lat_list[Request::NbPriorities];
+	int m_lat_idx[Request::NbPriorities];
+	Request *m_io_curr_req;
+	bool m_io_quit;
+	IOThread *m_io_thread;
 };
 
 inline void SerialLine::readRegister(Reg reg, int& val)
 {
-	readCameraRegister(reg, val);
+	unsigned long nb_bytes;
+	readCameraRegister(reg, val, nb_bytes);
 }
 
 inline void SerialLine::readFloatRegister(Reg reg, double& val)
 {
-	readCameraRegister(reg, val);
+	unsigned long nb_bytes;
+	readCameraRegister(reg, val, nb_bytes);
 }
 
 std::ostream& operator <<(std::ostream& os, SerialLine::RegOp op);
+std::ostream& operator <<(std::ostream& os, 
+			  SerialLine::Transaction::Result result);
+std::ostream& operator <<(std::ostream& os, 
+			  SerialLine::Request::Priority prio);
+std::ostream& operator <<(std::ostream& os, 
+			  const SerialLine::LatencyStats& stats);
+std::ostream& operator <<(std::ostream& os, 
+			  const SerialLine::CmdStats& stats);
 
 
 inline AutoMutex SerialLine::lock(int mode)
@@ -0,0 +1,197 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#ifndef FRELONSIMULATOR_H
+#define FRELONSIMULATOR_H
+
+#include "FrelonModel.h"
+#include "lima/ThreadUtils.h"
+
+namespace lima
+{
+
+namespace Frelon
+{
+
+/*******************************************************************
+ * \class Simulator
+ * \brief In-process Frelon camera speaking the serial-line protocol
+ *
+ * The Simulator can replace the Espia::SerialLine given to
+ * Frelon::SerialLine or Frelon::Camera. It decodes the ">CMD[?|val]"
+ * messages and answers "!OK[:val]" / "!E:err" with the timing of a
+ * real serial link: each byte costs the configured byte time, each
+ * command the firmware processing delay.
+ *
+ * The register state, the sequencer (exposure, readout, transfer and
+ * latency phases), the image counter and the SeqTim registers are
+ * modelled. Writing a register in RegSleepMap starts a reconfiguration
+ * period during which the SPB init status bits are not good and
+ * further writes answer BSY. External triggers are not simulated.
+ *******************************************************************/
+
+class Simulator : public HwSerialLine
+{
+	DEB_CLASS_NAMESPC(DebModCameraCom, "Simulator", "Frelon");
+
+ public:
+	enum ErrType {
+		ErrNone, ErrBusy, ErrFail,
+	};
+
+	static const double DefByteTime, DefCmdDelay, DefLineDelay,
+			    DefReconfigTime, DefResetTime;
+
+	Simulator(int complex_ser_nb = DefComplexSerNb,
+		  const std::string& ver = DefVersion, int cam_char = 0);
+	virtual ~Simulator();
+
+	virtual void write(const std::string& buffer,
+			   bool no_wait = false);
+	virtual void read(std::string& buffer, int max_len,
+			  double timeout = TimeoutDefault);
+	virtual void readStr(std::string& buffer, int max_len,
+			     const std::string& term,
+			     double timeout = TimeoutDefault);
+	virtual void readLine(std::string& buffer, int max_len,
+			      double timeout = TimeoutDefault);
+	virtual void flush();
+
+	virtual void getNbAvailBytes(int& avail);
+
+	void setByteTime(double  byte_time);
+	void getByteTime(double& byte_time);
+
+	void setCmdDelay(double  cmd_delay);
+	void getCmdDelay(double& cmd_delay);
+
+	void setReconfigTime(double  reconfig_time);
+	void getReconfigTime(double& reconfig_time);
+
+	void injectError(Reg reg, ErrType err_type, int nb_times = 1);
+
+	void setRegister(Reg reg, int  val);
+	void getRegister(Reg reg, int& val);
+
+	void getNbCmds(int& nb_cmds);
+	void getNbBytes(long& nb_written, long& nb_read);
+
+	static const int DefComplexSerNb;
+	static const std::string DefVersion;
+
+ private:
+	struct OutChunk {
+		std::string data;
+		double t0;
+	};
+	typedef std::vector<OutChunk> OutChunkList;
+	typedef std::map<Reg, int> RegValMap;
+	typedef std::pair<ErrType, int> ErrCount;
+	typedef std::map<Reg, ErrCount> RegErrMap;
+
+	struct AcqTiming {
+		double exp_time;
+		double shut_time;
+		double lat_time;
+		double readout_time;
+		double transfer_time;
+		double frame_period;
+	};
+
+	struct ReadoutGeom {
+		bool ftm;
+		int ccd_lines;
+		int nb_vchan, nb_hchan;
+		int lines, pixels;
+		int shift_lines;
+		int bin_vert, bin_horz;
+		int read_lines;
+	};
+
+	void resetRegs();
+
+	double now();
+	void sendResp(const std::string& resp, double delay,
+		      double line_delay = 0);
+	void processCmd(const std::string& cmd_line);
+	void processRegCmd(Reg reg, const std::string& req,
+			   const std::string& val);
+	void processMultiLineCmd(MultiLineCmd cmd);
+	void processSeqCmd(Cmd cmd);
+
+	bool findTerm(const std::string& term, int max_len,
+		      int& len, double& t_avail);
+	void extractOut(std::string& buffer, int len);
+	int countAvail(double t);
+	void readAvail(std::string& buffer, int max_len,
+		       const std::string& term, double timeout);
+
+	bool isReconfiguring(double t);
+	bool isRegReadOnly(Reg reg);
+	int getRegVal(Reg reg, double t);
+	double getTimeUnit();
+
+	void calcAcqTiming(AcqTiming& timing);
+	void calcReadoutGeom(ReadoutGeom& geom);
+	void calcReadoutTime(double& readout_time, double& transfer_time);
+	void calcImageSize(int& width, int& height);
+	double getFirstFrameEnd();
+	void updateAcq(double t);
+	int getSeqStatus(double t);
+	int getSPBStatusA(double t);
+	int getSPBStatusE(double t);
+	void latchSeqTim();
+
+	Mutex m_mutex;
+	Model m_model;
+	std::string m_ver;
+	RegValMap m_reg_val;
+	RegErrMap m_reg_err;
+	OutChunkList m_out;
+	Timestamp m_t0;
+
+	double m_byte_time;
+	double m_cmd_delay;
+	double m_line_delay;
+	double m_reconfig_time;
+	double m_reset_time;
+	double m_reconfig_end;
+	double m_rx_end;
+
+	bool m_acq_running;
+	double m_acq_start;
+	double m_acq_stop;
+	int m_acq_nb_frames;
+	AcqTiming m_acq_timing;
+	unsigned int m_img_count;
+
+	int m_nb_cmds;
+	long m_nb_written;
+	long m_nb_read;
+};
+
+
+} // namespace Frelon
+
+} // namespace lima
+
+
+#endif // FRELONSIMULATOR_H
@@ -23,6 +23,7 @@
 #define FRELONTIMINGCTRL_H
 
 #include "FrelonModel.h"
+#include "lima/ThreadUtils.h"
 
 namespace lima
 {
@@ -56,14 +57,43 @@ class TimingCtrl
 
 	struct Config {
 		int config_hd;
-		int bin_vert;
+		int bin_vert, bin_horz;
 		int chan_mode;
 		int nb_lines_xfer;
 		int roi_enable, roi_fast, roi_kinetic;
 		int roi_line_begin, roi_line_width;
+		int roi_pixel_width;
 		int shut_elec_select;
 	};
 	typedef std::map<Config, SeqTimValues> ConfigTimingMeasureMap;
+	typedef std::vector<Config> ConfigList;
+
+	// Lines read and shifted by the sequencer in a given Config,
+	// and pixels converted in each read line
+	struct ModelGeom {
+		bool ftm;
+		int ccd_lines;
+		int nb_vchan;
+		int chan_lines, chan_pixels;
+		int read_lines, shift_lines;
+		int read_pixels;
+	};
+
+	// per-line times of the timing model, reading 1024 pixels
+	static const double LineReadTime[2];	// [config_hd]
+	static const double LineShiftTime;
+	static const double LineXferTime;
+	static const int LineReadPixels;
+	static const double ChanModeDist;
+
+	// estimates fitted on the measures of the same config family
+	static const int EstimateMinMeasures;
+	static const double EstimateMaxError;
+
+	static const int MeasureFileFormat;
+
+	static const double CalibIdleTime;
+	static const double CalibPollTime;
 
 	TimingCtrl(Camera& cam);
 	virtual ~TimingCtrl();
@@ -76,16 +106,103 @@ class TimingCtrl
 	void latchSeqTimValues(SeqTimValues& st);
 	void measureSeqTimValues(SeqTimValues& st, double timeout = -1);
 
+	// chan_roi as calculated by GeometryState::calcSetRoi
+	Config calcConfig(int chan_mode, const Bin& bin, const Roi& chan_roi,
+			  RoiMode roi_mode);
+	void calcFrameTiming(const Config& config, double exp_time, 
+			     double lat_time, FrameTiming& ft);
+	void getFrameTiming(double exp_time, double lat_time, 
+			    FrameTiming& ft);
+
+	void setMeasureFile(const std::string& measure_file);
+	void getMeasureFile(std::string& measure_file);
+	void exportMeasures(const std::string& fname);
+	void importMeasures(const std::string& fname);
+
+	void addCalibRange(const SeqTimCalibRange& range);
+	void startCalib();
+	void stopCalib();
+	void getCalibPending(int& nb_pending);
+	void yieldCalib(bool wait = true);
+
  protected:
+	class CalibThread : public Thread
+	{
+		DEB_CLASS_NAMESPC(DebModCamera, "TimingCtrl::CalibThread", 
+				  "Frelon");
+	public:
+		CalibThread(TimingCtrl& timing_ctrl);
+		virtual ~CalibThread();
+
+	protected:
+		virtual void threadFunction();
+
+	private:
+		TimingCtrl& m_timing_ctrl;
+	};
+	friend class CalibThread;
+
 	void writeRegister(Reg reg, int  val);
 	void readRegister (Reg reg, int& val);
 	void readFloatRegister(Reg reg, double& val);
 
 	Config getConfig();
+	bool getCurrMeasure(SeqTimValues& st);
+	void addMeasure(const Config& config, const SeqTimValues& st);
+	bool hasMeasure(const Config& config);
+	void getMeasures(ConfigTimingMeasureMap& measure_map);
+
+	void calcModelGeom(const Config& config, ModelGeom& geom);
+	void calcModelTime(const Config& config, double& readout_time, 
+			   double& xfer_time);
+	static bool isSameFamily(const Config& a, const Config& b);
+	bool estimateMeasure(const Config& config, SeqTimValues& st,
+			     double& error);
+	bool calibrateModel(const Config& config, double& readout_factor, 
+			    double& xfer_factor);
+	static void calcFramePeriod(double exp_time, double lat_time,
+				    FrameTiming& ft);
+
+	bool readMeasureFile(const std::string& fname, 
+			     ConfigTimingMeasureMap& measure_map);
+	void writeMeasureFile(const std::string& fname, 
+			      const ConfigTimingMeasureMap& measure_map);
+	void saveMeasure(const Config& config, const SeqTimValues& st);
+
+	bool doMeasure(SeqTimValues& st, double timeout, bool abortable);
+	bool isCalibThread();
+	bool isCalibAborted();
+	bool calibConfig(const Config& config);
+	bool measureCalibConfig(const Config& config);
+	void calibThreadFunction();
 	
 	Camera& m_cam;
 	Model& m_model;
+	// the calib thread adds measures: m_curr_lock protects the cache
 	ConfigTimingMeasureMap m_timing_measure_cache;
+	unsigned long m_measure_gen;
+	std::string m_measure_file;
+	Mutex m_measure_file_lock;
+
+	// current config, valid while the SerialLine ReadoutCfgGen is equal
+	Mutex m_curr_lock;
+	bool m_curr_config_valid;
+	unsigned long m_curr_cfg_gen;
+	Config m_curr_config;
+	bool m_curr_measure_valid;
+	unsigned long m_curr_measure_gen;
+	// measured, or estimated within EstimateMaxError
+	bool m_curr_measured;
+	SeqTimValues m_curr_measure;
+
+	Cond m_calib_cond;
+	ConfigList m_calib_list;
+	CalibThread *m_calib_thread;
+	bool m_calib_active;
+	bool m_calib_quit;
+	bool m_calib_measuring;
+	bool m_calib_abort;
+	Timestamp m_calib_yield_ts;
 };
 
 std::ostream& operator <<(std::ostream& os, const TimingCtrl::Config& config);
@@ -0,0 +1,59 @@
+############################################################################
+# This file is part of LImA, a Library for Image Acquisition
+#
+# Copyright (C) : 2009-2011
+# European Synchrotron Radiation Facility
+# BP 220, Grenoble 38043
+# FRANCE
+#
+# This is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, see <http://www.gnu.org/licenses/>.
+############################################################################
+import sys
+from Lima import Core, Frelon
+
+
+# Export/import the persistent SeqTim measures of a camera:
+#   python -m Lima.Frelon.SeqTimMeasures export|import <file> [acq_args]
+
+def usage():
+    print(f'Usage: python -m Lima.Frelon.SeqTimMeasures export|import '
+          f'<file> [frelon_acq_args ...]')
+    exit(1)
+
+def main():
+    if len(sys.argv) < 3 or sys.argv[1] not in ['export', 'import']:
+        usage()
+    action, fname = sys.argv[1:3]
+    frelon_acq_args = [int(x) for x in sys.argv[3:]]
+
+    acq = Frelon.FrelonAcq(*frelon_acq_args)
+    cam = acq.getFrelonCamera()
+    if not cam.getModel().has(Frelon.Model.SeqTim):
+        print('This script can only run on Frelons with SeqTim measurement')
+        exit(1)
+
+    if action == 'export':
+        cam.exportSeqTimMeasures(fname)
+        print(f'Exported SeqTim measures to {fname}')
+    else:
+        cam.importSeqTimMeasures(fname)
+        print(f'Imported SeqTim measures from {fname}')
+
+
+if __name__ == '__main__':
+    try:
+        main()
+    except Core.Exception as e:
+        print(e)
+        exit(1)
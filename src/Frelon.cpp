@@ -21,141 +21,182 @@
 //###########################################################################
 #include "Frelon.h"
 #include "lima/MiscUtils.h"
+#include <cassert>
+#include <algorithm>
 
 using namespace lima;
 using namespace lima::Frelon;
 using namespace std;
 
-typedef pair<Reg, string> RegPair;
-static const RegPair RegStrCList[] = {
-	RegPair(NbFrames,	"N"),
-	RegPair(ExpTime,	"I"),
-	RegPair(ShutCloseTime,	"F"),
-	RegPair(LatencyTime,	"T"),
-	RegPair(RoiLineBegin,	"RLB"),
-	RegPair(RoiLineWidth,	"RLW"),
-	RegPair(RoiPixelBegin,	"RPB"),
-	RegPair(RoiPixelWidth,	"RPW"),
-	RegPair(ChanMode,	"M"),
-	RegPair(TimeUnit,	"Z"),
-	RegPair(RoiEnable,	"R"),
-	RegPair(RoiFast,	"RF"),
-	RegPair(AntiBloom,	"BL"),
-	RegPair(BinVert,	"BV"),
-	RegPair(BinHorz,	"BH"),
-	RegPair(ConfigHD,	"CNF"),
-	RegPair(RoiKinetic,	"SPE"),
-	RegPair(ShutEnable,	"U"),
-	RegPair(HardTrigDisable,"HTD"),
-
-	RegPair(NbLinesXfer,	"NLT"),
-	RegPair(ShutElecSelect,	"SES"),
-
-	RegPair(PixelFreq,	"P"),
-	RegPair(LineFreq,	"L"),
-
-	RegPair(FlipMode,	"FLI"),
-	RegPair(IntCalib,	"IE"),
-	RegPair(DisplayImage,	"X"),
-	RegPair(AdcFloatDiode,	"ADS"),
-	RegPair(AdcSignal,	"ASS"),
-	RegPair(DarkPixelCalib,	"DPE"),
-	RegPair(DarkPixelMode,	"DPM"),
-	RegPair(ChanControl,	"CCS"),
-	RegPair(Mire,		"MIR"),
-
-	RegPair(AoiLineBegin,	"ALB"),
-	RegPair(AoiLineWidth,	"ALW"),
-	RegPair(AoiPixelBegin,	"APB"),
-	RegPair(AoiPixelWidth,	"APW"),
-	RegPair(AoiImageHeight,	"IMH"),
-	RegPair(AoiImageWidth,	"IMW"),
-	RegPair(ChanOnImage,	"COI"),
-	RegPair(ChanOnCcd,	"COC"),
-
-	RegPair(Version,	"VER"),
-	RegPair(CompSerNb,	"SN"),
-	RegPair(Warn,		"W"),
-	RegPair(LastWarn,	"LW"),
-
-	RegPair(LineClockPer,	"TLC"),
-	RegPair(PixelClockPer,	"TPC"),
-	RegPair(FirstPHIVLen,	"TFV"),
-	RegPair(PHIHSetupLen,	"THS"),
-	RegPair(SingleVertXfer,	"TOV"),
-	RegPair(SingleHorzXfer,	"TOH"),
-	RegPair(AllVertXfer,	"TAV"),
-	RegPair(AllHorzXfer,	"TAH"),
-	RegPair(ReadoutTime,	"TRD"),
-	RegPair(TransferTime,	"TTR"),
-	RegPair(CcdModesAvail,	"CMA"),
-
-	RegPair(StatusSeqA,	"SSA"),
-	RegPair(StatusSeqB,	"SSB"),
-	RegPair(StatusAMTA,	"SAA"),
-	RegPair(StatusAMTB,	"SAB"),
-	RegPair(StatusAMTC,	"SAC"),
-	RegPair(StatusAMTD,	"SAD"),
-	RegPair(StatusAMTE,	"SAE"),
-
-	RegPair(LookUpTable,	"LUT"),
-	RegPair(ImagesPerEOF,	"NEF"),
-	RegPair(WeightValDFl,	"WVD"),
-	RegPair(WeightValSig,	"WVS"),
-
-	RegPair(SeqClockFreq,	"FSC"),
-	RegPair(CamChar,	"CCH"),
-
-	RegPair(SeqTimRdOutH,		"SETA"),
-	RegPair(SeqTimRdOutL,		"SETB"),
-	RegPair(SeqTimTransferH,	"SETC"),
-	RegPair(SeqTimTransferL,	"SETD"),
-	RegPair(SeqTimEShutH,		"SETE"),
-	RegPair(SeqTimEShutL,		"SETF"),
-	RegPair(SeqTimExposureH,	"SETG"),
-	RegPair(SeqTimExposureL,	"SETH"),
-	RegPair(SeqTimFramePeriodH,	"SETI"),
-	RegPair(SeqTimFramePeriodL,	"SETJ"),
+// reg, mnemonic, flags, sleep_time, timeout
+const RegProp lima::Frelon::RegPropList[NbRegs] = {
+	{NbFrames,		"N",	RegCacheable, 0, 0},
+	{ExpTime,		"I",	RegCacheable, 0, 0},
+	{ShutCloseTime,		"F",	RegCacheable, 0, 0},
+	{LatencyTime,		"T",	RegCacheable, 0, 0},
+	{RoiLineBegin,		"RLB",	RegCacheable | RegRoiCfg, 0, 0},
+	{RoiLineWidth,		"RLW",	RegCacheable | RegRoiCfg, 0, 0},
+	{RoiPixelBegin,		"RPB",	RegCacheable | RegRoiCfg, 0, 0},
+	{RoiPixelWidth,		"RPW",	RegCacheable | RegRoiCfg, 0, 0},
+	{ChanMode,		"M",	RegCacheable | RegChanCfg, 0, 0},
+	{TimeUnit,		"Z",	RegCacheable, 0, 0},
+	{RoiEnable,		"R",	RegCacheable | RegRoiCfg, 0, 0},
+	{RoiFast,		"RF",	RegCacheable | RegRoiCfg, 0, 0},
+	{AntiBloom,		"BL",	0, 0, 0},
+	{BinVert,		"BV",	RegCacheable | RegBinCfg, 0, 0},
+	{BinHorz,		"BH",	RegCacheable | RegBinCfg, 2.0, 10.0},
+	{ConfigHD,		"CNF",	RegCacheable | RegTimingCfg, 2.0, 10.0},
+	{RoiKinetic,		"SPE",	RegCacheable | RegRoiCfg, 0, 0},
+	{ShutEnable,		"U",	RegCacheable, 0, 0},
+	{HardTrigDisable,	"HTD",	RegCacheable, 0, 0},
+
+	{NbLinesXfer,		"NLT",	RegCacheable | RegTimingCfg, 0, 0},
+	{ShutElecSelect,	"SES",	RegCacheable | RegTimingCfg, 0, 0},
+
+	{PixelFreq,		"P",	0, 0, 0},
+	{LineFreq,		"L",	0, 0, 0},
+
+	{FlipMode,		"FLI",	RegCacheable | RegChanCfg, 0, 0},
+	{IntCalib,		"IE",	0, 0, 0},
+	{DisplayImage,		"X",	0, 0, 0},
+	{AdcFloatDiode,		"ADS",	0, 0, 0},
+	{AdcSignal,		"ASS",	0, 0, 0},
+	{DarkPixelCalib,	"DPE",	0, 0, 0},
+	{DarkPixelMode,		"DPM",	0, 0, 0},
+	{ChanControl,		"CCS",	0, 0, 0},
+	{Mire,			"MIR",	0, 0, 0},
+
+	{AoiLineBegin,		"ALB",	0, 0, 0},
+	{AoiLineWidth,		"ALW",	0, 0, 0},
+	{AoiPixelBegin,		"APB",	0, 0, 0},
+	{AoiPixelWidth,		"APW",	0, 0, 0},
+	{AoiImageHeight,	"IMH",	RegCacheable | RegDerived, 0, 0},
+	{AoiImageWidth,		"IMW",	RegCacheable | RegDerived, 0, 0},
+	{ChanOnImage,		"COI",	0, 0, 0},
+	{ChanOnCcd,		"COC",	0, 0, 0},
+
+	{Version,		"VER",	0, 0, 0},
+	{CompSerNb,		"SN",	RegCacheable, 0, 0},
+	{Warn,			"W",	0, 0, 0},
+	{LastWarn,		"LW",	0, 0, 0},
+
+	{LineClockPer,		"TLC",	0, 0, 0},
+	{PixelClockPer,		"TPC",	0, 0, 0},
+	{FirstPHIVLen,		"TFV",	0, 0, 0},
+	{PHIHSetupLen,		"THS",	0, 0, 0},
+	{SingleVertXfer,	"TOV",	0, 0, 0},
+	{SingleHorzXfer,	"TOH",	0, 0, 0},
+	{AllVertXfer,		"TAV",	0, 0, 0},
+	{AllHorzXfer,		"TAH",	0, 0, 0},
+	{ReadoutTime,		"TRD",	RegCacheable | RegFloat | RegDerived, 0, 0},
+	{TransferTime,		"TTR",	RegCacheable | RegFloat | RegDerived, 0, 0},
+	{CcdModesAvail,		"CMA",	RegCacheable, 0, 0},
+
+	{StatusSeqA,		"SSA",	0, 0, 0},
+	{StatusSeqB,		"SSB",	0, 0, 0},
+	{StatusAMTA,		"SAA",	0, 0, 0},
+	{StatusAMTB,		"SAB",	0, 0, 0},
+	{StatusAMTC,		"SAC",	0, 0, 0},
+	{StatusAMTD,		"SAD",	0, 0, 0},
+	{StatusAMTE,		"SAE",	0, 0, 0},
+
+	{LookUpTable,		"LUT",	0, 2.0, 0},
+	{ImagesPerEOF,		"NEF",	RegCacheable, 0, 0},
+	{WeightValDFl,		"WVD",	RegSigned, 0, 0},
+	{WeightValSig,		"WVS",	RegSigned, 0, 0},
+
+	{SeqClockFreq,		"FSC",	0, 0, 0},
+	{CamChar,		"CCH",	0, 0, 0},
+
+	{SeqTimRdOutH,		"SETA",	0, 0, 0},
+	{SeqTimRdOutL,		"SETB",	0, 0, 0},
+	{SeqTimTransferH,	"SETC",	0, 0, 0},
+	{SeqTimTransferL,	"SETD",	0, 0, 0},
+	{SeqTimEShutH,		"SETE",	0, 0, 0},
+	{SeqTimEShutL,		"SETF",	0, 0, 0},
+	{SeqTimExposureH,	"SETG",	0, 0, 0},
+	{SeqTimExposureL,	"SETH",	0, 0, 0},
+	{SeqTimFramePeriodH,	"SETI",	0, 0, 0},
+	{SeqTimFramePeriodL,	"SETJ",	0, 0, 0},
 
 };
-RegStrMapType lima::Frelon::RegStrMap(C_LIST_ITERS(RegStrCList));
-
-static Reg CacheableRegCList[] = {
-	NbFrames,	ExpTime,	ShutCloseTime,	LatencyTime,
-	RoiLineBegin,	RoiLineWidth,	RoiPixelBegin,	RoiPixelWidth,
-	ChanMode,	TimeUnit,	RoiEnable,	RoiFast,
-	RoiKinetic,	BinVert,	BinHorz,	ConfigHD,
-	ShutEnable,	HardTrigDisable, FlipMode,	CompSerNb,
-	CcdModesAvail,	ImagesPerEOF,   NbLinesXfer,    ShutElecSelect,
-};
-RegListType 
-lima::Frelon::CacheableRegList(C_LIST_ITERS(CacheableRegCList));
 
-static Reg FloatRegCList[] = {
-	ReadoutTime,
-};
-RegListType lima::Frelon::FloatRegList(C_LIST_ITERS(FloatRegCList));
+static bool CheckRegPropList()
+{
+	for (int i = 0; i < NbRegs; ++i)
+		if (RegPropList[i].reg != i)
+			return false;
+	return true;
+}
 
-static Reg SignedRegCList[] = {
-	WeightValDFl,
-	WeightValSig,
-};
-RegListType lima::Frelon::SignedRegList(C_LIST_ITERS(SignedRegCList));
+template <class M>
+static M BuildRegMap(typename M::mapped_type (*get)(const RegProp& prop))
+{
+	assert(CheckRegPropList());
+	M m;
+	for (int i = 0; i < NbRegs; ++i) {
+		typename M::mapped_type val = get(RegPropList[i]);
+		if (val != typename M::mapped_type())
+			m[Reg(i)] = val;
+	}
+	return m;
+}
+
+static string GetRegStr(const RegProp& prop)
+{ return prop.str; }
+static double GetRegSleepTime(const RegProp& prop)
+{ return prop.sleep_time; }
+static double GetRegTimeout(const RegProp& prop)
+{ return prop.timeout; }
+
+static RegListType BuildRegList(RegFlag flag)
+{
+	RegListType l;
+	for (int i = 0; i < NbRegs; ++i)
+		if (RegPropList[i].flags & flag)
+			l.push_back(Reg(i));
+	return l;
+}
 
-typedef pair<Reg, double> RegDoublePair;
+RegStrMapType 
+lima::Frelon::RegStrMap(BuildRegMap<RegStrMapType>(GetRegStr));
 
-static const RegDoublePair RegSleepCList[] = {
-	RegDoublePair(ConfigHD,    2.0),
-	RegDoublePair(BinHorz,     2.0),
-	RegDoublePair(LookUpTable, 2.0),
+RegListType lima::Frelon::CacheableRegList(BuildRegList(RegCacheable));
+RegListType lima::Frelon::FloatRegList(BuildRegList(RegFloat));
+RegListType lima::Frelon::SignedRegList(BuildRegList(RegSigned));
+
+// derived reg, Reg*Cfg groups of the registers it is computed from
+struct RegDep {
+	Reg reg;
+	int inputs;
 };
-RegDoubleMapType lima::Frelon::RegSleepMap(C_LIST_ITERS(RegSleepCList));
 
-static const RegDoublePair RegTimeoutCList[] = {
-	RegDoublePair(ConfigHD,    10.0),
-	RegDoublePair(BinHorz,     10.0),
+static const RegDep RegDepCList[] = {
+	{ReadoutTime,		RegReadoutCfg},
+	{TransferTime,		RegReadoutCfg},
+	{AoiImageHeight,	RegRoiCfg | RegBinCfg | RegChanCfg},
+	{AoiImageWidth,		RegRoiCfg | RegBinCfg | RegChanCfg},
 };
-RegDoubleMapType lima::Frelon::RegTimeoutMap(C_LIST_ITERS(RegTimeoutCList));
+
+static RegListMapType BuildRegDependMap()
+{
+	RegListMapType m;
+	const RegDep *it, *end = C_LIST_END(RegDepCList);
+	for (it = RegDepCList; it != end; ++it) {
+		assert(HasRegFlag(it->reg, RegDerived));
+		for (int i = 0; i < NbRegs; ++i)
+			if (RegPropList[i].flags & it->inputs)
+				m[Reg(i)].push_back(it->reg);
+	}
+	return m;
+}
+
+RegListMapType lima::Frelon::RegDependMap(BuildRegDependMap());
+
+RegDoubleMapType 
+lima::Frelon::RegSleepMap(BuildRegMap<RegDoubleMapType>(GetRegSleepTime));
+RegDoubleMapType 
+lima::Frelon::RegTimeoutMap(BuildRegMap<RegDoubleMapType>(GetRegTimeout));
 
 const int lima::Frelon::MaxRegVal = (1 << 16) - 1;
 
@@ -199,6 +240,82 @@ MultiLineCmdStrMapType
 lima::Frelon::MultiLineCmdStrMap(C_LIST_ITERS(MLCmdStrCList));
 
 
+template <class T>
+class MnemonicIndex
+{
+ public:
+	template <class M>
+	MnemonicIndex(const M& str_map)
+	{
+		typename M::const_iterator it, end = str_map.end();
+		for (it = str_map.begin(); it != end; ++it) {
+			unsigned int key = 0;
+			bool valid_key = getKey(it->second, key);
+			assert(valid_key);
+			(void) valid_key;
+			m_list.push_back(KeyPair(key, it->first));
+		}
+		sort(m_list.begin(), m_list.end(), KeyLess());
+	}
+
+	bool find(const string& str, T& val) const
+	{
+		unsigned int key;
+		if (!getKey(str, key))
+			return false;
+		typename KeyList::const_iterator it, end = m_list.end();
+		it = lower_bound(m_list.begin(), end, KeyPair(key, T()), 
+				 KeyLess());
+		if ((it == end) || (it->first != key))
+			return false;
+		val = it->second;
+		return true;
+	}
+
+ private:
+	typedef pair<unsigned int, T> KeyPair;
+	typedef vector<KeyPair> KeyList;
+
+	struct KeyLess {
+		bool operator()(const KeyPair& a, const KeyPair& b) const
+		{ return a.first < b.first; }
+	};
+
+	// mnemonics have at most 4 chars: pack them in an int
+	static bool getKey(const string& str, unsigned int& key)
+	{
+		if (str.empty() || (str.size() > sizeof(key)))
+			return false;
+		key = 0;
+		for (string::size_type i = 0; i < str.size(); ++i)
+			key = (key << 8) | (unsigned char) str[i];
+		return true;
+	}
+
+	KeyList m_list;
+};
+
+static const MnemonicIndex<Reg> RegIndex(RegStrMap);
+static const MnemonicIndex<Cmd> CmdIndex(CmdStrMap);
+static const MnemonicIndex<MultiLineCmd> MultiLineCmdIndex(MultiLineCmdStrMap);
+
+bool lima::Frelon::FindRegByStr(const string& str, Reg& reg)
+{
+	return RegIndex.find(str, reg);
+}
+
+bool lima::Frelon::FindCmdByStr(const string& str, Cmd& cmd)
+{
+	return CmdIndex.find(str, cmd);
+}
+
+bool lima::Frelon::FindMultiLineCmdByStr(const string& str, 
+					 MultiLineCmd& cmd)
+{
+	return MultiLineCmdIndex.find(str, cmd);
+}
+
+
 typedef pair<FrameTransferMode, string> FTMStrPair;
 static const FTMStrPair FTMNameCList[] = {
 	FTMStrPair(FFM, "FFM"),
@@ -305,3 +422,32 @@ std::ostream& lima::Frelon::operator <<(std::ostream& os,
 		  << "frame_period=" << st.frame_period << ", "
 		  << ">";
 }
+
+std::ostream& lima::Frelon::operator <<(std::ostream& os,
+					const FrameTiming& ft)
+{
+	return os << "<"
+		  << "readout_time=" << ft.readout_time << ", "
+		  << "transfer_time=" << ft.transfer_time << ", "
+		  << "dead_time=" << ft.dead_time << ", "
+		  << "frame_period=" << ft.frame_period << ", "
+		  << "max_frame_rate=" << ft.max_frame_rate << ", "
+		  << "predicted=" << ft.predicted << ", "
+		  << "error=" << ft.error
+		  << ">";
+}
+
+std::ostream& lima::Frelon::operator <<(std::ostream& os, 
+					const SeqTimCalibRange& range)
+{
+	return os << "<"
+		  << "chan_mode=" << range.chan_mode << ", "
+		  << "bin_vert=" << range.bin_vert_first << "-" 
+		  << range.bin_vert_last << ", "
+		  << "roi_mode=" << range.roi_mode << ", "
+		  << "roi_line_begin=" << range.roi_line_begin << ", "
+		  << "roi_line_width=" << range.roi_line_width_first << "-"
+		  << range.roi_line_width_last << "/" 
+		  << range.roi_line_width_step
+		  << ">";
+}
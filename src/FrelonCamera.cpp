@@ -20,7 +20,12 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include "FrelonCamera.h"
+#include "lima/MiscUtils.h"
 #include <iomanip>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <ctime>
 
 using namespace lima;
 using namespace lima::Frelon;
@@ -79,13 +84,90 @@ const double Camera::ResetLinkWaitTime = 5;
 const double Camera::UpdateCcdStatusTime = 0.1;
 const double Camera::MaxIdleWaitTime = 2.5;
 const double Camera::MaxBusyRetryTime = 0.2;	// 16 Mpixel image Aurora Xfer
+const double Camera::ReconfigPollTime = 10e-3;
+const double Camera::ReconfigMaxPollTime = 0.2;
+const double Camera::WaitStatusPollTime = 1e-3;
+const double Camera::WaitStatusMaxPollTime = 50e-3;
+const double Camera::WaitStatusGuardTime = 10e-3;
+const double Camera::WaitStatusGuardFactor = 0.1;
+const double Camera::DefStatusMaxAge = 0;
+const int Camera::MaxImageCountRetries = 2;
+const double Camera::ReadoutModeMinGain = 0.01;
+const double Camera::ReadoutModePredMargin = 0.05;
+const std::string Camera::SeqTimFileExt = ".seqtim";
+
+Camera::ReconfigWaiter::ReconfigWaiter(Camera& cam)
+	: m_cam(cam)
+{
+	DEB_CONSTRUCTOR();
+}
 
-Camera::Camera(Espia::SerialLine& espia_ser_line)
-	: m_ser_line(espia_ser_line), m_auto_seq_tim_measure(true)
+bool Camera::ReconfigWaiter::waitReconfig(double max_wait)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(max_wait);
+
+	// the SPB init status bits are only reliable with good HTD
+	if (!m_cam.m_model.has(Model::GoodHTD))
+		return false;
+
+	Timestamp end = Timestamp::now() + Timestamp(max_wait);
+	double poll_time = ReconfigPollTime;
+	while (true) {
+		Sleep(poll_time);
+		Status spb_status = m_cam.getSPBStatus(false);
+		if (!(spb_status & InInit))
+			break;
+		if (Timestamp::now() >= end) {
+			DEB_WARNING() << "Camera still in init after " 
+				      << DEB_VAR1(max_wait);
+			break;
+		}
+		poll_time = min(poll_time * 2, ReconfigMaxPollTime);
+	}
+	return true;
+}
+
+Camera::Camera(Espia::SerialLine& espia_ser_line, const string& cache_file)
+	: m_ser_line(espia_ser_line), m_reconfig_waiter(*this), 
+	  m_cache_file(cache_file), m_auto_seq_tim_measure(true)
 {
 	DEB_CONSTRUCTOR();
+	init();
+}
+
+Camera::Camera(HwSerialLine& hw_ser_line, const string& cache_file)
+	: m_ser_line(hw_ser_line), m_reconfig_waiter(*this), 
+	  m_cache_file(cache_file), m_auto_seq_tim_measure(true)
+{
+	DEB_CONSTRUCTOR();
+	init();
+}
+
+void Camera::init()
+{
+	DEB_MEMBER_FUNCT();
 
 	m_timing_ctrl = new TimingCtrl(*this);
+	m_ser_line.setReconfigWaiter(&m_reconfig_waiter);
+
+	WaitStatusStats wait_stats = {0, 0, 0, 0, 0, 0};
+	m_wait_stats = wait_stats;
+
+	for (int i = 0; i < 2; ++i) {
+		for (int j = 0; j < 2; ++j) {
+			m_status_cache[i][j].reading = false;
+			m_status_cache[i][j].timestamp = Timestamp();
+			m_status_cache[i][j].gen = 0;
+			m_status_cache[i][j].read_gen = 0;
+		}
+	}
+	m_status_max_age = DefStatusMaxAge;
+
+	m_img_count_base = 0;
+	m_img_count_last = 0;
+	m_trig_ack = true;
+	m_acq_time_est = 0;
 
 	sync();
 }
@@ -94,28 +176,44 @@ Camera::~Camera()
 {
 	DEB_DESTRUCTOR();
 
+	m_timing_ctrl->stopCalib();
 	stop();
+	m_ser_line.setReconfigWaiter(NULL);
+
+	if (!m_cache_file.empty()) {
+		try {
+			saveCacheFile();
+		} catch (Exception e) {
+			DEB_WARNING() << "Could not save register cache: "
+				      << e.getErrMsg();
+		}
+	}
 }
 
 void Camera::sync()
 {
 	DEB_MEMBER_FUNCT();
 
-	Espia::Dev& dev = getEspiaDev();
-	int chan_up_led;
-	dev.getChanUpLed(chan_up_led);
-	if (!chan_up_led) {
-		DEB_WARNING() << "Aurora link down. Forcing a link reset!";
-		dev.resetLink();
-		DEB_TRACE() << "Sleeping additional "
-			    << DEB_VAR1(Frelon::Camera::ResetLinkWaitTime);
-		Sleep(ResetLinkWaitTime);
+	if (hasEspiaDev()) {
+		Espia::Dev& dev = getEspiaDev();
+		int chan_up_led;
+		dev.getChanUpLed(chan_up_led);
+		if (!chan_up_led) {
+			DEB_WARNING() << "Aurora link down. "
+				      << "Forcing a link reset!";
+			dev.resetLink();
+			DEB_TRACE() << "Sleeping additional "
+				    << DEB_VAR1(ResetLinkWaitTime);
+			Sleep(ResetLinkWaitTime);
+		}
 	}
 
 	DEB_TRACE() << "Synchronizing with the camera";
 
 	m_model.reset();
 	m_started = false;
+	clearAcqEnd();
+	invalidateStatusCache();
 
 	try {
 		syncRegs();
@@ -150,7 +248,8 @@ void Camera::syncRegs()
 	int complex_ser_nb;
 	getComplexSerialNb(complex_ser_nb);
 	m_model.setComplexSerialNb(complex_ser_nb);
-	if (m_model.has(Model::CamChar)) {
+	bool warm_start = loadCacheFile(ver, complex_ser_nb);
+	if (!warm_start && m_model.has(Model::CamChar)) {
 		int cam_char;
 		readRegister(CamChar, cam_char);
 		m_model.setCamChar(cam_char);
@@ -167,6 +266,8 @@ void Camera::syncRegs()
 			break;
 		}
 	}
+	// the model and SPB connection may have changed since the last sync
+	m_geom->clearChanXformMap();
 
 	if (m_model.has(Model::GoodHTD))
 		syncRegsGoodHTD();
@@ -185,6 +286,139 @@ void Camera::syncRegs()
 	Sleep(UpdateCcdStatusTime);
 
 	m_geom->sync();
+
+	if (!m_cache_file.empty()) {
+		saveCacheFile();
+		if (m_model.has(Model::SeqTim)) {
+			string measure_file = m_cache_file + SeqTimFileExt;
+			m_timing_ctrl->setMeasureFile(measure_file);
+		}
+	}
+}
+
+void Camera::getCacheFile(string& cache_file)
+{
+	DEB_MEMBER_FUNCT();
+	cache_file = m_cache_file;
+	DEB_RETURN() << DEB_VAR1(cache_file);
+}
+
+static const Reg CacheSentinelRegs[] = {
+	ExpTime, ChanMode, BinVert,
+};
+
+void Camera::saveCacheFile()
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(m_cache_file);
+
+	if (m_cache_file.empty())
+		THROW_HW_ERROR(InvalidValue) << "No register cache file";
+
+	string ver;
+	m_model.getFirmware().getVersionStr(ver);
+	int complex_ser_nb, cam_char;
+	m_model.getComplexSerialNb(complex_ser_nb);
+	m_model.getCamChar(cam_char);
+
+	RegDoubleMapType snapshot;
+	m_ser_line.getCacheSnapshot(snapshot);
+
+	// written aside and renamed, so a crash never leaves half a file
+	string tmp_file = m_cache_file + ".tmp";
+	ofstream os(tmp_file.c_str());
+	os.precision(15);
+	os << "# Frelon register cache" << endl
+	   << RegStrMap[Version] << " " << ver << endl
+	   << RegStrMap[CompSerNb] << " " << complex_ser_nb << endl
+	   << RegStrMap[CamChar] << " " << cam_char << endl;
+	RegDoubleMapType::const_iterator it, end = snapshot.end();
+	for (it = snapshot.begin(); it != end; ++it)
+		if (it->first != CompSerNb)
+			os << GetRegProp(it->first).str << " " 
+			   << it->second << endl;
+	os.close();
+	if (!os || (rename(tmp_file.c_str(), m_cache_file.c_str()) != 0))
+		THROW_HW_ERROR(Error) << "Error writing " 
+				      << DEB_VAR1(m_cache_file);
+	DEB_TRACE() << "Saved " << snapshot.size() << " registers";
+}
+
+bool Camera::loadCacheFile(const string& ver, int complex_ser_nb)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(m_cache_file, ver, complex_ser_nb);
+
+	if (m_cache_file.empty())
+		return false;
+
+	ifstream is(m_cache_file.c_str());
+	if (!is) {
+		DEB_TRACE() << "No register cache file";
+		return false;
+	}
+
+	string file_ver;
+	int file_ser_nb = 0, file_cam_char = 0;
+	RegDoubleMapType snapshot;
+	string line;
+	while (getline(is, line)) {
+		if (line.empty() || (line[0] == '#'))
+			continue;
+		istringstream line_is(line);
+		string reg_str;
+		line_is >> reg_str;
+		Reg reg;
+		if (!FindRegByStr(reg_str, reg)) {
+			DEB_WARNING() << "Invalid register cache line: " 
+				      << DEB_VAR1(line);
+			return false;
+		}
+		if (reg == Version) {
+			line_is >> file_ver;
+			continue;
+		}
+		double val;
+		line_is >> val;
+		if (!line_is) {
+			DEB_WARNING() << "Invalid register cache line: " 
+				      << DEB_VAR1(line);
+			return false;
+		}
+		if (reg == CompSerNb)
+			file_ser_nb = int(val);
+		else if (reg == CamChar)
+			file_cam_char = int(val);
+		else if (HasRegFlag(reg, RegCacheable))
+			snapshot[reg] = val;
+	}
+
+	if ((file_ver != ver) || (file_ser_nb != complex_ser_nb)) {
+		DEB_TRACE() << "Register cache from another camera: "
+			    << DEB_VAR2(file_ver, file_ser_nb);
+		return false;
+	}
+
+	// a few registers are checked to detect outside changes
+	const Reg *it, *end = C_LIST_END(CacheSentinelRegs);
+	for (it = CacheSentinelRegs; it != end; ++it) {
+		RegDoubleMapType::const_iterator sit = snapshot.find(*it);
+		int val;
+		readRegister(*it, val);
+		if ((sit == snapshot.end()) || (sit->second != val)) {
+			DEB_TRACE() << "Register cache is stale: " 
+				    << DEB_VAR2(*it, val);
+			return false;
+		}
+	}
+
+	// the NbFrames write in syncRegs must reach the sequencer
+	snapshot.erase(NbFrames);
+	m_ser_line.setCacheSnapshot(snapshot);
+	if (m_model.has(Model::CamChar))
+		m_model.setCamChar(file_cam_char);
+	DEB_TRACE() << "Restored " << snapshot.size() << " registers";
+	return true;
 }
 
 void Camera::syncRegsGoodHTD()
@@ -243,12 +477,14 @@ void Camera::syncRegsBadHTD()
 				      << DEB_VAR1(DEB_HEX(status));
 	}
 					  
-	Espia::Dev& dev = getEspiaDev();
-	DEB_TRACE() << "Forcing Aurora link reset on old firmware!";
-	dev.resetLink();
-	DEB_TRACE() << "Sleeping additional "
-		    << DEB_VAR1(Frelon::Camera::ResetLinkWaitTime);
-	Sleep(ResetLinkWaitTime);
+	if (hasEspiaDev()) {
+		Espia::Dev& dev = getEspiaDev();
+		DEB_TRACE() << "Forcing Aurora link reset on old firmware!";
+		dev.resetLink();
+		DEB_TRACE() << "Sleeping additional "
+			    << DEB_VAR1(Frelon::Camera::ResetLinkWaitTime);
+		Sleep(ResetLinkWaitTime);
+	}
 
 	if (m_model.has(Model::HTDCmd))
 		setExtSyncEnable(ExtSyncBoth);
@@ -260,6 +496,11 @@ SerialLine& Camera::getSerialLine()
 	return m_ser_line;
 }
 
+bool Camera::hasEspiaDev()
+{
+	return m_ser_line.hasEspiaSerialLine();
+}
+
 Espia::Dev& Camera::getEspiaDev()
 {
 	Espia::SerialLine& ser_line = m_ser_line.getEspiaSerialLine();
@@ -283,9 +524,11 @@ void Camera::sendCmd(Cmd cmd)
 
 	string resp;
 	m_ser_line.sendFmtCmd(cmd_str, resp);
+	invalidateStatusCache();
 }
 
-void Camera::writeRegister(Reg reg, int val)
+template <class Op>
+void Camera::writeWithRetry(Op& op)
 {
 	DEB_MEMBER_FUNCT();
 
@@ -295,7 +538,7 @@ void Camera::writeRegister(Reg reg, int val)
 	for (retry = 0, end = false; !end; retry++) {
 		bool fail, busy;
 		try {
-			m_ser_line.writeRegister(reg, val);
+			op();
 			if (retry > 0)
 				DEB_WARNING() << "Succeeded after " << retry 
 					      << " retrie(s)";
@@ -325,8 +568,10 @@ void Camera::writeRegister(Reg reg, int val)
 			end = ((Timestamp::now() - t0) >= MaxBusyRetryTime);
 		else
 			end = (retry > 0);
-		if (!end)
+		if (!end) {
 			DEB_TRACE() << "Retrying ...";
+			op.countRetry(busy);
+		}
 	}
 
 	if (prev_busy)
@@ -337,18 +582,90 @@ void Camera::writeRegister(Reg reg, int val)
 				      << retry << " retrie(s)";
 }
 
+struct SingleRegWrite {
+	SerialLine& ser_line;
+	Reg reg;
+	int val;
+
+	void operator()()
+	{ ser_line.writeRegister(reg, val); }
+
+	void countRetry(bool busy)
+	{ ser_line.addWriteRetry(reg, busy); }
+};
+
+void Camera::writeRegister(Reg reg, int val)
+{
+	DEB_MEMBER_FUNCT();
+	m_timing_ctrl->yieldCalib();
+	SingleRegWrite op = {m_ser_line, reg, val};
+	writeWithRetry(op);
+}
+
+struct TransactionCommit {
+	SerialLine& ser_line;
+	SerialLine::Transaction& trans;
+
+	void operator()()
+	{ trans.commit(); }
+
+	void countRetry(bool busy)
+	{
+		typedef SerialLine::Transaction::ResultList ResultList;
+		const ResultList& list = trans.getResults();
+		ResultList::const_iterator it, end = list.end();
+		for (it = list.begin(); it != end; ++it)
+			if (it->result == SerialLine::Transaction::Failed)
+				ser_line.addWriteRetry(it->reg, busy);
+	}
+};
+
+void Camera::commitTransaction(SerialLine::Transaction& trans)
+{
+	DEB_MEMBER_FUNCT();
+	m_timing_ctrl->yieldCalib();
+	TransactionCommit op = {m_ser_line, trans};
+	writeWithRetry(op);
+}
+
 void Camera::readRegister(Reg reg, int& val)
 {
 	DEB_MEMBER_FUNCT();
+	m_timing_ctrl->yieldCalib();
 	m_ser_line.readRegister(reg, val);
 }
 
 void Camera::readFloatRegister(Reg reg, double& val)
 {
 	DEB_MEMBER_FUNCT();
+	m_timing_ctrl->yieldCalib();
 	m_ser_line.readFloatRegister(reg, val);
 }
 
+void Camera::readStatusRegister(Reg reg, int& val, bool use_queue,
+				unsigned long *nb_bytes)
+{
+	DEB_MEMBER_FUNCT();
+	// status reads can come from the ReconfigWaiter, holding the
+	// SerialLine lock, or be awaited by the calib thread: no wait
+	if (!use_queue) {
+		m_timing_ctrl->yieldCalib(false);
+		m_ser_line.readRegister(reg, val);
+	} else {
+		// status polls go before the queued configuration traffic
+		SerialLine::Request req;
+		m_ser_line.queueReadRegister(reg, req, 
+					     SerialLine::Request::High);
+		req.wait();
+		val = req.getVal();
+		if (nb_bytes)
+			*nb_bytes += req.getNbBytes();
+	}
+
+	// a failed un-acknowledged Start must not be reported as running
+	m_ser_line.flushPendingAcks();
+}
+
 void Camera::hardReset()
 {
 	DEB_MEMBER_FUNCT();
@@ -482,6 +799,12 @@ void Camera::getRoiMode(RoiMode& roi_mode)
 	m_geom->getRoiMode(roi_mode);
 }
 
+void Camera::getGeometryState(GeometryState& state)
+{
+	DEB_MEMBER_FUNCT();
+	m_geom->getState(state);
+}
+
 void Camera::checkRoi(const Roi& set_roi, Roi& hw_roi)
 {
 	DEB_MEMBER_FUNCT();
@@ -714,6 +1037,214 @@ void Camera::getTotalLatTime(double& lat_time)
 	DEB_RETURN() << DEB_VAR1(lat_time);
 }
 
+void Camera::calcFrameTiming(FrameTransferMode ftm, InputChan input_chan,
+			     const Bin& bin, const Roi& roi, RoiMode roi_mode,
+			     double exp_time, double lat_time, FrameTiming& ft)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR4(FTMNameMap[ftm], DEB_HEX(input_chan), 
+				bin, roi);
+	DEB_PARAM() << DEB_VAR3(roi_mode, exp_time, lat_time);
+
+	int chan_mode;
+	m_geom->calcChanMode(ftm, input_chan, chan_mode);
+	// the sequencer sees the ROI lines in channel coordinates
+	Roi chan_roi;
+	if ((roi_mode != None) && !roi.isEmpty()) {
+		GeometryState state;
+		m_geom->calcState(chan_mode, bin, state);
+		Roi hw_roi;
+		Point chan_roi_offset;
+		state.calcSetRoi(roi, hw_roi, chan_roi, chan_roi_offset);
+	}
+	TimingCtrl::Config config;
+	config = m_timing_ctrl->calcConfig(chan_mode, bin, chan_roi, 
+					   roi_mode);
+	m_timing_ctrl->calcFrameTiming(config, exp_time, lat_time, ft);
+	DEB_RETURN() << DEB_VAR1(ft);
+}
+
+void Camera::getFrameTiming(FrameTiming& ft)
+{
+	DEB_MEMBER_FUNCT();
+	double exp_time, lat_time;
+	getExpTime(exp_time);
+	getUserLatTime(lat_time);
+	m_timing_ctrl->getFrameTiming(exp_time, lat_time, ft);
+	DEB_RETURN() << DEB_VAR1(ft);
+}
+
+void Camera::getMaxFrameRate(double& max_frame_rate)
+{
+	DEB_MEMBER_FUNCT();
+	FrameTiming ft;
+	getFrameTiming(ft);
+	max_frame_rate = ft.max_frame_rate;
+	DEB_RETURN() << DEB_VAR1(max_frame_rate);
+}
+
+void Camera::calcFastestReadoutMode(const Roi& roi, ReadoutMode& mode)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(roi);
+
+	Bin bin;
+	getBin(bin);
+	double exp_time;
+	getExpTime(exp_time);
+	FrameDim max_frame_dim;
+	getMaxFrameDim(max_frame_dim);
+	Roi unbinned_roi = roi.getUnbinned(bin);
+
+	typedef vector<ReadoutMode> ReadoutModeList;
+	ReadoutModeList cand_list;
+	static const RoiMode RoiModeCList[] = { None, Slow, Fast, Kinetic };
+	FTMInputChanListMapType::const_iterator mit;
+	for (mit = FTMInputChanListMap.begin(); 
+	     mit != FTMInputChanListMap.end(); ++mit) {
+		FrameTransferMode ftm = mit->first;
+		Size frame_size = max_frame_dim.getSize();
+		if ((ftm == FTM) && !m_model.has(Model::HamaChip))
+			frame_size /= Point(1, 2);
+		bool roi_fits;
+		if (roi.isActive())
+			roi_fits = Roi(Point(0, 0), frame_size).containsRoi(
+								unbinned_roi);
+		else
+			roi_fits = (frame_size == max_frame_dim.getSize());
+		if (!roi_fits)
+			continue;
+
+		const InputChanList& chan_list = mit->second;
+		InputChanList::const_iterator cit, cend = chan_list.end();
+		for (cit = chan_list.begin(); cit != cend; ++cit) {
+			if (!m_geom->isInputChanAvail(ftm, *cit))
+				continue;
+			const RoiMode *rit, *rend = C_LIST_END(RoiModeCList);
+			for (rit = RoiModeCList; rit != rend; ++rit) {
+				if (roi.isActive() == (*rit == None))
+					continue;
+				ReadoutMode cand = {ftm, *cit, *rit,
+						    {0, 0, 0, 0, 0, true, -1}};
+				cand_list.push_back(cand);
+			}
+		}
+	}
+
+	// the current mode goes first: others must be significantly faster
+	ReadoutMode curr;
+	getFrameTransferMode(curr.ftm);
+	getInputChan(curr.input_chan);
+	getRoiMode(curr.roi_mode);
+	if (!roi.isActive())
+		curr.roi_mode = None;
+	else if (curr.roi_mode == None)
+		curr.roi_mode = Slow;
+	ReadoutModeList::iterator it, end = cand_list.end();
+	for (it = cand_list.begin(); it != end; ++it) {
+		bool is_curr = ((it->ftm == curr.ftm) && 
+				(it->input_chan == curr.input_chan) &&
+				(it->roi_mode == curr.roi_mode));
+		if (is_curr) {
+			rotate(cand_list.begin(), it, it + 1);
+			break;
+		}
+	}
+
+	// measured rates rank first: predicted ones must beat them by
+	// more than the model error
+	bool found = false;
+	double best_rate = 0;
+	for (it = cand_list.begin(); it != end; ++it) {
+		try {
+			if (roi.isActive()) {
+				int chan_mode;
+				m_geom->calcChanMode(it->ftm, it->input_chan,
+						     chan_mode);
+				Roi hw_roi;
+				m_geom->checkRoi(chan_mode, bin, roi, hw_roi);
+			}
+			calcFrameTiming(it->ftm, it->input_chan, bin, roi, 
+					it->roi_mode, exp_time, 0, 
+					it->timing);
+		} catch (Exception& e) {
+			DEB_TRACE() << "Skipping " 
+				    << getInputChanModeName(it->ftm, 
+							    it->input_chan)
+				    << ": " << e.getErrMsg();
+			continue;
+		}
+		double rate = it->timing.max_frame_rate;
+		bool measured = (it->timing.error == 0);
+		DEB_TRACE() << getInputChanModeName(it->ftm, it->input_chan)
+			    << " " << DEB_VAR3(it->roi_mode, rate, measured);
+		if (!measured)
+			rate /= 1 + ReadoutModePredMargin;
+		double min_rate = best_rate;
+		if (found)
+			min_rate *= 1 + ReadoutModeMinGain;
+		if (!found || (rate > min_rate)) {
+			mode = *it;
+			best_rate = rate;
+			found = true;
+		}
+	}
+	if (!found)
+		THROW_HW_ERROR(InvalidValue) << "No readout mode for " 
+					     << DEB_VAR1(roi);
+
+	DEB_RETURN() << getInputChanModeName(mode.ftm, mode.input_chan) 
+		     << " " << DEB_VAR2(mode.roi_mode, mode.timing);
+}
+
+// the final cut to roi (and the flip) is done on the hw_roi image
+void Camera::setFastestReadoutMode(const Roi& roi, Roi& hw_roi)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(roi);
+
+	ReadoutMode mode;
+	calcFastestReadoutMode(roi, mode);
+
+	// the writes go through different registers: on failure the
+	// camera is not left in a mixed mode
+	ReadoutMode prev_mode;
+	getFrameTransferMode(prev_mode.ftm);
+	getInputChan(prev_mode.input_chan);
+	getRoiMode(prev_mode.roi_mode);
+	Roi prev_roi;
+	getRoi(prev_roi);
+	try {
+		setReadoutMode(mode, roi);
+	} catch (Exception& e) {
+		DEB_ERROR() << "Restoring the previous readout mode: " 
+			    << e.getErrMsg();
+		try {
+			setReadoutMode(prev_mode, prev_roi);
+		} catch (Exception& e) {
+			DEB_ERROR() << "Could not restore the readout mode: "
+				    << e.getErrMsg();
+		}
+		throw;
+	}
+	getRoi(hw_roi);
+	DEB_RETURN() << DEB_VAR1(hw_roi);
+}
+
+void Camera::setReadoutMode(const ReadoutMode& mode, const Roi& roi)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << getInputChanModeName(mode.ftm, mode.input_chan) 
+		    << " " << DEB_VAR2(mode.roi_mode, roi);
+
+	setRoi(Roi());
+	setFrameTransferMode(mode.ftm);
+	setInputChan(mode.input_chan);
+	setRoiMode(mode.roi_mode);
+	if ((mode.roi_mode != None) && roi.isActive())
+		setRoi(roi);
+}
+
 void Camera::setNbFrames(int nb_frames)
 {
 	DEB_MEMBER_FUNCT();
@@ -776,32 +1307,159 @@ void Camera::getExtSyncEnable(ExtSync& ext_sync_ena)
 	DEB_RETURN() << DEB_VAR1(ext_sync_ena);
 }
 
-void Camera::getStatus(Status& status, bool use_ser_line, bool read_spb)
+void Camera::getStatus(Status& status, bool use_ser_line, bool read_spb,
+		       bool force_read)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(use_ser_line, read_spb, force_read);
+	unsigned long nb_bytes;
+	getCachedStatus(status, use_ser_line, read_spb, force_read, nb_bytes);
+	DEB_RETURN() << DEB_VAR1(DEB_HEX(status));
+}
+
+// nb_bytes: serial bytes of the status read done by this call, 0 if it
+// joined the read of another caller or used the cache
+void Camera::getCachedStatus(Status& status, bool use_ser_line, 
+			     bool read_spb, bool force_read, 
+			     unsigned long& nb_bytes)
 {
 	DEB_MEMBER_FUNCT();
-	DEB_PARAM() << DEB_VAR2(use_ser_line, read_spb);
 
 	bool has_good_htd = m_model.has(Model::GoodHTD);
 	if ((use_ser_line || read_spb) && !has_good_htd)
 		THROW_HW_ERROR(NotSupported) << "SPB2/ser. line status "
 			"not supported: must upgrade to good HTD firmware";
 
+	bool ser_line = (use_ser_line || !hasEspiaDev());
+	StatusCacheEntry& entry = m_status_cache[ser_line][read_spb];
+
+	// forced reads only accept a result read after the request, the
+	// others also join the read in progress, unless it was started
+	// before the last invalidation
+	AutoMutex l(m_status_cache_cond.mutex());
+	Timestamp req = Timestamp::now();
+	Timestamp min_ts = force_read ? req : req - Timestamp(m_status_max_age);
+	bool valid_read = (entry.reading && (entry.read_gen == entry.gen));
+	if (!force_read && valid_read && (entry.read_start < min_ts))
+		min_ts = entry.read_start;
+	nb_bytes = 0;
+	while (!entry.timestamp.isSet() || (entry.timestamp < min_ts)) {
+		if (!entry.reading)
+			readCachedStatus(entry, l, ser_line, read_spb, 
+					 nb_bytes);
+		else
+			m_status_cache_cond.wait();
+	}
+
+	status = entry.status;
+	DEB_RETURN() << DEB_VAR2(DEB_HEX(status), nb_bytes);
+}
+
+void Camera::setStatusMaxAge(double max_age)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(max_age);
+	if (max_age < 0)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " 
+					     << DEB_VAR1(max_age);
+	AutoMutex l(m_status_cache_cond.mutex());
+	m_status_max_age = max_age;
+}
+
+void Camera::getStatusMaxAge(double& max_age)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_status_cache_cond.mutex());
+	max_age = m_status_max_age;
+	DEB_RETURN() << DEB_VAR1(max_age);
+}
+
+void Camera::setTrigAck(bool trig_ack)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(trig_ack);
+	AutoMutex l = lock();
+	m_trig_ack = trig_ack;
+}
+
+void Camera::getTrigAck(bool& trig_ack)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l = lock();
+	trig_ack = m_trig_ack;
+	DEB_RETURN() << DEB_VAR1(trig_ack);
+}
+
+void Camera::invalidateStatusCache()
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_status_cache_cond.mutex());
+	for (int i = 0; i < 2; ++i) {
+		for (int j = 0; j < 2; ++j) {
+			m_status_cache[i][j].timestamp = Timestamp();
+			m_status_cache[i][j].gen++;
+		}
+	}
+}
+
+void Camera::readCachedStatus(StatusCacheEntry& entry, AutoMutex& l,
+			      bool use_ser_line, bool read_spb, 
+			      unsigned long& nb_bytes)
+{
+	DEB_MEMBER_FUNCT();
+
+	entry.reading = true;
+	entry.read_start = Timestamp::now();
+	entry.read_gen = entry.gen;
+	Timestamp read_start = entry.read_start;
+	unsigned long read_gen = entry.read_gen;
+	l.unlock();
+
+	Status status;
+	try {
+		readStatus(status, use_ser_line, read_spb, nb_bytes);
+	} catch (...) {
+		l.lock();
+		entry.reading = false;
+		m_status_cache_cond.broadcast();
+		throw;
+	}
+
+	l.lock();
+	// invalidated while reading: the status can be older than the
+	// Start/Stop, the caller reads it again
+	if (entry.gen == read_gen) {
+		entry.status = status;
+		entry.timestamp = read_start;
+	} else {
+		DEB_TRACE() << "Status invalidated during the read";
+	}
+	entry.reading = false;
+	m_status_cache_cond.broadcast();
+}
+
+void Camera::readStatus(Status& status, bool use_ser_line, bool read_spb,
+			unsigned long& nb_bytes)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(use_ser_line, read_spb);
+
 	int ccd_status;
 	if (use_ser_line) {
-		readRegister(StatusSeqA, ccd_status);
+		readStatusRegister(StatusSeqA, ccd_status, true, &nb_bytes);
 	} else {
 		Espia::Dev& dev = getEspiaDev();
 		dev.getCcdStatus(ccd_status);
 	}
 
-	int spb_status = read_spb ? getSPBStatus() : 0;
+	int spb_status = read_spb ? getSPBStatus(true, &nb_bytes) : 0;
 	ccd_status |= spb_status;
 
 	status = Status(ccd_status);
 	DEB_RETURN() << DEB_VAR1(DEB_HEX(status));
 }
 
-Status Camera::getSPBStatus()
+Status Camera::getSPBStatus(bool use_queue, unsigned long *nb_bytes)
 {
 	DEB_MEMBER_FUNCT();
 
@@ -815,20 +1473,26 @@ Status Camera::getSPBStatus()
 			if (!present)
 				continue;
 			int chan = i ? 8 : 0;
-			writeRegister(ChanControl, chan);
+			// see readStatusRegister: no wait for the calib
+			m_timing_ctrl->yieldCalib(false);
+			SingleRegWrite op = {m_ser_line, ChanControl, chan};
+			writeWithRetry(op);
 			int spb_status, mask, good;
-			readRegister(StatusAMTA, spb_status);
+			readStatusRegister(StatusAMTA, spb_status, use_queue,
+					   nb_bytes);
 			mask = SPB8_SAA_TstInitMask;
 			good = SPB8_SAA_TstInitGood;
 			in_init |= ((spb_status & mask) != good);
-			readRegister(StatusAMTE, spb_status);
+			readStatusRegister(StatusAMTE, spb_status, use_queue,
+					   nb_bytes);
 			mask = SPB8_SAE_TstEnvMask;
 			good = 0;
 			in_xfer |= ((spb_status & mask) != good);
 		}
 	} else {
 		int spb_status, mask, good;
-		readRegister(StatusAMTA, spb_status);
+		readStatusRegister(StatusAMTA, spb_status, use_queue,
+				   nb_bytes);
 		mask = SPB2_SAA_TstInitMask;
 		good = SPB2_SAA_TstInitGood;
 		in_init |= ((spb_status & mask) != good);
@@ -848,6 +1512,15 @@ Status Camera::getSPBStatus()
 	return Status(spb_status);
 }
 
+// CPU time of the calling thread, not of the whole process
+static double getThreadCpuTime()
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0;
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 bool Camera::waitStatus(Status& status, Status mask, double timeout,
 			bool use_ser_line, bool read_spb)
 {
@@ -855,45 +1528,230 @@ bool Camera::waitStatus(Status& status, Status mask, double timeout,
 	DEB_PARAM() << DEB_VAR5(DEB_HEX(status), DEB_HEX(mask), timeout,
 				use_ser_line, read_spb);
 
+	Timestamp t0 = Timestamp::now();
 	Timestamp end;
 	if (timeout > 0)
-		end = Timestamp::now() + Timestamp(timeout);
+		end = t0 + Timestamp(timeout);
+
+	WaitStatusStats stats = {0, 0, 0, 0, 0, 0};
+	double cpu_t0 = getThreadCpuTime();
+
+	// the idle status cannot come before the predicted acq. end
+	if (status == (Wait & mask))
+		stats.sleep_time = sleepUntilAcqEnd(end);
 
 	bool good_status = false;
 	Status curr_status = Status(0xffff);
-	while (!good_status) {
-		if (end.isSet() && (Timestamp::now() >= end)) {
-			DEB_WARNING() << "Timeout waiting for " 
-				      << DEB_VAR2(DEB_HEX(status), 
-						  DEB_HEX(curr_status));
+	double poll_time = WaitStatusPollTime;
+	Timestamp last_poll;
+	while (true) {
+		Timestamp poll = Timestamp::now();
+		m_ser_line.flushPendingAcks();
+		unsigned long poll_bytes;
+		getCachedStatus(curr_status, use_ser_line, read_spb, true,
+				poll_bytes);
+		stats.nb_polls++;
+		stats.nb_bytes += poll_bytes;
+		good_status = ((curr_status & mask) == status);
+		if (good_status) {
+			if (last_poll.isSet())
+				stats.wake_latency = poll - last_poll;
 			break;
 		}
-
-		getStatus(curr_status, use_ser_line, read_spb);
-		good_status = ((curr_status & mask) == status);
+		last_poll = poll;
+
+		double sleep_time = poll_time;
+		if (end.isSet()) {
+			double left = end - Timestamp::now();
+			if (left <= 0) {
+				DEB_WARNING() << "Timeout waiting for " 
+					      << DEB_VAR2(DEB_HEX(status), 
+							  DEB_HEX(curr_status));
+				break;
+			}
+			sleep_time = min(sleep_time, left);
+		}
+		Sleep(sleep_time);
+		poll_time = min(poll_time * 2, WaitStatusMaxPollTime);
 	}
 
+	stats.wait_time = Timestamp::now() - t0;
+	stats.cpu_time = getThreadCpuTime() - cpu_t0;
+	DEB_TRACE() << DEB_VAR6(stats.nb_polls, stats.wait_time, 
+				stats.sleep_time, stats.wake_latency, 
+				stats.cpu_time, stats.nb_bytes);
+	AutoMutex l(m_status_cond.mutex());
+	m_wait_stats = stats;
+	l.unlock();
+
 	status = curr_status;
 	DEB_RETURN() << DEB_VAR2(DEB_HEX(status), good_status);
 	return good_status;
 }
 
+void Camera::getWaitStatusStats(WaitStatusStats& stats)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_status_cond.mutex());
+	stats = m_wait_stats;
+}
+
+void Camera::estimateAcqEnd(TrigMode trig_mode)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(trig_mode);
+
+	double acq_time = 0;
+	bool int_trig = ((trig_mode == IntTrig) || (trig_mode == IntTrigMult));
+	int nb_frames = (trig_mode == IntTrigMult) ? 1 : m_nb_frames;
+	if (int_trig && (nb_frames > 0)) {
+		// without SeqTim measurement the dead time is unknown
+		double exp_time, lat_time;
+		getExpTime(exp_time);
+		if (needSeqTimMeasure())
+			getUserLatTime(lat_time);
+		else
+			getTotalLatTime(lat_time);
+		acq_time = nb_frames * (exp_time + lat_time);
+		DEB_TRACE() << DEB_VAR1(acq_time);
+	}
+
+	AutoMutex l(m_status_cond.mutex());
+	m_acq_time_est = acq_time;
+	l.unlock();
+	restartAcqEnd();
+}
+
+// IntTrigMult re-triggers reuse the estimation of the first one
+void Camera::restartAcqEnd()
+{
+	DEB_MEMBER_FUNCT();
+
+	Timestamp acq_start = Timestamp::now();
+	AutoMutex l(m_status_cond.mutex());
+	m_acq_start = acq_start;
+	if (m_acq_time_est > 0)
+		m_acq_end_est = acq_start + Timestamp(m_acq_time_est);
+	else
+		m_acq_end_est = Timestamp();
+}
+
+void Camera::clearAcqEnd()
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_status_cond.mutex());
+	m_acq_end_est = Timestamp();
+	m_status_cond.broadcast();
+}
+
+double Camera::sleepUntilAcqEnd(Timestamp end)
+{
+	DEB_MEMBER_FUNCT();
+
+	Timestamp t0 = Timestamp::now();
+	AutoMutex l(m_status_cond.mutex());
+	// wake up before the end, estimations are not exact
+	while (m_acq_end_est.isSet()) {
+		double acq_time = m_acq_end_est - m_acq_start;
+		double guard = (WaitStatusGuardTime + 
+				acq_time * WaitStatusGuardFactor);
+		Timestamp wake = m_acq_end_est - Timestamp(guard);
+		if (end.isSet() && (end < wake))
+			wake = end;
+		double left = wake - Timestamp::now();
+		if (left <= 0)
+			break;
+		m_status_cond.wait(left);
+	}
+	double sleep_time = Timestamp::now() - t0;
+	DEB_RETURN() << DEB_VAR1(sleep_time);
+	return sleep_time;
+}
+
 void Camera::getImageCount(unsigned int& img_count, bool only_lsw)
 {
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR1(only_lsw);
 
-	int reg_count;
-	readRegister(StatusAMTC, reg_count);
-	img_count = reg_count;
-	if (!only_lsw) {
-		readRegister(StatusAMTD, reg_count);
-		img_count |= reg_count << 16;
+	if (only_lsw) {
+		int reg_count;
+		readStatusRegister(StatusAMTC, reg_count);
+		img_count = reg_count;
+	} else {
+		Timestamp timestamp;
+		img_count = readImageCount(timestamp);
 	}
 
 	DEB_RETURN() << DEB_VAR1(img_count);
 }
 
+// the MSW is re-read until stable, so a LSW carry cannot tear the value
+unsigned int Camera::readImageCount(Timestamp& timestamp)
+{
+	DEB_MEMBER_FUNCT();
+
+	int lsw, msw, prev_msw;
+	readStatusRegister(StatusAMTD, msw);
+	for (int i = 0; ; ++i) {
+		Timestamp t0 = Timestamp::now();
+		readStatusRegister(StatusAMTC, lsw);
+		Timestamp t1 = Timestamp::now();
+		timestamp = t0 + Timestamp((t1 - t0) / 2);
+		prev_msw = msw;
+		readStatusRegister(StatusAMTD, msw);
+		if (msw == prev_msw)
+			break;
+		if (i == MaxImageCountRetries)
+			THROW_HW_ERROR(Error) << "Image counter MSW not stable: "
+					      << DEB_VAR2(prev_msw, msw);
+		DEB_TRACE() << "MSW changed: " << DEB_VAR2(prev_msw, msw);
+	}
+
+	unsigned int img_count = (((unsigned int) msw) << 16) | lsw;
+	DEB_RETURN() << DEB_VAR2(img_count, timestamp);
+	return img_count;
+}
+
+void Camera::getImageCountSample(ImageCountSample& sample)
+{
+	DEB_MEMBER_FUNCT();
+
+	AutoMutex l(m_img_count_lock);
+	unsigned int img_count = readImageCount(sample.timestamp);
+	if (img_count < m_img_count_last) {
+		DEB_TRACE() << "Image counter wrap: " 
+			    << DEB_VAR2(m_img_count_last, img_count);
+		m_img_count_base += 1ULL << 32;
+	}
+	m_img_count_last = img_count;
+	sample.count = m_img_count_base + img_count;
+	DEB_RETURN() << DEB_VAR2(sample.count, sample.timestamp);
+}
+
+void Camera::resetImageCount(bool restart)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(restart);
+
+	// the camera counter restarts from 0 on each Start command:
+	// IntTrigMult restarts carry over the count read just before,
+	// the last sample may miss the latest frames. A trigger takes
+	// far less than 64k frames: only the LSW is read, in the
+	// re-trigger latency
+	AutoMutex l(m_img_count_lock);
+	if (restart) {
+		int lsw;
+		readStatusRegister(StatusAMTC, lsw);
+		unsigned int img_count = (m_img_count_last & ~0xffffU) | lsw;
+		if (img_count < m_img_count_last)
+			img_count += 0x10000;
+		m_img_count_base += img_count;
+	} else {
+		m_img_count_base = 0;
+	}
+	m_img_count_last = 0;
+}
+
 void Camera::getMissingExtStartPulses(int& missing_pulses)
 {
 	DEB_MEMBER_FUNCT();
@@ -925,8 +1783,21 @@ void Camera::start()
 {
 	DEB_MEMBER_FUNCT();
 
+	m_timing_ctrl->yieldCalib();
 	AutoMutex l = lock();
 
+	// report the previous un-acknowledged Start errors here
+	m_ser_line.flushPendingAcks();
+
+	// IntTrigMult re-triggers: pre-encoded Start, no config. check
+	if (m_started && (m_trig_mode == IntTrigMult)) {
+		resetImageCount(true);
+		m_ser_line.sendFastCmd(Start, m_trig_ack);
+		invalidateStatusCache();
+		restartAcqEnd();
+		return;
+	}
+
 	TrigMode trig_mode;
 	getTrigMode(trig_mode);
 	if (m_started && (trig_mode != IntTrigMult))
@@ -934,24 +1805,32 @@ void Camera::start()
 
 	if ((trig_mode == IntTrig) || (m_trig_mode == IntTrigMult)) {
 		DEB_TRACE() << "Starting camera by software";
+		resetImageCount(m_started);
 		sendCmd(Start);
 	} else if (m_model.has(Model::GoodHTD)) {
 		DEB_TRACE() << "Enabling Ext. Sync. signals";
+		resetImageCount(false);
 		setExtSyncEnable(ExtSyncBoth);
 	}
 
 	m_started = true;
+	m_ser_line.setDeferLowPrio(true);
+	invalidateStatusCache();
+	estimateAcqEnd(trig_mode);
 }
 
 void Camera::stop()
 {
 	DEB_MEMBER_FUNCT();
 
+	m_timing_ctrl->yieldCalib();
 	AutoMutex l = lock();
 
 	if (!m_started)
 		return;
 
+	clearAcqEnd();
+
 	TrigMode trig_mode;
 	getTrigMode(trig_mode);
 
@@ -962,9 +1841,10 @@ void Camera::stop()
 	}
 
 	Status status;
-	getStatus(status);
+	getStatus(status, false, false, true);
 	if (status == Wait) {
 		m_started = false;
+		m_ser_line.setDeferLowPrio(false);
 		return;
 	}
 
@@ -993,6 +1873,7 @@ void Camera::stop()
 		DEB_WARNING() << "Camera not idle after " 
 			      << DEB_VAR1(wait_time);
 	m_started = false;
+	m_ser_line.setDeferLowPrio(false);
 }
 
 bool Camera::isRunning()
@@ -1040,6 +1921,44 @@ void Camera::measureSeqTimValues(SeqTimValues& st, double timeout)
 	m_geom->deadTimeChanged();
 }
 
+void Camera::exportSeqTimMeasures(const string& fname)
+{
+	DEB_MEMBER_FUNCT();
+	m_timing_ctrl->exportMeasures(fname);
+}
+
+void Camera::importSeqTimMeasures(const string& fname)
+{
+	DEB_MEMBER_FUNCT();
+	m_timing_ctrl->importMeasures(fname);
+	m_geom->deadTimeChanged();
+}
+
+void Camera::addSeqTimCalibRange(const SeqTimCalibRange& range)
+{
+	DEB_MEMBER_FUNCT();
+	m_timing_ctrl->addCalibRange(range);
+}
+
+void Camera::startSeqTimCalib()
+{
+	DEB_MEMBER_FUNCT();
+	m_timing_ctrl->startCalib();
+}
+
+void Camera::stopSeqTimCalib()
+{
+	DEB_MEMBER_FUNCT();
+	m_timing_ctrl->stopCalib();
+}
+
+void Camera::getSeqTimCalibPending(int& nb_pending)
+{
+	DEB_MEMBER_FUNCT();
+	m_timing_ctrl->getCalibPending(nb_pending);
+	DEB_RETURN() << DEB_VAR1(nb_pending);
+}
+
 void Camera::registerDeadTimeChangedCallback(DeadTimeChangedCallback& cb)
 {
 	DEB_MEMBER_FUNCT();
@@ -42,6 +42,425 @@ DeadTimeChangedCallback::~DeadTimeChangedCallback()
 }
 
 
+GeometryState::GeometryState()
+	: frelon16(false), spb_con_xy(false), input_chan(Chan1234),
+	  roi_bin_offset(0), chan_roi_offset(0)
+{
+}
+
+void GeometryState::calcChanXform(ChanXform& chan_xform) const
+{
+	DEB_MEMBER_FUNCT();
+
+	Flip& mirror = chan_xform.mirror;
+	if (frelon16) {
+		mirror.x = false;
+		mirror.y = spb_con_xy;
+	} else {
+		mirror.x = (isChanActive(input_chan, Chan12) ||
+			    isChanActive(input_chan, Chan34));
+		mirror.y = (isChanActive(input_chan, Chan13) ||
+			    isChanActive(input_chan, Chan24));
+	}
+	chan_xform.nb_chan = Point(mirror) + 1;
+	chan_xform.chan_size = ccd_size / chan_xform.nb_chan;
+
+	Flip readout_flip(false);
+	if (!frelon16) {
+		bool right  = (!isChanActive(input_chan, Chan1) &&
+			       !isChanActive(input_chan, Chan3));
+		bool bottom = (!isChanActive(input_chan, Chan1) &&
+			       !isChanActive(input_chan, Chan2));
+		readout_flip = Flip(right, bottom);
+	}
+	DEB_TRACE() << DEB_VAR2(flip, readout_flip);
+	chan_xform.flip = flip & readout_flip;
+
+	DEB_RETURN() << DEB_VAR1(chan_xform);
+}
+
+Flip GeometryState::getMirror() const
+{
+	DEB_MEMBER_FUNCT();
+	ChanXform xform;
+	calcChanXform(xform);
+	DEB_RETURN() << DEB_VAR1(xform.mirror);
+	return xform.mirror;
+}
+
+Point GeometryState::getNbChan() const
+{
+	DEB_MEMBER_FUNCT();
+	ChanXform xform;
+	calcChanXform(xform);
+	DEB_RETURN() << DEB_VAR1(xform.nb_chan);
+	return xform.nb_chan;
+}
+
+Size GeometryState::getChanSize() const
+{
+	DEB_MEMBER_FUNCT();
+	ChanXform xform;
+	calcChanXform(xform);
+	DEB_RETURN() << DEB_VAR1(xform.chan_size);
+	return xform.chan_size;
+}
+
+Flip GeometryState::getRoiInsideMirror() const
+{
+	DEB_MEMBER_FUNCT();
+	Flip roi_inside_mirror(chan_roi_offset.x > 0, chan_roi_offset.y > 0);
+	DEB_RETURN() << DEB_VAR1(roi_inside_mirror);
+	return roi_inside_mirror;
+}
+
+void GeometryState::xformChanCoords(const ChanXform& xform, 
+				    const Point& point, Point& xform_point, 
+				    Corner& ref_corner) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(point);
+
+	Flip effect_flip = xform.flip;
+	DEB_TRACE() << "After flip: " << DEB_VAR1(effect_flip);
+
+	if (xform.mirror.x)
+		effect_flip.x = (point.x >= xform.chan_size.getWidth());
+	if (xform.mirror.y)
+		effect_flip.y = (point.y >= xform.chan_size.getHeight());
+	DEB_TRACE() << "After mirror: " << DEB_VAR1(effect_flip);
+
+	ref_corner = effect_flip.getRefCorner();
+
+	xform_point = ccd_size.getCornerCoords(point, ref_corner);
+	DEB_RETURN() << DEB_VAR2(xform_point, ref_corner);
+}
+
+void GeometryState::calcImageRoi(const ChanXform& xform, 
+				 const Roi& chan_roi, 
+				 const Flip& roi_inside_mirror,
+				 Roi& image_roi, Point& roi_bin_offset) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(chan_roi, roi_inside_mirror);
+
+	Point image_tl, chan_tl = chan_roi.getTopLeft();
+	Point image_br, chan_br = chan_roi.getBottomRight();
+	Corner c_tl, c_br;
+	xformChanCoords(xform, chan_tl, image_tl, c_tl);
+	xformChanCoords(xform, chan_br, image_br, c_br);
+	Roi unbinned_roi(image_tl, image_br);
+	DEB_TRACE() << "Before mirror shift " << DEB_VAR1(unbinned_roi);
+
+	Size bin_size = Point(bin);
+	Point mirr_shift = roi_inside_mirror * (bin_size - 1);
+	DEB_TRACE() << DEB_VAR1(mirr_shift);
+
+	image_tl = unbinned_roi.getTopLeft() + mirr_shift;
+	unbinned_roi.setTopLeft(image_tl);
+	DEB_TRACE() << "After mirror shift " << DEB_VAR1(unbinned_roi);
+
+	image_roi = unbinned_roi.getBinned(bin);
+
+	image_tl %= bin_size;
+	c_tl = roi_inside_mirror.getRefCorner();
+	DEB_TRACE() << DEB_VAR2(image_tl, c_tl);
+
+	roi_bin_offset = bin_size.getCornerCoords(image_tl, c_tl) % bin_size;
+
+	DEB_RETURN() << DEB_VAR2(image_roi, roi_bin_offset);
+}
+
+void GeometryState::calcFinalRoi(const ChanXform& xform, 
+				 const Roi& image_roi, 
+				 const Point& chan_roi_offset,
+				 Roi& final_roi) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(image_roi, chan_roi_offset);
+
+	Point tl = image_roi.getTopLeft() + chan_roi_offset;
+	Size size = image_roi.getSize() * xform.nb_chan;
+	final_roi = Roi(tl, size);
+
+	DEB_RETURN() << DEB_VAR1(final_roi);
+}
+
+void GeometryState::calcChanRoi(const ChanXform& xform, 
+				const Roi& image_roi, Roi& chan_roi,
+				Flip& roi_inside_mirror) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(image_roi);
+
+	Roi unbinned_roi = image_roi.getUnbinned(bin);
+	DEB_TRACE() << DEB_VAR1(unbinned_roi);
+
+	Point image_tl = unbinned_roi.getTopLeft();
+	image_tl += roi_bin_offset;
+	unbinned_roi.setTopLeft(image_tl);
+	DEB_TRACE() << "shifted: " << DEB_VAR2(roi_bin_offset, unbinned_roi);
+
+	Point image_br = unbinned_roi.getBottomRight();
+	Point chan_tl, chan_br;
+	Corner c_tl, c_br;
+	xformChanCoords(xform, image_tl, chan_tl, c_tl);
+	xformChanCoords(xform, image_br, chan_br, c_br);
+
+	chan_roi.setCorners(chan_tl, chan_br);
+	DEB_TRACE() << "xformChanCoords: " << DEB_VAR3(chan_roi, c_tl, c_br);
+
+	chan_tl = chan_roi.getTopLeft();
+	chan_br = chan_roi.getBottomRight();
+
+	bool two_xchan = (c_tl.getX() != c_br.getX());
+	bool two_ychan = (c_tl.getY() != c_br.getY());
+	DEB_TRACE() << DEB_VAR2(two_xchan, two_ychan);
+
+	const Size& chan_size = xform.chan_size;
+	if (two_xchan)
+		chan_br.x = chan_size.getWidth() - 1;
+	if (two_ychan)
+		chan_br.y = chan_size.getHeight() - 1;
+
+	chan_roi.setCorners(chan_tl, chan_br);
+
+	roi_inside_mirror = xform.mirror;
+	roi_inside_mirror.x &= (image_tl.x > chan_br.x);
+	roi_inside_mirror.y &= (image_tl.y > chan_br.y);
+
+	DEB_RETURN() << DEB_VAR2(chan_roi, roi_inside_mirror);
+}
+
+void GeometryState::calcChanRoiOffset(const Roi& req_roi, 
+				      const Roi& image_roi,
+				      Point& chan_roi_offset) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(req_roi, image_roi);
+
+	Point virt_tl = image_roi.getTopLeft();
+
+	Size image_size, bin_ccd_size = ccd_size / bin;
+
+	image_size = image_roi.getSize();
+	Point image_br = image_roi.getBottomRight();
+
+	Point mirror_tl = bin_ccd_size - (image_br + 1) - image_size;
+	Point req_tl = req_roi.getTopLeft();
+	if (req_tl.x > image_br.x)
+		virt_tl.x = mirror_tl.x;
+	if (req_tl.y > image_br.y)
+		virt_tl.y = mirror_tl.y;
+
+	chan_roi_offset = virt_tl - image_roi.getTopLeft();
+	DEB_RETURN() << DEB_VAR1(chan_roi_offset);
+}
+
+void GeometryState::checkRoi(const Roi& set_roi, Roi& hw_roi) const
+{
+	DEB_MEMBER_FUNCT();
+	ChanXform xform;
+	calcChanXform(xform);
+	checkRoi(xform, set_roi, hw_roi);
+}
+
+void GeometryState::checkRoi(const ChanXform& xform, const Roi& set_roi, 
+			     Roi& hw_roi) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(set_roi);
+
+	if (set_roi.isActive()) {
+		Roi chan_roi;
+		Point chan_roi_offset;
+		calcSetRoi(xform, set_roi, hw_roi, chan_roi, chan_roi_offset);
+	} else 
+		hw_roi = set_roi;
+
+	DEB_RETURN() << DEB_VAR1(hw_roi);
+}
+
+void GeometryState::calcSetRoi(const Roi& set_roi, Roi& hw_roi, 
+			       Roi& chan_roi, Point& chan_roi_offset) const
+{
+	DEB_MEMBER_FUNCT();
+	ChanXform xform;
+	calcChanXform(xform);
+	calcSetRoi(xform, set_roi, hw_roi, chan_roi, chan_roi_offset);
+}
+
+void GeometryState::calcSetRoi(const ChanXform& xform, const Roi& set_roi, 
+			       Roi& hw_roi, Roi& chan_roi, 
+			       Point& chan_roi_offset) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(set_roi);
+
+	Roi aligned_roi;
+	if (frelon16) {
+		// no horizontal roi in Frelon16
+		Point top_left(0, set_roi.getTopLeft().y);
+		Size size(ccd_size.getWidth() / bin.getX(),
+			  set_roi.getSize().getHeight());
+		aligned_roi = Roi(top_left, size);
+	} else {
+		aligned_roi = set_roi;
+		aligned_roi.alignCornersTo(Point(32, 1), Ceil);
+	}
+	Flip roi_inside_mirror;
+	calcChanRoi(xform, aligned_roi, chan_roi, roi_inside_mirror);
+	Roi image_roi;
+	Point image_roi_bin_offset;
+	calcImageRoi(xform, chan_roi, roi_inside_mirror, image_roi, 
+		     image_roi_bin_offset);
+	calcChanRoiOffset(set_roi, image_roi, chan_roi_offset);
+	calcFinalRoi(xform, image_roi, chan_roi_offset, hw_roi);
+
+	DEB_RETURN() << DEB_VAR3(hw_roi, chan_roi, chan_roi_offset);
+}
+
+void GeometryState::calcHwRoi(const Roi& chan_roi, Roi& hw_roi) const
+{
+	DEB_MEMBER_FUNCT();
+	ChanXform xform;
+	calcChanXform(xform);
+	calcHwRoi(xform, chan_roi, hw_roi);
+}
+
+void GeometryState::calcHwRoi(const ChanXform& xform, const Roi& chan_roi, 
+			      Roi& hw_roi) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(chan_roi);
+
+	Roi image_roi;
+	Point image_roi_bin_offset;
+	calcImageRoi(xform, chan_roi, getRoiInsideMirror(), image_roi, 
+		     image_roi_bin_offset);
+	calcFinalRoi(xform, image_roi, chan_roi_offset, hw_roi);
+
+	DEB_RETURN() << DEB_VAR1(hw_roi);
+}
+
+void GeometryState::calcRoiBinOffset(const Roi& chan_roi, 
+				     Point& chan_roi_bin_offset) const
+{
+	DEB_MEMBER_FUNCT();
+	ChanXform xform;
+	calcChanXform(xform);
+	calcRoiBinOffset(xform, chan_roi, chan_roi_bin_offset);
+}
+
+void GeometryState::calcRoiBinOffset(const ChanXform& xform, 
+				     const Roi& chan_roi, 
+				     Point& chan_roi_bin_offset) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(chan_roi);
+
+	Roi image_roi;
+	calcImageRoi(xform, chan_roi, getRoiInsideMirror(), image_roi, 
+		     chan_roi_bin_offset);
+
+	DEB_RETURN() << DEB_VAR1(chan_roi_bin_offset);
+}
+
+void GeometryState::calcRoiBinOffsetChanRoi(const Roi& chan_roi, 
+					    const Point& new_roi_bin_offset,
+					    Roi& new_chan_roi) const
+{
+	DEB_MEMBER_FUNCT();
+	ChanXform xform;
+	calcChanXform(xform);
+	calcRoiBinOffsetChanRoi(xform, chan_roi, new_roi_bin_offset, 
+				new_chan_roi);
+}
+
+void GeometryState::calcRoiBinOffsetChanRoi(const ChanXform& xform, 
+					    const Roi& chan_roi, 
+					    const Point& new_roi_bin_offset,
+					    Roi& new_chan_roi) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(chan_roi, new_roi_bin_offset);
+
+	Size bin_size = Point(bin);
+	Roi valid_offset_range(Point(0), bin_size);
+	if (!valid_offset_range.containsPoint(new_roi_bin_offset)) {
+		THROW_HW_ERROR(InvalidValue) << "Invalid unaligned " 
+					     << DEB_VAR1(new_roi_bin_offset);
+	} else if (new_roi_bin_offset.x != 0) {
+		THROW_HW_ERROR(InvalidValue) 
+			<< "Invalid " << DEB_VAR1(new_roi_bin_offset) << ". "
+			<< "Must be horizontally aligned to " << DEB_VAR1(bin);
+	}
+
+	Point image_tl, image_br;
+	Corner c_tl, c_br;
+	xformChanCoords(xform, chan_roi.getTopLeft(),     image_tl, c_tl);
+	xformChanCoords(xform, chan_roi.getBottomRight(), image_br, c_br);
+	Roi image_roi(image_tl, image_br);
+	DEB_TRACE() << DEB_VAR1(image_roi);
+
+	Flip roi_inside_mirror = getRoiInsideMirror();
+	Point mirr_shift = roi_inside_mirror * (bin_size - 1);
+	DEB_TRACE() << DEB_VAR1(mirr_shift);
+
+	image_tl = image_roi.getTopLeft() + mirr_shift;
+	image_tl -= image_tl % bin_size;
+	DEB_TRACE() << "After alignment " << DEB_VAR1(image_tl);
+
+	c_tl = roi_inside_mirror.getRefCorner();
+	image_tl += new_roi_bin_offset * c_tl.getDir();
+	DEB_TRACE() << "After roi_bin_offset " << DEB_VAR1(image_tl);
+
+	Roi max_chan_roi(Point(0), xform.chan_size);
+	bool ok = max_chan_roi.containsPoint(image_tl);
+	if (ok) {
+		DEB_TRACE() << "Image top-left is OK";
+		image_roi.setTopLeft(image_tl);
+		ok = max_chan_roi.containsRoi(image_roi);
+	}
+	if (!ok)
+		THROW_HW_ERROR(InvalidValue) << "Cannot apply requested "
+					     << DEB_VAR1(new_roi_bin_offset);
+
+	Point chan_tl, chan_br;
+	xformChanCoords(xform, image_roi.getTopLeft(),     chan_tl, c_tl);
+	xformChanCoords(xform, image_roi.getBottomRight(), chan_br, c_br);
+	new_chan_roi = Roi(chan_tl, chan_br);
+
+	DEB_RETURN() << DEB_VAR1(new_chan_roi);
+}
+
+std::ostream& lima::Frelon::operator <<(std::ostream& os, 
+					const ChanXform& xform)
+{
+	return os << "<"
+		  << "mirror=" << xform.mirror << ", "
+		  << "nb_chan=" << xform.nb_chan << ", "
+		  << "chan_size=" << xform.chan_size << ", "
+		  << "flip=" << xform.flip
+		  << ">";
+}
+
+std::ostream& lima::Frelon::operator <<(std::ostream& os, 
+					const GeometryState& state)
+{
+	return os << "<"
+		  << "frelon16=" << state.frelon16 << ", "
+		  << "spb_con_xy=" << state.spb_con_xy << ", "
+		  << "ccd_size=" << state.ccd_size << ", "
+		  << "input_chan=" << int(state.input_chan) << ", "
+		  << "flip=" << state.flip << ", "
+		  << "bin=" << state.bin << ", "
+		  << "roi_bin_offset=" << state.roi_bin_offset << ", "
+		  << "chan_roi_offset=" << state.chan_roi_offset
+		  << ">";
+}
+
+
 Geometry::Geometry(Camera& cam)
 	: m_cam(cam), m_model(cam.getModel()),
 	  m_mis_cb_act(false), m_dead_time(0), m_dead_time_cb(NULL)
@@ -71,6 +490,7 @@ void Geometry::sync()
 {
 	DEB_MEMBER_FUNCT();
 
+	buildChanXformMap();
 	m_chan_roi_offset = 0;
 	getRoiBinOffset(m_roi_bin_offset);
 	deadTimeChanged();
@@ -191,25 +611,35 @@ void Geometry::calcFTMInputChan(int chan_mode, FrameTransferMode& ftm,
 	DEB_RETURN() << DEB_VAR2(FTMNameMap[ftm], DEB_HEX(input_chan));
 }
 
+bool Geometry::isInputChanAvail(FrameTransferMode ftm, InputChan input_chan)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(FTMNameMap[ftm], DEB_HEX(input_chan));
+
+	bool avail = false;
+	const InputChanList& chan_list = FTMInputChanListMap[ftm];
+	if (find(chan_list.begin(), chan_list.end(), input_chan) != 
+	    chan_list.end()) {
+		int chan_mode;
+		calcChanMode(ftm, input_chan, chan_mode);
+		int mode_bit = 1 << (chan_mode - 1);
+		avail = ((getModesAvail() & mode_bit) != 0);
+	}
+
+	DEB_RETURN() << DEB_VAR1(avail);
+	return avail;
+}
+
 bool Geometry::getDefInputChan(FrameTransferMode ftm, InputChan& input_chan)
 {
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR1(FTMNameMap[ftm]);
 
-	int modes_avail = getModesAvail();
-
 	bool valid_mode = false;
 	InputChanList::const_iterator it, end = DefInputChanList.end();
 	for (it = DefInputChanList.begin(); it != end; ++it) {
 		input_chan = *it;
-		int chan_mode;
-		try {
-			calcChanMode(ftm, input_chan, chan_mode);
-		} catch (...) {
-			continue;
-		}
-		int mode_bit = 1 << (chan_mode - 1);
-		valid_mode = ((modes_avail & mode_bit) != 0);
+		valid_mode = isInputChanAvail(ftm, input_chan);
 		if (valid_mode)
 			break;
 	}
@@ -217,7 +647,7 @@ bool Geometry::getDefInputChan(FrameTransferMode ftm, InputChan& input_chan)
 	if (!valid_mode) {
 		DEB_WARNING() << "Could not find default input_chan for " 
 			      << FTMNameMap[ftm] << ": " 
-			      << DEB_VAR1(DEB_HEX(modes_avail));
+			      << DEB_VAR1(DEB_HEX(getModesAvail()));
 		DEB_RETURN() << DEB_VAR1(valid_mode);
 	} else {
 		DEB_RETURN() << DEB_VAR2(valid_mode, DEB_HEX(input_chan)) 
@@ -328,9 +758,19 @@ void Geometry::getFrameDim(FrameDim& frame_dim)
 {
 	DEB_MEMBER_FUNCT();
 
-	getMaxFrameDim(frame_dim);
 	FrameTransferMode ftm;
 	getFrameTransferMode(ftm);
+	calcFrameDim(ftm, frame_dim);
+
+	DEB_RETURN() << DEB_VAR1(frame_dim);
+}
+
+void Geometry::calcFrameDim(FrameTransferMode ftm, FrameDim& frame_dim)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(FTMNameMap[ftm]);
+
+	getMaxFrameDim(frame_dim);
 	if ((ftm == FTM) && !m_model.has(Model::HamaChip))
 		frame_dim /= Point(1, 2);
 
@@ -411,8 +851,10 @@ void Geometry::setBin(const Bin& bin)
 	Roi roi;
 	setRoi(roi);
 
-	writeRegister(BinHorz, bin.getX());
-	writeRegister(BinVert, bin.getY());
+	SerialLine::Transaction trans(m_cam.getSerialLine());
+	trans.writeRegister(BinHorz, bin.getX());
+	trans.writeRegister(BinVert, bin.getY());
+	m_cam.commitTransaction(trans);
 
 	resetRoiBinOffset();
 
@@ -439,9 +881,11 @@ void Geometry::setRoiMode(RoiMode roi_mode)
 	bool roi_kin  = (roi_mode == Kinetic);
 	DEB_TRACE() << DEB_VAR3(roi_hw, roi_fast, roi_kin);
 
-	writeRegister(RoiEnable,  roi_hw);
-	writeRegister(RoiFast,    roi_fast);
-	writeRegister(RoiKinetic, roi_kin);
+	SerialLine::Transaction trans(m_cam.getSerialLine());
+	trans.writeRegister(RoiEnable,  roi_hw);
+	trans.writeRegister(RoiFast,    roi_fast);
+	trans.writeRegister(RoiKinetic, roi_kin);
+	m_cam.commitTransaction(trans);
 
 	if (roi_mode == None)
 		resetRoiBinOffset();
@@ -471,221 +915,154 @@ void Geometry::getRoiMode(RoiMode& roi_mode)
 	DEB_RETURN() << DEB_VAR1(roi_mode);
 }
 
-Flip Geometry::getMirror()
+void Geometry::buildChanXformMap()
 {
 	DEB_MEMBER_FUNCT();
 
-	Flip mirror;
-	if (isFrelon16()) {
-		mirror.x = false;
-		mirror.y = (m_model.getSPBConType() == SPBConXY);
-	} else {
-		InputChan curr;
-		getInputChan(curr);
-		mirror.x = (isChanActive(curr, Chan12) ||
-			    isChanActive(curr, Chan34));
-		mirror.y = (isChanActive(curr, Chan13) ||
-			    isChanActive(curr, Chan24));
+	m_chan_xform_map.clear();
+
+	GeometryState state;
+	state.frelon16 = isFrelon16();
+	state.spb_con_xy = (m_model.getSPBConType() == SPBConXY);
+
+	int modes_avail = getModesAvail();
+	FTMChanRangeMapType::const_iterator it, end = FTMChanRangeMap.end();
+	for (it = FTMChanRangeMap.begin(); it != end; ++it) {
+		const ChanRange& range = it->second;
+		for (int chan_mode = range.first; chan_mode < range.second; 
+		     ++chan_mode) {
+			int mode_bit = 1 << (chan_mode - 1);
+			if ((modes_avail & mode_bit) == 0)
+				continue;
+			FrameTransferMode ftm;
+			calcFTMInputChan(chan_mode, ftm, state.input_chan);
+			FrameDim frame_dim;
+			calcFrameDim(ftm, frame_dim);
+			state.ccd_size = frame_dim.getSize();
+			for (int flip_mode = 0; flip_mode < 4; ++flip_mode) {
+				state.flip.x = (flip_mode >> 1) & 1;
+				state.flip.y = (flip_mode >> 0) & 1;
+				ChanXformKey key(chan_mode, flip_mode);
+				state.calcChanXform(m_chan_xform_map[key]);
+			}
+		}
 	}
-	DEB_RETURN() << DEB_VAR1(mirror);
-	return mirror;
+
+	DEB_TRACE() << DEB_VAR1(m_chan_xform_map.size());
 }
 
-Point Geometry::getNbChan()
+void Geometry::clearChanXformMap()
 {
 	DEB_MEMBER_FUNCT();
-	Point nb_chan = Point(getMirror()) + 1;
-	DEB_RETURN() << DEB_VAR1(nb_chan);
-	return nb_chan;
+	m_chan_xform_map.clear();
 }
 
-Size Geometry::getCcdSize()
+void Geometry::getChanXform(int chan_mode, int flip_mode, 
+			    const GeometryState& state, ChanXform& xform)
 {
 	DEB_MEMBER_FUNCT();
-	FrameDim frame_dim;
-	getFrameDim(frame_dim);
-	Size ccd_size = frame_dim.getSize();
-	DEB_RETURN() << DEB_VAR1(ccd_size);
-	return ccd_size;
+	DEB_PARAM() << DEB_VAR2(chan_mode, flip_mode);
+
+	ChanXformKey key(chan_mode, flip_mode);
+	ChanXformMap::const_iterator it = m_chan_xform_map.find(key);
+	if (it != m_chan_xform_map.end()) {
+		xform = it->second;
+	} else {
+		DEB_TRACE() << "Not in table, calculating";
+		state.calcChanXform(xform);
+		m_chan_xform_map[key] = xform;
+	}
+
+	DEB_RETURN() << DEB_VAR1(xform);
 }
 
-Size Geometry::getChanSize()
+void Geometry::getState(GeometryState& state)
 {
 	DEB_MEMBER_FUNCT();
-	Size chan_size = getCcdSize() / getNbChan();
-	DEB_RETURN() << DEB_VAR1(chan_size);
-	return chan_size;
+	ChanXform xform;
+	getState(state, xform);
 }
 
-Flip Geometry::getRoiInsideMirror()
+void Geometry::getState(GeometryState& state, ChanXform& xform)
 {
 	DEB_MEMBER_FUNCT();
-	Flip roi_inside_mirror(m_chan_roi_offset.x > 0, 
-			       m_chan_roi_offset.y > 0);
-	DEB_RETURN() << DEB_VAR1(roi_inside_mirror);
-	return roi_inside_mirror;
+
+	int chan_mode;
+	getChanMode(chan_mode);
+	Bin bin;
+	getBin(bin);
+	calcState(chan_mode, bin, state, xform);
 }
 
-void Geometry::xformChanCoords(const Point& point, Point& xform_point, 
-			     Corner& ref_corner)
+void Geometry::calcState(int chan_mode, const Bin& bin, 
+			 GeometryState& state)
 {
 	DEB_MEMBER_FUNCT();
-	DEB_PARAM() << DEB_VAR1(point);
-
-	Flip chan_flip;
-	getFlip(chan_flip);
-	Flip mirror = getMirror();
-	Size chan_size = getChanSize();
-
-	Flip readout_flip(false);
-	if (!isFrelon16()) {
-		InputChan curr;
-		getInputChan(curr);
-		bool right  = (!isChanActive(curr, Chan1) &&
-			       !isChanActive(curr, Chan3));
-		bool bottom = (!isChanActive(curr, Chan1) &&
-			       !isChanActive(curr, Chan2));
-		readout_flip = Flip(right, bottom);
-	}
-	DEB_TRACE() << DEB_VAR2(chan_flip, readout_flip);
-
-	Flip effect_flip = chan_flip & readout_flip;
-	DEB_TRACE() << "After flip: " << DEB_VAR1(effect_flip);
-
-	if (mirror.x)
-		effect_flip.x = (point.x >= chan_size.getWidth());
-	if (mirror.y)
-		effect_flip.y = (point.y >= chan_size.getHeight());
-	DEB_TRACE() << "After mirror: " << DEB_VAR1(effect_flip);
-
-	ref_corner = effect_flip.getRefCorner();
-
-	Size ccd_size = getCcdSize();
-	xform_point = ccd_size.getCornerCoords(point, ref_corner);
-	DEB_RETURN() << DEB_VAR2(xform_point, ref_corner);
+	ChanXform xform;
+	calcState(chan_mode, bin, state, xform);
 }
 
-void Geometry::calcImageRoi(const Roi& chan_roi, const Flip& roi_inside_mirror,
-			  Roi& image_roi, Point& roi_bin_offset)
+void Geometry::calcState(int chan_mode, const Bin& bin, 
+			 GeometryState& state, ChanXform& xform)
 {
 	DEB_MEMBER_FUNCT();
-	DEB_PARAM() << DEB_VAR2(chan_roi, roi_inside_mirror);
-
-	Point image_tl, chan_tl = chan_roi.getTopLeft();
-	Point image_br, chan_br = chan_roi.getBottomRight();
-	Corner c_tl, c_br;
-	xformChanCoords(chan_tl, image_tl, c_tl);
-	xformChanCoords(chan_br, image_br, c_br);
-	Roi unbinned_roi(image_tl, image_br);
-	DEB_TRACE() << "Before mirror shift " << DEB_VAR1(unbinned_roi);
+	DEB_PARAM() << DEB_VAR2(chan_mode, bin);
 
-	Bin bin;
-	getBin(bin);
-	Size bin_size = Point(bin);
-	Point mirr_shift = roi_inside_mirror * (bin_size - 1);
-	DEB_TRACE() << DEB_VAR1(mirr_shift);
-
-	image_tl = unbinned_roi.getTopLeft() + mirr_shift;
-	unbinned_roi.setTopLeft(image_tl);
-	DEB_TRACE() << "After mirror shift " << DEB_VAR1(unbinned_roi);
-
-	image_roi = unbinned_roi.getBinned(bin);
-
-	image_tl %= bin_size;
-	c_tl = roi_inside_mirror.getRefCorner();
-	DEB_TRACE() << DEB_VAR2(image_tl, c_tl);
-
-	roi_bin_offset = bin_size.getCornerCoords(image_tl, c_tl) % bin_size;
+	int flip_mode;
+	getFlipMode(flip_mode);
 
-	DEB_RETURN() << DEB_VAR2(image_roi, roi_bin_offset);
+	state.frelon16 = isFrelon16();
+	state.spb_con_xy = (m_model.getSPBConType() == SPBConXY);
+	FrameTransferMode ftm;
+	calcFTMInputChan(chan_mode, ftm, state.input_chan);
+	FrameDim frame_dim;
+	calcFrameDim(ftm, frame_dim);
+	state.ccd_size = frame_dim.getSize();
+	state.flip.x = (flip_mode >> 1) & 1;
+	state.flip.y = (flip_mode >> 0) & 1;
+	state.bin = bin;
+	state.roi_bin_offset = m_roi_bin_offset;
+	state.chan_roi_offset = m_chan_roi_offset;
+	getChanXform(chan_mode, flip_mode, state, xform);
+
+	DEB_RETURN() << DEB_VAR2(state, xform);
 }
 
-void Geometry::calcFinalRoi(const Roi& image_roi, const Point& chan_roi_offset,
-			  Roi& final_roi)
+Flip Geometry::getMirror()
 {
 	DEB_MEMBER_FUNCT();
-	DEB_PARAM() << DEB_VAR2(image_roi, chan_roi_offset);
-
-	Point tl = image_roi.getTopLeft() + chan_roi_offset;
-	Point nb_chan = getNbChan();
-	Size size = image_roi.getSize() * nb_chan;
-	final_roi = Roi(tl, size);
-
-	DEB_RETURN() << DEB_VAR1(final_roi);
+	GeometryState state;
+	ChanXform xform;
+	getState(state, xform);
+	Flip mirror = xform.mirror;
+	DEB_RETURN() << DEB_VAR1(mirror);
+	return mirror;
 }
 
-void Geometry::calcChanRoi(const Roi& image_roi, Roi& chan_roi,
-			 Flip& roi_inside_mirror)
+Point Geometry::getNbChan()
 {
 	DEB_MEMBER_FUNCT();
-	DEB_PARAM() << DEB_VAR1(image_roi);
-
-	Bin bin;
-	getBin(bin);
-	Roi unbinned_roi = image_roi.getUnbinned(bin);
-	DEB_TRACE() << DEB_VAR1(unbinned_roi);
-
-	Point image_tl = unbinned_roi.getTopLeft();
-	image_tl += m_roi_bin_offset;
-	unbinned_roi.setTopLeft(image_tl);
-	DEB_TRACE() << "shifted: " << DEB_VAR2(m_roi_bin_offset, unbinned_roi);
-
-	Point image_br = unbinned_roi.getBottomRight();
-	Point chan_tl, chan_br;
-	Corner c_tl, c_br;
-	xformChanCoords(image_tl, chan_tl, c_tl);
-	xformChanCoords(image_br, chan_br, c_br);
-
-	chan_roi.setCorners(chan_tl, chan_br);
-	DEB_TRACE() << "xformChanCoords: " << DEB_VAR3(chan_roi, c_tl, c_br);
-
-	chan_tl = chan_roi.getTopLeft();
-	chan_br = chan_roi.getBottomRight();
-
-	bool two_xchan = (c_tl.getX() != c_br.getX());
-	bool two_ychan = (c_tl.getY() != c_br.getY());
-	DEB_TRACE() << DEB_VAR2(two_xchan, two_ychan);
-
-	Size chan_size = getChanSize();
-	if (two_xchan)
-		chan_br.x = chan_size.getWidth() - 1;
-	if (two_ychan)
-		chan_br.y = chan_size.getHeight() - 1;
-
-	chan_roi.setCorners(chan_tl, chan_br);
-
-	roi_inside_mirror = getMirror();
-	roi_inside_mirror.x &= (image_tl.x > chan_br.x);
-	roi_inside_mirror.y &= (image_tl.y > chan_br.y);
-
-	DEB_RETURN() << DEB_VAR2(chan_roi, roi_inside_mirror);
+	Point nb_chan = Point(getMirror()) + 1;
+	DEB_RETURN() << DEB_VAR1(nb_chan);
+	return nb_chan;
 }
 
-void Geometry::calcChanRoiOffset(const Roi& req_roi, const Roi& image_roi,
-			       Point& chan_roi_offset)
+Size Geometry::getCcdSize()
 {
 	DEB_MEMBER_FUNCT();
-	DEB_PARAM() << DEB_VAR2(req_roi, image_roi);
-
-	Point virt_tl = image_roi.getTopLeft();
-
-	Size image_size, ccd_size = getCcdSize();
-	Bin bin;
-	getBin(bin);
-	ccd_size /= bin;
-
-	image_size = image_roi.getSize();
-	Point image_br = image_roi.getBottomRight();
-
-	Point mirror_tl = ccd_size - (image_br + 1) - image_size;
-	Point req_tl = req_roi.getTopLeft();
-	if (req_tl.x > image_br.x)
-		virt_tl.x = mirror_tl.x;
-	if (req_tl.y > image_br.y)
-		virt_tl.y = mirror_tl.y;
+	FrameDim frame_dim;
+	getFrameDim(frame_dim);
+	Size ccd_size = frame_dim.getSize();
+	DEB_RETURN() << DEB_VAR1(ccd_size);
+	return ccd_size;
+}
 
-	chan_roi_offset = virt_tl - image_roi.getTopLeft();
-	DEB_RETURN() << DEB_VAR1(chan_roi_offset);
+Size Geometry::getChanSize()
+{
+	DEB_MEMBER_FUNCT();
+	Size chan_size = getCcdSize() / getNbChan();
+	DEB_RETURN() << DEB_VAR1(chan_size);
+	return chan_size;
 }
 
 void Geometry::checkRoiMode(const Roi& roi)
@@ -708,45 +1085,34 @@ void Geometry::checkRoi(const Roi& set_roi, Roi& hw_roi)
 	DEB_PARAM() << DEB_VAR1(set_roi);
 
 	if (set_roi.isActive()) {
-		Roi chan_roi;
-		Point chan_roi_offset;
-		processSetRoi(set_roi, hw_roi, chan_roi, chan_roi_offset);
+		GeometryState state;
+		ChanXform xform;
+		getState(state, xform);
+		state.checkRoi(xform, set_roi, hw_roi);
 	} else 
 		hw_roi = set_roi;
 
 	DEB_RETURN() << DEB_VAR1(hw_roi);
 }
 
-void Geometry::processSetRoi(const Roi& set_roi, Roi& hw_roi, 
-			   Roi& chan_roi, Point& chan_roi_offset)
+void Geometry::checkRoi(int chan_mode, const Bin& bin, const Roi& set_roi,
+			Roi& hw_roi)
 {
 	DEB_MEMBER_FUNCT();
-	DEB_PARAM() << DEB_VAR1(set_roi);
+	DEB_PARAM() << DEB_VAR3(chan_mode, bin, set_roi);
 
-	Roi aligned_roi;
-	if (isFrelon16()) {
-		// no horizontal roi in Frelon16
-		Point top_left(0, set_roi.getTopLeft().y);
-		FrameDim frame_dim;
-		getFrameDim(frame_dim);
-		Bin bin;
-		getBin(bin);
-		Size size(frame_dim.getSize().getWidth() / bin.getX(),
-			  set_roi.getSize().getHeight());
-		aligned_roi = Roi(top_left, size);
-	} else {
-		aligned_roi = set_roi;
-		aligned_roi.alignCornersTo(Point(32, 1), Ceil);
-	}
-	Flip roi_inside_mirror;
-	calcChanRoi(aligned_roi, chan_roi, roi_inside_mirror);
-	Roi image_roi;
-	Point roi_bin_offset;
-	calcImageRoi(chan_roi, roi_inside_mirror, image_roi, roi_bin_offset);
-	calcChanRoiOffset(set_roi, image_roi, chan_roi_offset);
-	calcFinalRoi(image_roi, chan_roi_offset, hw_roi);
+	GeometryState state;
+	ChanXform xform;
+	calcState(chan_mode, bin, state, xform);
+	state.checkRoi(xform, set_roi, hw_roi);
 
-	DEB_RETURN() << DEB_VAR3(hw_roi, chan_roi, chan_roi_offset);
+	Roi frame_roi(Point(0, 0), state.ccd_size / bin);
+	if (!frame_roi.containsRoi(hw_roi) || !hw_roi.containsRoi(set_roi))
+		THROW_HW_ERROR(InvalidValue) << "Roi not available in "
+					     << DEB_VAR3(chan_mode, set_roi, 
+							 hw_roi);
+
+	DEB_RETURN() << DEB_VAR1(hw_roi);
 }
 
 void Geometry::setRoi(const Roi& set_roi)
@@ -760,9 +1126,12 @@ void Geometry::setRoi(const Roi& set_roi)
 		return;
 	}
 
+	GeometryState state;
+	ChanXform xform;
+	getState(state, xform);
 	Roi hw_roi, chan_roi;
 	Point chan_roi_offset;
-	processSetRoi(set_roi, hw_roi, chan_roi, chan_roi_offset);
+	state.calcSetRoi(xform, set_roi, hw_roi, chan_roi, chan_roi_offset);
 
 	writeChanRoi(chan_roi);
 	m_chan_roi_offset = chan_roi_offset;
@@ -779,14 +1148,13 @@ void Geometry::getRoi(Roi& hw_roi)
 	if (roi_mode == None)
 		return;
 
-	Roi chan_roi, image_roi;
+	Roi chan_roi;
 	readChanRoi(chan_roi);
 
-	Flip roi_inside_mirror = getRoiInsideMirror();
-	Point roi_bin_offset;
-	calcImageRoi(chan_roi, roi_inside_mirror, image_roi, roi_bin_offset);
-
-	calcFinalRoi(image_roi, m_chan_roi_offset, hw_roi);
+	GeometryState state;
+	ChanXform xform;
+	getState(state, xform);
+	state.calcHwRoi(xform, chan_roi, hw_roi);
 	DEB_RETURN() << DEB_VAR1(hw_roi);
 }
 
@@ -798,10 +1166,12 @@ void Geometry::writeChanRoi(const Roi& chan_roi)
 	Point tl  = chan_roi.getTopLeft();
 	Size size = chan_roi.getSize();
 	
-	writeRegister(RoiPixelBegin, tl.x);
-	writeRegister(RoiPixelWidth, size.getWidth());
-	writeRegister(RoiLineBegin,  tl.y);
-	writeRegister(RoiLineWidth,  size.getHeight());
+	SerialLine::Transaction trans(m_cam.getSerialLine());
+	trans.writeRegister(RoiPixelBegin, tl.x);
+	trans.writeRegister(RoiPixelWidth, size.getWidth());
+	trans.writeRegister(RoiLineBegin,  tl.y);
+	trans.writeRegister(RoiLineWidth,  size.getHeight());
+	m_cam.commitTransaction(trans);
 
 	deadTimeChanged();
 }
@@ -836,56 +1206,15 @@ void Geometry::setRoiBinOffset(const Point& roi_bin_offset)
 			THROW_HW_ERROR(InvalidValue) << "HW Roi not active";
 		return;
 	} 
-	Bin bin;
-	getBin(bin);
-	Size bin_size = Point(bin);
-	Roi valid_offset_range(Point(0), bin_size);
-	if (!valid_offset_range.containsPoint(roi_bin_offset)) {
-		THROW_HW_ERROR(InvalidValue) << "Invalid unaligned " 
-					     << DEB_VAR1(roi_bin_offset);
-	} else if (roi_bin_offset.x != 0) {
-		THROW_HW_ERROR(InvalidValue) 
-			<< "Invalid " << DEB_VAR1(roi_bin_offset) << ". "
-			<< "Must be horizontally aligned to " << DEB_VAR1(bin);
-	}
 
 	Roi chan_roi;
 	readChanRoi(chan_roi);
 
-	Point image_tl, image_br;
-	Corner c_tl, c_br;
-	xformChanCoords(chan_roi.getTopLeft(),     image_tl, c_tl);
-	xformChanCoords(chan_roi.getBottomRight(), image_br, c_br);
-	Roi image_roi(image_tl, image_br);
-	DEB_TRACE() << DEB_VAR1(image_roi);
-
-	Flip roi_inside_mirror = getRoiInsideMirror();
-	Point mirr_shift = roi_inside_mirror * (bin_size - 1);
-	DEB_TRACE() << DEB_VAR1(mirr_shift);
-
-	image_tl = image_roi.getTopLeft() + mirr_shift;
-	image_tl -= image_tl % bin_size;
-	DEB_TRACE() << "After alignment " << DEB_VAR1(image_tl);
-
-	c_tl = roi_inside_mirror.getRefCorner();
-	image_tl += roi_bin_offset * c_tl.getDir();
-	DEB_TRACE() << "After roi_bin_offset " << DEB_VAR1(image_tl);
-
-	Roi max_chan_roi(Point(0), getChanSize());
-	bool ok = max_chan_roi.containsPoint(image_tl);
-	if (ok) {
-		DEB_TRACE() << "Image top-left is OK";
-		image_roi.setTopLeft(image_tl);
-		ok = max_chan_roi.containsRoi(image_roi);
-	}
-	if (!ok)
-		THROW_HW_ERROR(InvalidValue) << "Cannot apply requested "
-					     << DEB_VAR1(roi_bin_offset);
-
-	Point chan_tl, chan_br;
-	xformChanCoords(image_roi.getTopLeft(),     chan_tl, c_tl);
-	xformChanCoords(image_roi.getBottomRight(), chan_br, c_br);
-	chan_roi = Roi(chan_tl, chan_br);
+	GeometryState state;
+	ChanXform xform;
+	getState(state, xform);
+	state.calcRoiBinOffsetChanRoi(xform, chan_roi, roi_bin_offset, 
+				      chan_roi);
 
 	writeChanRoi(chan_roi);
 
@@ -903,11 +1232,13 @@ void Geometry::getRoiBinOffset(Point& roi_bin_offset)
 		return;
 	}
 
-	Roi chan_roi, image_roi;
+	Roi chan_roi;
 	readChanRoi(chan_roi);
 
-	Flip roi_inside_mirror = getRoiInsideMirror();
-	calcImageRoi(chan_roi, roi_inside_mirror, image_roi, roi_bin_offset);
+	GeometryState state;
+	ChanXform xform;
+	getState(state, xform);
+	state.calcRoiBinOffset(xform, chan_roi, roi_bin_offset);
 
 	DEB_RETURN() << DEB_VAR1(roi_bin_offset);
 }
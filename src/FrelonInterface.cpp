@@ -393,8 +393,13 @@ void SyncCtrlObj::getValidRanges(ValidRangesType& valid_ranges)
 	valid_ranges.min_exp_time = 1 * MinTimeUnit;
 	valid_ranges.max_exp_time = MaxRegVal * MaxTimeUnit;
 
-	double dead_time;
-	m_cam.getDeadTime(dead_time);
+	// the model can underestimate the dead time of a not yet measured
+	// config: only a measured one replaces the register-derived value
+	FrameTiming ft;
+	m_cam.getFrameTiming(ft);
+	double dead_time = ft.dead_time;
+	if (ft.predicted)
+		m_cam.getDeadTime(dead_time);
 	valid_ranges.min_lat_time = dead_time;
 	valid_ranges.max_lat_time = dead_time + MaxRegVal * LatTimeUnit;
 
@@ -831,12 +836,16 @@ EventCtrlObj::~EventCtrlObj()
  * \brief Hw Interface constructor
  *******************************************************************/
 
+const double Interface::HwFrameCheckPeriod = 0.1;
+const int Interface::MaxHwFrameLag = 2;
+
 Interface::Interface(Espia::Acq& acq, BufferCtrlMgr& buffer_mgr,
 		     Camera& cam)
 	: m_acq(acq), m_buffer_mgr(buffer_mgr), m_cam(cam),
 	  m_det_info(cam), m_buffer(buffer_mgr), m_sync(acq, cam), 
 	  m_bin(acq, cam), m_roi(acq, cam), m_flip(acq, cam), m_shutter(cam),
-	  m_acq_end_cb(cam), m_event_cb(m_event)
+	  m_acq_end_cb(cam), m_event_cb(m_event), m_check_hw_frames(false),
+	  m_hw_frame_lag(0), m_max_hw_frame_lag(0)
 {
 	DEB_CONSTRUCTOR();
 
@@ -963,6 +972,10 @@ void Interface::startAcq()
 	bool was_running = (trig_mode == IntTrigMult) && m_cam.isRunning();
 	if (!was_running) {
 		m_buffer_mgr.setStartTimestamp(Timestamp::now());
+		AutoMutex l(m_hw_frames_lock);
+		m_hw_frames_check = Timestamp();
+		m_hw_frame_lag = m_max_hw_frame_lag = 0;
+		l.unlock();
 		m_acq.start();
 	}
 
@@ -980,6 +993,10 @@ void Interface::stopAcq()
 	DEB_MEMBER_FUNCT();
 	m_cam.stop();
 	m_acq.stop();
+
+	Acq::Status acq_status;
+	m_acq.getStatus(acq_status);
+	checkHwFrames(acq_status.last_frame_nb + 1, true);
 }
 
 void Interface::getStatus(StatusType& status)
@@ -1028,8 +1045,65 @@ int Interface::getNbHwAcquiredFrames()
 	Acq::Status acq_status;
 	m_acq.getStatus(acq_status);
 	int nb_hw_acq_frames = acq_status.last_frame_nb + 1;
+	checkHwFrames(nb_hw_acq_frames, false);
 	DEB_RETURN() << DEB_VAR1(nb_hw_acq_frames);
 	return nb_hw_acq_frames;
 }
 
+void Interface::setCheckHwFrames(bool check_hw_frames)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(check_hw_frames);
+	AutoMutex l(m_hw_frames_lock);
+	m_check_hw_frames = check_hw_frames;
+}
+
+void Interface::getCheckHwFrames(bool& check_hw_frames)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_hw_frames_lock);
+	check_hw_frames = m_check_hw_frames;
+	DEB_RETURN() << DEB_VAR1(check_hw_frames);
+}
+
+void Interface::getHwFrameLag(int& frame_lag, int& max_frame_lag)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_hw_frames_lock);
+	frame_lag = m_hw_frame_lag;
+	max_frame_lag = m_max_hw_frame_lag;
+	DEB_RETURN() << DEB_VAR2(frame_lag, max_frame_lag);
+}
+
+// frames counted by the camera but not (yet) received by the DMA:
+// during the acq. up to MaxHwFrameLag are in transit, after it all are lost
+void Interface::checkHwFrames(int nb_dma_frames, bool force)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(nb_dma_frames, force);
+
+	AutoMutex l(m_hw_frames_lock);
+	if (!m_check_hw_frames)
+		return;
+	Timestamp now = Timestamp::now();
+	bool check_due = (!m_hw_frames_check.isSet() || 
+			  (now - m_hw_frames_check >= HwFrameCheckPeriod));
+	if (!force && !check_due)
+		return;
+	m_hw_frames_check = now;
+
+	Camera::ImageCountSample sample;
+	m_cam.getImageCountSample(sample);
+	long long frame_lag = sample.count - nb_dma_frames;
+	m_hw_frame_lag = int(frame_lag);
+	int max_lag = force ? 0 : MaxHwFrameLag;
+	if ((m_hw_frame_lag > max_lag) && 
+	    (m_hw_frame_lag > m_max_hw_frame_lag))
+		DEB_WARNING() << "Camera " << sample.count << " vs. DMA "
+			      << nb_dma_frames << " frames: " 
+			      << m_hw_frame_lag - max_lag 
+			      << " frame(s) lost";
+	m_max_hw_frame_lag = max(m_max_hw_frame_lag, m_hw_frame_lag);
+}
+
 
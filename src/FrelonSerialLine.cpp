@@ -20,9 +20,10 @@
 // along with this program; if not, see <http://www.gnu.org/licenses/>.
 //###########################################################################
 #include "FrelonSerialLine.h"
-#include "lima/RegExUtils.h"
 #include "lima/MiscUtils.h"
 #include <sstream>
+#include <cctype>
+#include <algorithm>
 
 using namespace lima;
 using namespace lima::Frelon;
@@ -32,24 +33,100 @@ const double SerialLine::TimeoutSingle    = 0.5;
 const double SerialLine::TimeoutNormal    = 2.0;
 const double SerialLine::TimeoutMultiLine = 3.0;
 const double SerialLine::TimeoutReset     = 15.0;
+const double SerialLine::TimeoutLineGapMin = 0.05;
+const double SerialLine::TimeoutLineGapConfirm = 0.01;
+const double SerialLine::AvailPollTime = 1e-3;
+
+
+const double SerialLine::CmdStats::AckDelayBinLimit[] = {
+	1e-3, 2e-3, 5e-3, 10e-3, 20e-3, 50e-3, 100e-3,
+};
+
+SerialLine::CmdStats::CmdStats()
+{
+	reset();
+}
+
+void SerialLine::CmdStats::reset()
+{
+	nb_calls = nb_cache_hits = nb_cache_misses = 0;
+	nb_bytes_written = nb_bytes_read = 0;
+	for (int i = 0; i < NbAckDelayBins; ++i)
+		ack_delay_hist[i] = 0;
+	ack_delay_total = sleep_time = 0;
+	nb_busy_retries = nb_fail_retries = 0;
+}
+
+void SerialLine::CmdStats::addAckDelay(double ack_delay)
+{
+	int bin = 0;
+	while ((bin < NbAckDelayBins - 1) && 
+	       (ack_delay >= AckDelayBinLimit[bin]))
+		++bin;
+	ack_delay_hist[bin]++;
+	ack_delay_total += ack_delay;
+}
 
 
 SerialLine::SerialLine(Espia::SerialLine& espia_ser_line)
-	: m_espia_ser_line(espia_ser_line)
+	: m_hw_ser_line(espia_ser_line), m_espia_ser_line(&espia_ser_line)
+{
+	DEB_CONSTRUCTOR();
+	init();
+}
+
+SerialLine::SerialLine(HwSerialLine& hw_ser_line)
+	: m_hw_ser_line(hw_ser_line), 
+	  m_espia_ser_line(dynamic_cast<Espia::SerialLine *>(&hw_ser_line))
 {
 	DEB_CONSTRUCTOR();
+	init();
+}
+
+void SerialLine::init()
+{
+	DEB_MEMBER_FUNCT();
+
 	ostringstream os;
-	os << "Serial#" << espia_ser_line.getDev().getDevNb();
+	if (m_espia_ser_line)
+		os << "Serial#" << m_espia_ser_line->getDev().getDevNb();
+	else
+		os << "Serial";
 	DEB_SET_OBJ_NAME(os.str());
 
-	m_espia_ser_line.setLineTerm("\r\n");
-	m_espia_ser_line.setTimeout(TimeoutNormal);
+	m_hw_ser_line.setLineTerm("\r\n");
+	m_hw_ser_line.setTimeout(TimeoutNormal);
 
 	m_last_warn = 0;
 
 	m_curr_op = None;
 	m_curr_cache = false;
+	m_readout_cfg_gen = 0;
 	m_cache_act = true;
+	clearRegCache();
+	for (int i = 0; i < NbRegs; ++i)
+		m_cache_hits[i] = 0;
+
+	m_defer_sleep = false;
+	m_deferred_sleep = 0;
+	m_reconfig_waiter = NULL;
+
+	for (int i = 0; i < NbCmds; ++i)
+		m_cmd_msg[i] = string(">") + CmdStrMap[Cmd(i)] + "\r\n";
+
+	m_curr_stats = NULL;
+	m_cmd_nb_bytes = 0;
+	for (int i = 0; i < NbMultiLineCmds; ++i) {
+		MultiLineTiming& timing = m_ml_timing[i];
+		timing.nb_reads = timing.nb_lines = timing.nb_same_lines = 0;
+		timing.max_line_gap = 0;
+	}
+
+	m_defer_low_prio = false;
+	resetLatencyStats();
+	m_io_curr_req = NULL;
+	m_io_quit = false;
+	m_io_thread = NULL;
 
 	flush();
 }
@@ -57,11 +134,37 @@ SerialLine::SerialLine(Espia::SerialLine& espia_ser_line)
 SerialLine::~SerialLine()
 {
 	DEB_DESTRUCTOR();
+
+	if (!m_io_thread)
+		return;
+
+	// the pending requests are executed before the thread exits
+	AutoMutex l(m_queue_cond.mutex());
+	m_io_quit = true;
+	m_defer_low_prio = false;
+	m_queue_cond.broadcast();
+	l.unlock();
+
+	m_io_thread->join();
+	delete m_io_thread;
+}
+
+bool SerialLine::hasEspiaSerialLine()
+{
+	return (m_espia_ser_line != NULL);
 }
 
 Espia::SerialLine& SerialLine::getEspiaSerialLine()
 {
-	return m_espia_ser_line;
+	DEB_MEMBER_FUNCT();
+	if (!m_espia_ser_line)
+		THROW_HW_ERROR(NotSupported) << "Not an Espia serial line";
+	return *m_espia_ser_line;
+}
+
+HwSerialLine& SerialLine::getHwSerialLine()
+{
+	return m_hw_ser_line;
 }
 
 void SerialLine::write(const string& buffer, bool no_wait)
@@ -85,59 +188,64 @@ void SerialLine::writeCmd(const string& buffer, bool no_wait)
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR1(no_wait);
 
-	MsgPartStrMapType msg_parts;
-	splitMsg(buffer, msg_parts);
-	const string& cmd = msg_parts[MsgCmd];
+	readPendingAcks(0);
 
-	if (cmd == CmdStrMap[Reset]) {
+	MsgPartPos msg_pos;
+	parseMsg(buffer, msg_pos);
+	string cmd = msg_pos.str(buffer, MsgCmd);
+
+	Cmd seq_cmd;
+	MultiLineCmd ml_cmd;
+	bool is_seq_cmd = FindCmdByStr(cmd, seq_cmd);
+	if (is_seq_cmd && (seq_cmd == Reset)) {
 		m_curr_op = DoReset;
 		DEB_TRACE() << "DoReset: clearing reg cache and reset trace";
-		m_reg_cache.clear();
+		clearRegCache();
 		m_reset_trace_log.clear();
-	} else {
-		MultiLineCmdStrMapType::const_iterator it, end;
-		end = MultiLineCmdStrMap.end();
-		it = FindMapValue(MultiLineCmdStrMap, cmd);
-		if (it != end)
-			m_curr_op = MultiRead;
+	} else if (FindMultiLineCmdByStr(cmd, ml_cmd)) {
+		m_curr_op = MultiRead;
+		m_curr_ml_cmd = ml_cmd;
 	}
 
 	bool reg_found = false;
-	if (m_curr_op == None) {
-		RegStrMapType::const_iterator it, end = RegStrMap.end();
-		it = FindMapValue(RegStrMap, cmd);
-		reg_found = (it != end);
-		if (reg_found)
-			m_curr_reg = it->first;
-	}
+	if (m_curr_op == None)
+		reg_found = FindRegByStr(cmd, m_curr_reg);
+
+	if (reg_found)
+		m_curr_stats = &m_reg_stats[m_curr_reg];
+	else if (is_seq_cmd)
+		m_curr_stats = &m_cmd_stats[seq_cmd];
+	else if (m_curr_op == MultiRead)
+		m_curr_stats = &m_ml_cmd_stats[ml_cmd];
+	else
+		m_curr_stats = NULL;
+	if (m_curr_stats)
+		m_curr_stats->nb_calls++;
+	m_cmd_nb_bytes = 0;
 
-	bool has_sign = !msg_parts[MsgSign].empty();
+	bool has_sign = !msg_pos.empty(MsgSign);
 	if (has_sign) {
-		bool ok = false;
-		if (reg_found) {
-			const RegListType& list = SignedRegList;
-			RegListType::const_iterator end = list.end();
-			ok = (find(list.begin(), end, m_curr_reg) != end);
-		}
+		bool ok = (reg_found && HasRegFlag(m_curr_reg, RegSigned));
 		if (!ok)
 			THROW_HW_ERROR(InvalidValue)
 				<< "Command " << cmd << " cannot be negative";
 	}
 
+	bool is_req = !msg_pos.empty(MsgReq);
 	m_curr_cache = false;
 	if (reg_found && isRegCacheable(m_curr_reg)) {
-		bool is_req = !msg_parts[MsgReq].empty();
 		m_curr_op = is_req ? ReadReg : WriteReg;
 		if (!is_req)
-			m_curr_resp = msg_parts[MsgVal];
-		int cache_int;
-		double cache_float;
+			m_curr_resp = msg_pos.str(buffer, MsgVal);
+		int cache_int = 0;
+		double cache_float = 0;
 		if (isFloatReg(m_curr_reg))
 			m_curr_cache = getRegCacheVal(m_curr_reg, cache_float);
 		else
 			m_curr_cache = getRegCacheVal(m_curr_reg, cache_int);
 		if (m_curr_cache) {
 			ostringstream os;
+			os.precision(15);
 			if (isFloatReg(m_curr_reg))
 				os << cache_float;
 			else
@@ -151,36 +259,61 @@ void SerialLine::writeCmd(const string& buffer, bool no_wait)
 		if (m_curr_cache) {
 			DEB_TRACE() << "Skipping " << m_curr_op 
 				    << ", already in cache";
+			m_curr_stats->nb_cache_hits++;
 			return;
 		}
+		m_curr_stats->nb_cache_misses++;
 	}
 
+	// unknown side effects: non-cacheable regs & config reload
+	bool reg_write = (reg_found && !is_req);
+	bool unk_write = reg_write && !HasRegFlag(m_curr_reg, RegCacheable);
+	if (unk_write || (is_seq_cmd && (seq_cmd == Reload)))
+		invalidateDerivedRegs();
+	else if (reg_write)
+		invalidateDependRegs(m_curr_reg);
+
 	if (m_curr_op == None) {
 		m_curr_op = DoCmd;
-		CmdStrMapType::const_iterator it = FindMapValue(CmdStrMap, cmd);
-		m_curr_cmd = (it != CmdStrMap.end()) ? it->first : Reset;
+		m_curr_cmd = is_seq_cmd ? seq_cmd : Reset;
 	}
 
 	DEB_TRACE() << DEB_VAR1(m_curr_op);
 
-	string sync = msg_parts[MsgSync].empty() ? ">" : "";
-	string term = msg_parts[MsgTerm].empty() ? "\r\n" : "";
-	string msg = sync + buffer + term;
+	bool has_sync = !msg_pos.empty(MsgSync);
+	bool has_term = !msg_pos.empty(MsgTerm);
+	if (has_sync && has_term) {
+		if (m_curr_stats)
+			m_curr_stats->nb_bytes_written += buffer.size();
+		m_cmd_nb_bytes += buffer.size();
+		m_hw_ser_line.write(buffer, no_wait);
+		return;
+	}
 
-	m_espia_ser_line.write(msg, no_wait);
+	string msg;
+	msg.reserve(buffer.size() + 3);
+	if (!has_sync)
+		msg += '>';
+	msg += buffer;
+	if (!has_term)
+		msg += "\r\n";
+	if (m_curr_stats)
+		m_curr_stats->nb_bytes_written += msg.size();
+	m_cmd_nb_bytes += msg.size();
+	m_hw_ser_line.write(msg, no_wait);
 }
 
 void SerialLine::read(string& buffer, int max_len, double timeout)
 {
 	DEB_MEMBER_FUNCT();
-	m_espia_ser_line.read(buffer, max_len, timeout);
+	m_hw_ser_line.read(buffer, max_len, timeout);
 }
 
 void SerialLine::readStr(string& buffer, int max_len, 
 			 const string& term, double timeout)
 {
 	DEB_MEMBER_FUNCT();
-	m_espia_ser_line.readStr(buffer, max_len, term, timeout);
+	m_hw_ser_line.readStr(buffer, max_len, term, timeout);
 }
 
 void SerialLine::readLine(string& buffer, int max_len, double timeout)
@@ -238,17 +371,19 @@ void SerialLine::readSingleLine(string& buffer, int max_len, double timeout)
 		if ((m_curr_op == DoReset) || slow_cmd) {
 			timeout = TimeoutReset;
 		} else if (m_curr_op == WriteReg) {
-			RegDoubleMapType::const_iterator it;
-			it = RegTimeoutMap.find(m_curr_reg);
-			if (it != RegTimeoutMap.end())
-				timeout = it->second;
+			double reg_timeout = GetRegProp(m_curr_reg).timeout;
+			if (reg_timeout > 0)
+				timeout = reg_timeout;
 		}
 	}
 
 	Timestamp t0 = Timestamp::now();
 	bool reset_trace;
 	do {
-		m_espia_ser_line.readLine(buffer, max_len, timeout);
+		m_hw_ser_line.readLine(buffer, max_len, timeout);
+		if (m_curr_stats)
+			m_curr_stats->nb_bytes_read += buffer.size();
+		m_cmd_nb_bytes += buffer.size();
 		reset_trace = ((m_curr_op == DoReset) && (buffer != "!OK\r\n"));
 		if (reset_trace) {
 			std::string s = buffer.substr(0, buffer.size() - 2);
@@ -256,15 +391,26 @@ void SerialLine::readSingleLine(string& buffer, int max_len, double timeout)
 		}
 	} while (reset_trace);
 	double ack_delay = Timestamp::now() - t0;
+	if (m_curr_stats)
+		m_curr_stats->addAckDelay(ack_delay);
 
 	decodeFmtResp(buffer, m_curr_fmt_resp);
 
 	if (m_curr_op == WriteReg) {
 		double sleep_time = getRegSleepTime(m_curr_reg);
 		if ((sleep_time > 0) && (ack_delay < sleep_time)) {
-			DEB_TRACE() << "Sleeping " << sleep_time << " s after "
-				    << "changing " << RegStrMap[m_curr_reg];
-			Sleep(sleep_time);
+			if (m_defer_sleep) {
+				m_deferred_sleep = max(m_deferred_sleep, 
+						       sleep_time);
+				m_deferred_reg = m_curr_reg;
+			} else {
+				DEB_TRACE() << "Sleeping " << sleep_time 
+					    << " s after changing " 
+					    << GetRegProp(m_curr_reg).str;
+				m_reg_stats[m_curr_reg].sleep_time += 
+								sleep_time;
+				Sleep(sleep_time);
+			}
 		}
 	}
 
@@ -273,37 +419,161 @@ void SerialLine::readSingleLine(string& buffer, int max_len, double timeout)
 		return;
 
 	const string& cache_str = is_req ? m_curr_fmt_resp : m_curr_resp;
-	int cache_val;
+	double cache_val;
 	istringstream is(cache_str);
-	is >> cache_val;
-	m_reg_cache[m_curr_reg] = cache_val;
+	if (isFloatReg(m_curr_reg)) {
+		is >> cache_val;
+	} else {
+		int int_val;
+		is >> int_val;
+		cache_val = int_val;
+	}
+	AutoMutex cache_l(m_cache_lock);
+	RegCacheEntry& entry = m_reg_cache[m_curr_reg];
+	bool changed = (!entry.valid || (entry.val != cache_val));
+	if (changed && HasRegFlag(m_curr_reg, RegReadoutCfg))
+		++m_readout_cfg_gen;
+	entry.val = cache_val;
+	entry.valid = true;
 	DEB_TRACE() << "New " << DEB_VAR1(cache_val);
 }
 
 void SerialLine::readMultiLine(string& buffer, int max_len)
 {
 	DEB_MEMBER_FUNCT();
-	DEB_PARAM() << DEB_VAR1(max_len);
+	DEB_PARAM() << DEB_VAR2(max_len, m_curr_ml_cmd);
 
-	Timestamp timeout = Timestamp::now() + Timestamp(TimeoutMultiLine);
+	Timestamp t0 = Timestamp::now();
+	Timestamp timeout = t0 + Timestamp(TimeoutMultiLine);
+
+	// after the first read, the end of the response is detected by the
+	// learned number of lines, or by a line gap close to the observed one
+	MultiLineTiming& timing = m_ml_timing[m_curr_ml_cmd];
+	double gap_timeout = TimeoutSingle;
+	if (timing.nb_reads > 0) {
+		gap_timeout = max(LineGapFactor * timing.max_line_gap, 
+				  TimeoutLineGapMin);
+		gap_timeout = min(gap_timeout, TimeoutSingle);
+	}
+	bool known_nb_lines = (timing.nb_same_lines >= MultiLineStableReads);
+	// shorter gap confirming the end once the learned lines are read
+	double confirm_timeout = max(timing.max_line_gap, 
+				     TimeoutLineGapConfirm);
+	confirm_timeout = min(confirm_timeout, gap_timeout);
+	DEB_TRACE() << DEB_VAR4(gap_timeout, confirm_timeout, known_nb_lines, 
+				timing.nb_lines);
 
 	buffer.clear();
 
-	while (Timestamp::now() < timeout) {
+	int nb_lines = 0;
+	double max_line_gap = 0;
+	Timestamp t_last;
+	bool complete = false;
+	while (!complete && (Timestamp::now() < timeout)) {
 		string ans;
 		int len = max_len - buffer.size();
+		bool missing = known_nb_lines && (nb_lines < timing.nb_lines);
+		double line_timeout = (nb_lines && !missing) ? gap_timeout : 
+							       TimeoutSingle;
 		try {
 			DEB_TRACE() << "Atempting to read: " << DEB_VAR1(len);
-			m_espia_ser_line.readLine(ans, len, TimeoutSingle);
+			m_hw_ser_line.readLine(ans, len, line_timeout);
 			buffer += ans;
 		} catch (Exception e) {
 			if (!buffer.empty())
 				break;
+			continue;
 		}
+
+		Timestamp t = Timestamp::now();
+		if (nb_lines++ > 0)
+			max_line_gap = max(max_line_gap, double(t - t_last));
+		t_last = t;
+
+		if (known_nb_lines && (nb_lines == timing.nb_lines))
+			complete = !waitAvailBytes(confirm_timeout);
+	}
+
+	if (m_curr_stats) {
+		m_curr_stats->nb_bytes_read += buffer.size();
+		m_curr_stats->addAckDelay(Timestamp::now() - t0);
 	}
+	m_cmd_nb_bytes += buffer.size();
 
 	if (buffer.empty())
 		THROW_HW_ERROR(Error) << "Timeout reading Frelon multi-line";
+
+	if (nb_lines == timing.nb_lines) {
+		timing.nb_same_lines++;
+	} else {
+		if (known_nb_lines)
+			DEB_WARNING() << "Multi-line response changed: "
+				      << DEB_VAR2(nb_lines, timing.nb_lines)
+				      << ", learning it again";
+		timing.nb_lines = nb_lines;
+		timing.nb_same_lines = 1;
+	}
+	timing.max_line_gap = max(timing.max_line_gap, max_line_gap);
+	timing.nb_reads++;
+	DEB_TRACE() << DEB_VAR3(nb_lines, max_line_gap, complete);
+}
+
+bool SerialLine::waitAvailBytes(double timeout)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(timeout);
+
+	Timestamp end = Timestamp::now() + Timestamp(timeout);
+	int avail;
+	while (true) {
+		m_hw_ser_line.getNbAvailBytes(avail);
+		if (avail > 0)
+			break;
+		double left = end - Timestamp::now();
+		if (left <= 0)
+			break;
+		Sleep(min(left, AvailPollTime));
+	}
+
+	DEB_RETURN() << DEB_VAR1(avail);
+	return (avail > 0);
+}
+
+void SerialLine::clearRegCache()
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex cache_l(m_cache_lock);
+	for (int i = 0; i < NbRegs; ++i)
+		m_reg_cache[i].valid = false;
+	++m_readout_cfg_gen;
+}
+
+void SerialLine::invalidateDerivedRegs()
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex cache_l(m_cache_lock);
+	for (int i = 0; i < NbRegs; ++i)
+		if (HasRegFlag(Reg(i), RegDerived))
+			m_reg_cache[i].valid = false;
+	++m_readout_cfg_gen;
+}
+
+void SerialLine::invalidateDependRegs(Reg reg)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(reg);
+
+	RegListMapType::const_iterator mit = RegDependMap.find(reg);
+	if (mit == RegDependMap.end())
+		return;
+	const RegListType& dep_list = mit->second;
+	AutoMutex cache_l(m_cache_lock);
+	RegListType::const_iterator it, end = dep_list.end();
+	for (it = dep_list.begin(); it != end; ++it) {
+		m_reg_cache[*it].valid = false;
+		if (HasRegFlag(*it, RegReadoutCfg))
+			++m_readout_cfg_gen;
+	}
 }
 
 bool SerialLine::isRegCacheable(Reg reg)
@@ -315,8 +585,7 @@ bool SerialLine::isRegCacheable(Reg reg)
 		return false;
 	}
 
-	const RegListType& list = CacheableRegList;
-	bool cacheable = (find(list.begin(), list.end(), reg) != list.end());
+	bool cacheable = HasRegFlag(reg, RegCacheable);
 	DEB_RETURN() << DEB_VAR1(cacheable);
 	return cacheable;
 }
@@ -324,8 +593,7 @@ bool SerialLine::isRegCacheable(Reg reg)
 
 bool SerialLine::isFloatReg(Reg reg)
 {
-	const RegListType& list = FloatRegList;
-	return (find(list.begin(), list.end(), reg) != list.end());
+	return HasRegFlag(reg, RegFloat);
 }
 
 namespace lima
@@ -343,7 +611,7 @@ void SerialLine::checkRegType<int>(Reg reg)
 }
 
 template <>
-void SerialLine::checkRegType<double>(Reg reg)
+void SerialLine::checkRegType<double>(Reg /*reg*/)
 {
 }
 
@@ -352,46 +620,59 @@ bool SerialLine::getRegCacheVal(Reg reg, T& val)
 {
 	DEB_MEMBER_FUNCT();
 	checkRegType<T>(reg);
-	RegValMapType::const_iterator it = m_reg_cache.find(reg);
-	bool in_cache = (it != m_reg_cache.end());
-	val = in_cache ? it->second : 0;
+	const RegCacheEntry& entry = m_reg_cache[reg];
+	bool in_cache = entry.valid;
+	val = in_cache ? T(entry.val) : 0;
 	DEB_RETURN() << DEB_VAR2(in_cache, val);
 	return in_cache;
 }
 
+// m_cache_lock only: cache hits do not wait for the command owning the line
 template <class T>
 bool SerialLine::getRegCacheValSafe(Reg reg, T& val)
 {
-	AutoMutex l = lock(AutoMutex::Locked);
-	return (isRegCacheable(reg) && getRegCacheVal(reg, val));
+	DEB_MEMBER_FUNCT();
+	checkRegType<T>(reg);
+	if (!HasRegFlag(reg, RegCacheable))
+		return false;
+
+	AutoMutex cache_l(m_cache_lock);
+	const RegCacheEntry& entry = m_reg_cache[reg];
+	bool in_cache = (m_cache_act && entry.valid);
+	val = in_cache ? T(entry.val) : 0;
+	DEB_RETURN() << DEB_VAR2(in_cache, val);
+	return in_cache;
 }
 
 template <class T>
-void SerialLine::readCameraRegister(Reg reg, T& val)
+void SerialLine::readCameraRegister(Reg reg, T& val, unsigned long& nb_bytes)
 {
 	DEB_MEMBER_FUNCT();
-	const string& reg_str = RegStrMap[reg];
+	if ((reg < 0) || (reg >= NbRegs))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(reg);
+	const string reg_str = GetRegProp(reg).str;
 	DEB_PARAM() << DEB_VAR2(reg, reg_str);
 
+	nb_bytes = 0;
 	bool in_cache = getRegCacheValSafe(reg, val);
 	if (in_cache) {
 		DEB_TRACE() << "Using cache value";
+		countCacheHit(reg);
 		DEB_RETURN() << DEB_VAR1(val);
 		return;
 	} 
 
-	if (reg_str.empty())
-		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(reg);
-
 	string resp;
-	sendFmtCmd(reg_str + "?", resp);
+	execFmtCmd(reg_str + "?", resp, nb_bytes);
 	istringstream is(resp);
 	is >> val;
 	DEB_RETURN() << DEB_VAR1(val);
 }
 
-template void SerialLine::readCameraRegister<int>(Reg reg, int& val);
-template void SerialLine::readCameraRegister<double>(Reg reg, double& val);
+template void SerialLine::readCameraRegister<int>(Reg reg, int& val,
+						  unsigned long& nb_bytes);
+template void SerialLine::readCameraRegister<double>(Reg reg, double& val,
+						     unsigned long& nb_bytes);
 
 
 } // namespace Frelon
@@ -400,9 +681,7 @@ template void SerialLine::readCameraRegister<double>(Reg reg, double& val);
 double SerialLine::getRegSleepTime(Reg reg)
 {
 	DEB_MEMBER_FUNCT();
-	RegDoubleMapType::const_iterator it = RegSleepMap.find(reg);
-	bool in_map = (it != RegSleepMap.end());
-	double sleep_time = in_map ? it->second : 0;
+	double sleep_time = GetRegProp(reg).sleep_time;
 	DEB_RETURN() << DEB_VAR1(sleep_time);
 	return sleep_time;
 }
@@ -410,13 +689,14 @@ double SerialLine::getRegSleepTime(Reg reg)
 void SerialLine::flush()
 {
 	DEB_MEMBER_FUNCT();
-	m_espia_ser_line.flush();
+	m_hw_ser_line.flush();
+	m_pending_acks.clear();
 }
 
 void SerialLine::getNbAvailBytes(int &avail)
 {
 	DEB_MEMBER_FUNCT();
-	m_espia_ser_line.getNbAvailBytes(avail);
+	m_hw_ser_line.getNbAvailBytes(avail);
 	DEB_RETURN() << DEB_VAR1(avail);
 }
 
@@ -424,49 +704,85 @@ void SerialLine::setTimeout(double timeout)
 {
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR1(timeout);
-	m_espia_ser_line.setTimeout(timeout);
+	m_hw_ser_line.setTimeout(timeout);
 }
 
 void SerialLine::getTimeout(double& timeout) const
 {
 	DEB_MEMBER_FUNCT();
-	m_espia_ser_line.getTimeout(timeout);
+	m_hw_ser_line.getTimeout(timeout);
 	DEB_RETURN() << DEB_VAR1(timeout);
 }
 
 
-void SerialLine::splitMsg(const string& msg, 
-			  MsgPartStrMapType& msg_parts) const
+void SerialLine::parseMsg(const string& msg, MsgPartPos& msg_pos) const
 {
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR1(msg);
 
-	msg_parts.clear();
+	// >?[A-Za-z]+(\?|-?[0-9]+(\.[0-9]+)?)?[\r\n]*
+	string::size_type pos = 0, len = msg.size();
+	msg_pos.clear();
+
+	bool ok;
+	if ((pos < len) && (msg[pos] == '>')) {
+		++pos;
+		msg_pos.set(MsgSync, 0, pos);
+	}
 
-	const static RegEx re("^(?P<sync>>)?"
-			      "(?P<cmd>[A-Za-z]+)"
-			      "((?P<req>\\?)|"
-			      "(?P<val>(?P<sign>-?)[0-9]+"
-			      "(\\.(?P<dec>[0-9]+))?))?"
-			      "(?P<term>[\r\n]+)?$");
+	string::size_type beg = pos;
+	while ((pos < len) && isalpha(msg[pos]))
+		++pos;
+	msg_pos.set(MsgCmd, beg, pos);
+	ok = (pos > beg);
+
+	if (ok && (pos < len) && (msg[pos] == '?')) {
+		beg = pos++;
+		msg_pos.set(MsgReq, beg, pos);
+	} else if (ok && (pos < len) && 
+		   ((msg[pos] == '-') || isdigit(msg[pos]))) {
+		string::size_type val_beg = pos;
+		if (msg[pos] == '-') {
+			beg = pos++;
+			msg_pos.set(MsgSign, beg, pos);
+		}
+		beg = pos;
+		while ((pos < len) && isdigit(msg[pos]))
+			++pos;
+		ok = (pos > beg);
+		if (ok && (pos < len) && (msg[pos] == '.')) {
+			beg = ++pos;
+			while ((pos < len) && isdigit(msg[pos]))
+				++pos;
+			msg_pos.set(MsgDec, beg, pos);
+			ok = (pos > beg);
+		}
+		msg_pos.set(MsgVal, val_beg, pos);
+	}
 
-	RegEx::FullNameMatchType match;
-	if (!re.matchName(msg, match))
+	beg = pos;
+	while ((pos < len) && ((msg[pos] == '\r') || (msg[pos] == '\n')))
+		++pos;
+	msg_pos.set(MsgTerm, beg, pos);
+
+	if (!ok || (pos != len))
 		THROW_HW_ERROR(InvalidValue) << "Invalid Frelon message: "
 					     << DEB_VAR1(msg);
+}
 
-	typedef pair<MsgPart, string> KeyPair;
-	static const KeyPair key_list[] = {
-		KeyPair(MsgSync, "sync"), KeyPair(MsgCmd, "cmd"), 
-		KeyPair(MsgVal,  "val"),  KeyPair(MsgDec, "dec"),  
-		KeyPair(MsgReq,  "req"),  KeyPair(MsgTerm, "term"),
-		KeyPair(MsgSign, "sign"),
-	};
-	const KeyPair *it, *end = C_LIST_END(key_list);
-	for (it = key_list; it != end; ++it) {
-		const MsgPart& key = it->first;
-		const string&  grp = it->second;
-		msg_parts[key] = match[grp];
+void SerialLine::splitMsg(const string& msg, 
+			  MsgPartStrMapType& msg_parts) const
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(msg);
+
+	MsgPartPos msg_pos;
+	parseMsg(msg, msg_pos);
+
+	msg_parts.clear();
+	for (int i = 0; i < NbMsgParts; ++i) {
+		MsgPart part = MsgPart(i);
+		msg_parts[part] = msg_pos.str(msg, part);
 	}
 
 	DEB_RETURN() << DEB_VAR2(msg_parts[MsgSync], msg_parts[MsgCmd]);
@@ -474,41 +790,87 @@ void SerialLine::splitMsg(const string& msg,
 				 msg_parts[MsgVal], msg_parts[MsgDec]);
 }
 
+bool SerialLine::findAns(const string& ans, AnsPart& part,
+			 string::size_type& beg, string::size_type& len)
+{
+	// !(OK(:[^\r]+)?|W\a?:[^\r]+|E\a?:[^\r]+)\r\n
+	string::size_type size = ans.size();
+	string::size_type start = ans.find('!');
+	for (; start != string::npos; start = ans.find('!', start + 1)) {
+		string::size_type pos = start + 1;
+		bool has_val;
+		if (ans.compare(pos, 2, "OK") == 0) {
+			part = AnsResp;
+			pos += 2;
+			has_val = (pos < size) && (ans[pos] == ':');
+		} else if ((pos < size) && 
+			   ((ans[pos] == 'W') || (ans[pos] == 'E'))) {
+			part = (ans[pos++] == 'W') ? AnsWarn : AnsErr;
+			if ((pos < size) && (ans[pos] == '\a'))
+				++pos;
+			has_val = (pos < size) && (ans[pos] == ':');
+			if (!has_val)
+				continue;
+		} else {
+			continue;
+		}
+
+		beg = len = 0;
+		if (has_val) {
+			beg = ++pos;
+			while ((pos < size) && (ans[pos] != '\r'))
+				++pos;
+			len = pos - beg;
+			if (len == 0)
+				continue;
+		}
+		if (ans.compare(pos, 2, "\r\n") == 0)
+			return true;
+	}
+	return false;
+}
+
 void SerialLine::decodeFmtResp(const string& ans, string& fmt_resp)
 {
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR1(ans);
 
 	fmt_resp.clear();
+	m_last_err_code.clear();
 
-	const static RegEx re("!(OK(:(?P<resp>[^\r]+))?|"
-			        "W\a?:(?P<warn>[^\r]+)|"
-			        "E\a?:(?P<err>[^\r]+))\r\n");
-
-	RegEx::FullNameMatchType match;
-	if (!re.matchName(ans, match))
+	AnsPart part;
+	string::size_type beg, len;
+	if (!findAns(ans, part, beg, len))
 		THROW_HW_ERROR(Error) << "Unexpected Frelon answer: "
 				      << DEB_VAR1(ans);
 
-	RegEx::SingleMatchType& err = match["err"];
-	if (err.found()) 
-		THROW_HW_ERROR(Error) << "Frelon Error: " << string(err);
+	if (part == AnsErr) {
+		m_last_err_code.assign(ans, beg, len);
+		THROW_HW_ERROR(Error) << "Frelon Error: " << m_last_err_code;
+	}
 
-	RegEx::SingleMatchType& warn = match["warn"];
-	if (warn.found()) {
-		string warn_str = warn;
+	if (part == AnsWarn) {
+		string warn_str = ans.substr(beg, len);
 		DEB_WARNING() << "Camera warning: " << warn_str;
 		istringstream is(warn_str);
 		is >> m_last_warn;
 		return;
 	}
 
-	fmt_resp = match["resp"];
+	fmt_resp.assign(ans, beg, len);
 	if (!fmt_resp.empty())
 		DEB_RETURN() << DEB_VAR1(fmt_resp);
 }
 
 void SerialLine::sendFmtCmd(const string& cmd, string& resp)
+{
+	unsigned long nb_bytes;
+	execFmtCmd(cmd, resp, nb_bytes);
+}
+
+// nb_bytes is read before releasing the line: only this command
+void SerialLine::execFmtCmd(const string& cmd, string& resp,
+			    unsigned long& nb_bytes)
 {
 	DEB_MEMBER_FUNCT();
 
@@ -516,11 +878,114 @@ void SerialLine::sendFmtCmd(const string& cmd, string& resp)
 
 	m_curr_fmt_resp.clear();
 
-	writeCmd(cmd);
-	string ans;
-	readResp(ans);
+	// the reconfiguration wait is done once the line is free again
+	bool defer_sleep = m_defer_sleep;
+	m_defer_sleep = true;
+	try {
+		writeCmd(cmd);
+		string ans;
+		readResp(ans);
+	} catch (...) {
+		m_defer_sleep = defer_sleep;
+		throw;
+	}
+	m_defer_sleep = defer_sleep;
 
 	resp = m_curr_fmt_resp;
+	nb_bytes = m_cmd_nb_bytes;
+
+	if (!m_defer_sleep)
+		doDeferredSleep();
+}
+
+void SerialLine::sendFastCmd(Cmd cmd, bool wait_ack)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(cmd, wait_ack);
+
+	// Reset & Reload have side effects on the register cache
+	if ((cmd == Reset) || (cmd == Reload))
+		THROW_HW_ERROR(InvalidValue) << "Invalid fast " 
+					     << DEB_VAR1(cmd);
+
+	AutoMutex l = lock(AutoMutex::Locked);
+
+	while (m_curr_op != None)
+		m_cond.wait();
+
+	checkPendingErr();
+	readPendingAcks(wait_ack ? 0 : MaxPendingAcks - 1);
+
+	const string& msg = m_cmd_msg[cmd];
+	CmdStats& stats = m_cmd_stats[cmd];
+	stats.nb_calls++;
+	stats.nb_bytes_written += msg.size();
+	Timestamp t0 = Timestamp::now();
+	m_hw_ser_line.write(msg);
+	if (!wait_ack) {
+		m_pending_acks.push_back(cmd);
+		return;
+	}
+
+	string ans, resp;
+	m_hw_ser_line.readLine(ans, MaxReadLen, TimeoutSingle);
+	stats.nb_bytes_read += ans.size();
+	stats.addAckDelay(Timestamp::now() - t0);
+	decodeFmtResp(ans, resp);
+}
+
+void SerialLine::getNbPendingAcks(int& nb_pending_acks)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l = lock(AutoMutex::Locked);
+	nb_pending_acks = m_pending_acks.size();
+	DEB_RETURN() << DEB_VAR1(nb_pending_acks);
+}
+
+void SerialLine::flushPendingAcks()
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l = lock(AutoMutex::Locked);
+	// no wait: the caller can already hold the line, and a command 
+	// in progress has read them before being written
+	if (m_curr_op == None)
+		readPendingAcks(0);
+	checkPendingErr();
+}
+
+void SerialLine::checkPendingErr()
+{
+	DEB_MEMBER_FUNCT();
+	if (m_pending_err.empty())
+		return;
+
+	string err;
+	err.swap(m_pending_err);
+	THROW_HW_ERROR(Error) << "Un-acknowledged " << err;
+}
+
+// called with the line locked before writing a new command: the 
+// errors are reported by the next sendFastCmd or flushPendingAcks
+void SerialLine::readPendingAcks(int max_pending)
+{
+	DEB_MEMBER_FUNCT();
+
+	while (int(m_pending_acks.size()) > max_pending) {
+		Cmd cmd = m_pending_acks.front();
+		m_pending_acks.pop_front();
+		string ans, resp;
+		m_hw_ser_line.readLine(ans, MaxReadLen, TimeoutSingle);
+		m_cmd_stats[cmd].nb_bytes_read += ans.size();
+		try {
+			decodeFmtResp(ans, resp);
+		} catch (Exception& e) {
+			DEB_ERROR() << "Un-acknowledged " << CmdStrMap[cmd] 
+				    << ": " << e;
+			m_pending_err = CmdStrMap[cmd] + " failed: " + 
+					e.getErrMsg();
+			m_last_err_code.clear();
+		}
+	}
 }
 
 int SerialLine::getLastWarning()
@@ -537,7 +1002,7 @@ void SerialLine::clearCache()
 	DEB_MEMBER_FUNCT();
 	AutoMutex l = lock(AutoMutex::Locked);
 	DEB_TRACE() << "Clearing reg cache";
-	m_reg_cache.clear();
+	clearRegCache();
 }
 
 void SerialLine::setCacheActive(bool cache_act)
@@ -547,9 +1012,11 @@ void SerialLine::setCacheActive(bool cache_act)
 	AutoMutex l = lock(AutoMutex::Locked);
 	if (cache_act && !m_cache_act) {
 		DEB_TRACE() << "Clearing reg cache";
-		m_reg_cache.clear();
+		clearRegCache();
 	}
+	AutoMutex cache_l(m_cache_lock);
 	m_cache_act = cache_act;
+	++m_readout_cfg_gen;
 }
 
 void SerialLine::getCacheActive(bool& cache_act)
@@ -560,6 +1027,57 @@ void SerialLine::getCacheActive(bool& cache_act)
 	DEB_RETURN() << DEB_VAR1(cache_act);
 }
 
+void SerialLine::getCacheSnapshot(RegDoubleMapType& snapshot)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l = lock(AutoMutex::Locked);
+	snapshot.clear();
+	for (int i = 0; i < NbRegs; ++i) {
+		const RegCacheEntry& entry = m_reg_cache[i];
+		if (entry.valid)
+			snapshot[Reg(i)] = entry.val;
+	}
+	DEB_RETURN() << DEB_VAR1(snapshot.size());
+}
+
+void SerialLine::setCacheSnapshot(const RegDoubleMapType& snapshot)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(snapshot.size());
+	RegDoubleMapType::const_iterator it, end = snapshot.end();
+	for (it = snapshot.begin(); it != end; ++it) {
+		Reg reg = it->first;
+		bool ok = ((reg >= 0) && (reg < NbRegs) && 
+			   HasRegFlag(reg, RegCacheable));
+		if (!ok)
+			THROW_HW_ERROR(InvalidValue) << "Invalid cache " 
+						     << DEB_VAR1(reg);
+	}
+
+	AutoMutex l = lock(AutoMutex::Locked);
+	if (!m_cache_act) {
+		DEB_TRACE() << "Reg cache is disabled";
+		return;
+	}
+	AutoMutex cache_l(m_cache_lock);
+	for (it = snapshot.begin(); it != end; ++it) {
+		Reg reg = it->first;
+		RegCacheEntry& entry = m_reg_cache[reg];
+		entry.val = it->second;
+		entry.valid = true;
+	}
+	++m_readout_cfg_gen;
+}
+
+unsigned long SerialLine::getReadoutCfgGen()
+{
+	AutoMutex cache_l(m_cache_lock);
+	// without the cache the register changes cannot be followed
+	if (!m_cache_act)
+		return ++m_readout_cfg_gen;
+	return m_readout_cfg_gen;
+}
+
 void SerialLine::getResetTraceLog(StrList& reset_trace_log)
 {
 	DEB_MEMBER_FUNCT();
@@ -571,25 +1089,695 @@ void SerialLine::getResetTraceLog(StrList& reset_trace_log)
 void SerialLine::writeRegister(Reg reg, int  val)
 {
 	DEB_MEMBER_FUNCT();
-	const string& reg_str = RegStrMap[reg];
+	if ((reg < 0) || (reg >= NbRegs))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(reg);
+	const string reg_str = GetRegProp(reg).str;
 	DEB_PARAM() << DEB_VAR3(reg, reg_str, val);
 
 	int cache_val;
 	bool in_cache = getRegCacheValSafe(reg, cache_val);
 	if (in_cache && (cache_val == val)) {
 		DEB_TRACE() << "Value already in cache";
+		countCacheHit(reg);
 		return;
 	} 
 
-	if (reg_str.empty())
-		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(reg);
-
 	ostringstream cmd;
 	cmd << reg_str << val;
 	string resp;
 	sendFmtCmd(cmd.str(), resp);
 }
 
+// merged into m_reg_stats by getRegStats, no line lock on cache hits
+void SerialLine::countCacheHit(Reg reg)
+{
+	AutoMutex cache_l(m_cache_lock);
+	m_cache_hits[reg]++;
+}
+
+void SerialLine::addWriteRetry(Reg reg, bool busy)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(reg, busy);
+	if ((reg < 0) || (reg >= NbRegs))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(reg);
+	AutoMutex l = lock(AutoMutex::Locked);
+	CmdStats& stats = m_reg_stats[reg];
+	if (busy)
+		stats.nb_busy_retries++;
+	else
+		stats.nb_fail_retries++;
+}
+
+void SerialLine::getRegStats(Reg reg, CmdStats& stats)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(reg);
+	if ((reg < 0) || (reg >= NbRegs))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(reg);
+	AutoMutex l = lock(AutoMutex::Locked);
+	stats = m_reg_stats[reg];
+	AutoMutex cache_l(m_cache_lock);
+	unsigned long nb_hits = m_cache_hits[reg];
+	stats.nb_calls += nb_hits;
+	stats.nb_cache_hits += nb_hits;
+	DEB_RETURN() << DEB_VAR1(stats);
+}
+
+void SerialLine::getCmdStats(Cmd cmd, CmdStats& stats)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(cmd);
+	if ((cmd < 0) || (cmd >= NbCmds))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(cmd);
+	AutoMutex l = lock(AutoMutex::Locked);
+	stats = m_cmd_stats[cmd];
+	DEB_RETURN() << DEB_VAR1(stats);
+}
+
+void SerialLine::getMultiLineCmdStats(MultiLineCmd cmd, CmdStats& stats)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(cmd);
+	if ((cmd < 0) || (cmd >= NbMultiLineCmds))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(cmd);
+	AutoMutex l = lock(AutoMutex::Locked);
+	stats = m_ml_cmd_stats[cmd];
+	DEB_RETURN() << DEB_VAR1(stats);
+}
+
+void SerialLine::resetStats()
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l = lock(AutoMutex::Locked);
+	AutoMutex cache_l(m_cache_lock);
+	for (int i = 0; i < NbRegs; ++i) {
+		m_reg_stats[i].reset();
+		m_cache_hits[i] = 0;
+	}
+	for (int i = 0; i < NbCmds; ++i)
+		m_cmd_stats[i].reset();
+	for (int i = 0; i < NbMultiLineCmds; ++i)
+		m_ml_cmd_stats[i].reset();
+}
+
+void SerialLine::getTotalBytes(unsigned long& nb_written, 
+			       unsigned long& nb_read)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l = lock(AutoMutex::Locked);
+	nb_written = nb_read = 0;
+	for (int i = 0; i < NbRegs; ++i) {
+		nb_written += m_reg_stats[i].nb_bytes_written;
+		nb_read += m_reg_stats[i].nb_bytes_read;
+	}
+	for (int i = 0; i < NbCmds; ++i) {
+		nb_written += m_cmd_stats[i].nb_bytes_written;
+		nb_read += m_cmd_stats[i].nb_bytes_read;
+	}
+	for (int i = 0; i < NbMultiLineCmds; ++i) {
+		nb_written += m_ml_cmd_stats[i].nb_bytes_written;
+		nb_read += m_ml_cmd_stats[i].nb_bytes_read;
+	}
+	DEB_RETURN() << DEB_VAR2(nb_written, nb_read);
+}
+
+SerialLine::Transaction::Transaction(SerialLine& ser_line)
+	: m_ser_line(ser_line)
+{
+	DEB_CONSTRUCTOR();
+}
+
+void SerialLine::Transaction::writeRegister(Reg reg, int val)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(reg, val);
+
+	if ((reg < 0) || (reg >= NbRegs))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(reg);
+
+	RegResult entry;
+	entry.reg = reg;
+	entry.val = val;
+	entry.result = Pending;
+
+	// a later write to the same register overrides the previous one
+	ResultList::iterator it, end = m_list.end();
+	for (it = m_list.begin(); it != end; ++it) {
+		if (it->reg == reg) {
+			*it = entry;
+			return;
+		}
+	}
+	m_list.push_back(entry);
+}
+
+void SerialLine::Transaction::commit()
+{
+	DEB_MEMBER_FUNCT();
+	m_ser_line.commitTransaction(*this);
+}
+
+bool SerialLine::Transaction::isDone() const
+{
+	ResultList::const_iterator it, end = m_list.end();
+	for (it = m_list.begin(); it != end; ++it)
+		if ((it->result == Pending) || (it->result == Failed))
+			return false;
+	return true;
+}
+
+const SerialLine::Transaction::ResultList& 
+SerialLine::Transaction::getResults() const
+{
+	return m_list;
+}
+
+static bool IsSleepReg(const SerialLine::Transaction::RegResult& entry)
+{
+	return (GetRegProp(entry.reg).sleep_time > 0);
+}
+
+static const string BusyErrCode = "BSY";
+
+void SerialLine::commitTransaction(Transaction& trans)
+{
+	DEB_MEMBER_FUNCT();
+
+	AutoMutex l = lock(AutoMutex::Locked);
+
+	while (m_curr_op != None) {
+		DEB_TRACE() << "Waiting end of current " << m_curr_op;
+		m_cond.wait();
+	}
+
+	typedef Transaction::ResultList ResultList;
+	ResultList& list = trans.m_list;
+
+	m_defer_sleep = true;
+	m_deferred_sleep = 0;
+	try {
+		ResultList::iterator it, end = list.end();
+		for (it = list.begin(); it != end; ++it) {
+			Transaction::Result& result = it->result;
+			if ((result == Transaction::Written) ||
+			    (result == Transaction::Skipped))
+				continue;
+			if (!IsSleepReg(*it))
+				doDeferredSleep();
+			try {
+				writeTransactionReg(*it);
+			} catch (Exception e) {
+				// the camera may refuse writes while it is
+				// reconfiguring: wait for it and try again
+				bool busy = (m_last_err_code == BusyErrCode);
+				if (!busy || (m_deferred_sleep == 0))
+					throw;
+				DEB_TRACE() << "Camera busy, waiting "
+					    << "reconfiguration";
+				doDeferredSleep();
+				writeTransactionReg(*it);
+			}
+		}
+	} catch (...) {
+		m_defer_sleep = false;
+		doDeferredSleep();
+		throw;
+	}
+	m_defer_sleep = false;
+	doDeferredSleep();
+}
+
+void SerialLine::doDeferredSleep()
+{
+	DEB_MEMBER_FUNCT();
+	if (m_deferred_sleep == 0)
+		return;
+	double sleep_time = m_deferred_sleep;
+	m_deferred_sleep = 0;
+	waitReconfig(m_deferred_reg, sleep_time);
+}
+
+void SerialLine::waitReconfig(Reg reg, double sleep_time)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(reg, sleep_time);
+
+	Timestamp t0 = Timestamp::now();
+	bool ready = false;
+	if (m_reconfig_waiter) {
+		try {
+			ready = m_reconfig_waiter->waitReconfig(sleep_time);
+		} catch (Exception e) {
+			DEB_WARNING() << "Error polling camera readiness: " 
+				      << e.getErrMsg();
+		}
+	}
+	if (!ready) {
+		DEB_TRACE() << "Sleeping " << sleep_time << " s after "
+			    << "changing " << GetRegProp(reg).str;
+		Sleep(sleep_time);
+	}
+
+	double wait_time = Timestamp::now() - t0;
+	DEB_TRACE() << DEB_VAR2(ready, wait_time);
+	m_reg_stats[reg].sleep_time += wait_time;
+}
+
+void SerialLine::setReconfigWaiter(ReconfigWaiter *reconfig_waiter)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l = lock(AutoMutex::Locked);
+	m_reconfig_waiter = reconfig_waiter;
+}
+
+void SerialLine::writeTransactionReg(Transaction::RegResult& entry)
+{
+	DEB_MEMBER_FUNCT();
+	const char *reg_str = GetRegProp(entry.reg).str;
+	DEB_PARAM() << DEB_VAR3(entry.reg, reg_str, entry.val);
+
+	int cache_val;
+	bool in_cache = (isRegCacheable(entry.reg) && 
+			 getRegCacheVal(entry.reg, cache_val));
+	if (in_cache && (cache_val == entry.val)) {
+		DEB_TRACE() << "Value already in cache";
+		countCacheHit(entry.reg);
+		entry.result = Transaction::Skipped;
+		return;
+	}
+
+	m_last_err_code.clear();
+	try {
+		ostringstream cmd;
+		cmd << reg_str << entry.val;
+		string resp;
+		sendFmtCmd(cmd.str(), resp);
+		entry.result = Transaction::Written;
+		entry.err_msg.clear();
+	} catch (Exception e) {
+		entry.result = Transaction::Failed;
+		entry.err_msg = e.getErrMsg();
+		throw;
+	}
+}
+
+SerialLine::Request::Request()
+	: m_ser_line(NULL), m_state(Idle), m_nb_bytes(0)
+{
+	DEB_CONSTRUCTOR();
+}
+
+SerialLine::Request::~Request()
+{
+	DEB_DESTRUCTOR();
+	waitDone();
+}
+
+void SerialLine::Request::waitDone()
+{
+	if (!m_ser_line)
+		return;
+	AutoMutex l(m_ser_line->m_queue_cond.mutex());
+	while ((m_state == Queued) || (m_state == Running))
+		m_ser_line->m_queue_cond.wait();
+}
+
+SerialLine::Request::State SerialLine::Request::getState()
+{
+	if (!m_ser_line)
+		return m_state;
+	AutoMutex l(m_ser_line->m_queue_cond.mutex());
+	return m_state;
+}
+
+bool SerialLine::Request::isDone()
+{
+	return (getState() == Done);
+}
+
+bool SerialLine::Request::wait(double timeout)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(timeout);
+
+	if (!m_ser_line)
+		THROW_HW_ERROR(Error) << "Request was not queued";
+
+	Cond& cond = m_ser_line->m_queue_cond;
+	AutoMutex l(cond.mutex());
+	Timestamp end = Timestamp::now() + Timestamp(timeout);
+	while (m_state != Done) {
+		if (timeout < 0) {
+			cond.wait();
+			continue;
+		}
+		double remaining = end - Timestamp::now();
+		if ((remaining <= 0) || !cond.wait(remaining)) {
+			if (m_state == Done)
+				break;
+			DEB_RETURN() << DEB_VAR1(m_state);
+			return false;
+		}
+	}
+
+	if (m_failed)
+		THROW_HW_ERROR(Error) << m_err_msg;
+	return true;
+}
+
+const string& SerialLine::Request::getResp() const
+{
+	return m_resp;
+}
+
+int SerialLine::Request::getVal() const
+{
+	return m_val;
+}
+
+double SerialLine::Request::getFloatVal() const
+{
+	return m_float_val;
+}
+
+unsigned long SerialLine::Request::getNbBytes() const
+{
+	return m_nb_bytes;
+}
+
+SerialLine::IOThread::IOThread(SerialLine& ser_line)
+	: m_ser_line(ser_line)
+{
+	DEB_CONSTRUCTOR();
+}
+
+SerialLine::IOThread::~IOThread()
+{
+	DEB_DESTRUCTOR();
+}
+
+void SerialLine::IOThread::threadFunction()
+{
+	DEB_MEMBER_FUNCT();
+	m_ser_line.ioThreadFunction();
+}
+
+void SerialLine::queueFmtCmd(const string& cmd, Request& req,
+			     Request::Priority prio)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(cmd, prio);
+
+	MsgPartPos msg_pos;
+	parseMsg(cmd, msg_pos);
+	if ((prio != Request::Normal) && msg_pos.empty(MsgReq))
+		THROW_HW_ERROR(InvalidValue) << "Only requests can have " 
+					     << DEB_VAR1(prio);
+
+	req.m_type = Request::FmtCmd;
+	req.m_cmd = cmd;
+	queueRequest(req, prio);
+}
+
+void SerialLine::queueMultiLineCmd(MultiLineCmd cmd, Request& req,
+				   Request::Priority prio)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(cmd, prio);
+	req.m_type = Request::MultiLine;
+	req.m_ml_cmd = cmd;
+	queueRequest(req, prio);
+}
+
+void SerialLine::queueWriteRegister(Reg reg, int val, Request& req)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(reg, val);
+	if ((reg < 0) || (reg >= NbRegs))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(reg);
+	req.m_type = Request::WriteReg;
+	req.m_reg = reg;
+	req.m_val = val;
+	queueRequest(req, Request::Normal);
+}
+
+void SerialLine::queueReadRegister(Reg reg, Request& req,
+				   Request::Priority prio)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(reg, prio);
+	if ((reg < 0) || (reg >= NbRegs))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(reg);
+	checkRegType<int>(reg);
+	req.m_type = Request::ReadReg;
+	req.m_reg = reg;
+	queueRequest(req, prio);
+}
+
+void SerialLine::queueReadFloatRegister(Reg reg, Request& req,
+					Request::Priority prio)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(reg, prio);
+	if ((reg < 0) || (reg >= NbRegs))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(reg);
+	checkRegType<double>(reg);
+	req.m_type = Request::ReadFloatReg;
+	req.m_reg = reg;
+	queueRequest(req, prio);
+}
+
+void SerialLine::queueRequest(Request& req, Request::Priority prio)
+{
+	DEB_MEMBER_FUNCT();
+
+	if ((prio < 0) || (prio >= Request::NbPriorities))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(prio);
+
+	AutoMutex l(m_queue_cond.mutex());
+	if ((req.m_state == Request::Queued) || 
+	    (req.m_state == Request::Running))
+		THROW_HW_ERROR(Error) << "Request already queued";
+	if (req.m_ser_line && (req.m_ser_line != this))
+		THROW_HW_ERROR(Error) << "Request used by another SerialLine";
+
+	req.m_ser_line = this;
+	req.m_prio = prio;
+	req.m_queue_ts = Timestamp::now();
+	req.m_resp.clear();
+	req.m_nb_bytes = 0;
+	req.m_failed = false;
+	req.m_err_msg.clear();
+
+	if (getCachedResult(req)) {
+		req.m_state = Request::Done;
+		addLatencySample(req);
+		return;
+	}
+
+	if (!m_io_thread) {
+		DEB_TRACE() << "Starting I/O thread";
+		m_io_thread = new IOThread(*this);
+		m_io_thread->start();
+	}
+
+	req.m_state = Request::Queued;
+	m_req_queue[prio].push_back(&req);
+	m_queue_cond.broadcast();
+}
+
+bool SerialLine::isQueueIdle()
+{
+	if (m_io_curr_req)
+		return false;
+	for (int i = 0; i < Request::NbPriorities; ++i)
+		if (!m_req_queue[i].empty())
+			return false;
+	return true;
+}
+
+SerialLine::Request *SerialLine::getNextRequest()
+{
+	DEB_MEMBER_FUNCT();
+
+	for (int i = 0; i < Request::NbPriorities; ++i) {
+		RequestQueue& queue = m_req_queue[i];
+		if (queue.empty())
+			continue;
+		if ((i == Request::Low) && m_defer_low_prio) {
+			DEB_TRACE() << "Deferring " << queue.size() 
+				    << " low priority requests";
+			break;
+		}
+		Request *req = queue.front();
+		queue.pop_front();
+		return req;
+	}
+	return NULL;
+}
+
+void SerialLine::addLatencySample(Request& req)
+{
+	double latency = Timestamp::now() - req.m_queue_ts;
+	LatencyList& lat_list = m_lat_list[req.m_prio];
+	int& idx = m_lat_idx[req.m_prio];
+	if (int(lat_list.size()) < MaxLatencySamples)
+		lat_list.push_back(latency);
+	else
+		lat_list[idx] = latency;
+	idx = (idx + 1) % MaxLatencySamples;
+}
+
+void SerialLine::getLatencyStats(Request::Priority prio, 
+				 LatencyStats& stats)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(prio);
+
+	if ((prio < 0) || (prio >= Request::NbPriorities))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(prio);
+
+	AutoMutex l(m_queue_cond.mutex());
+	LatencyList lat_list = m_lat_list[prio];
+	l.unlock();
+
+	sort(lat_list.begin(), lat_list.end());
+	int nb_samples = lat_list.size();
+	stats.nb_samples = nb_samples;
+	if (nb_samples == 0) {
+		stats.p50 = stats.p90 = stats.p99 = stats.max = 0;
+		return;
+	}
+	stats.p50 = lat_list[(nb_samples - 1) * 50 / 100];
+	stats.p90 = lat_list[(nb_samples - 1) * 90 / 100];
+	stats.p99 = lat_list[(nb_samples - 1) * 99 / 100];
+	stats.max = lat_list.back();
+	DEB_RETURN() << DEB_VAR1(stats);
+}
+
+void SerialLine::resetLatencyStats()
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_queue_cond.mutex());
+	for (int i = 0; i < Request::NbPriorities; ++i) {
+		m_lat_list[i].clear();
+		m_lat_idx[i] = 0;
+	}
+}
+
+void SerialLine::setDeferLowPrio(bool defer_low_prio)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(defer_low_prio);
+	AutoMutex l(m_queue_cond.mutex());
+	m_defer_low_prio = defer_low_prio;
+	m_queue_cond.broadcast();
+}
+
+void SerialLine::getDeferLowPrio(bool& defer_low_prio)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_queue_cond.mutex());
+	defer_low_prio = m_defer_low_prio;
+	DEB_RETURN() << DEB_VAR1(defer_low_prio);
+}
+
+bool SerialLine::getCachedResult(Request& req)
+{
+	DEB_MEMBER_FUNCT();
+
+	// with pending requests the cache may not reflect the queued writes
+	if (!isQueueIdle())
+		return false;
+
+	bool in_cache = false;
+	switch (req.m_type) {
+	case Request::ReadReg:
+		in_cache = getRegCacheValSafe(req.m_reg, req.m_val);
+		break;
+	case Request::ReadFloatReg:
+		in_cache = getRegCacheValSafe(req.m_reg, req.m_float_val);
+		break;
+	case Request::WriteReg:
+		int cache_val;
+		in_cache = (getRegCacheValSafe(req.m_reg, cache_val) && 
+			    (cache_val == req.m_val));
+		break;
+	default:
+		break;
+	}
+	if (in_cache) {
+		DEB_TRACE() << "Request answered from cache";
+		countCacheHit(req.m_reg);
+	}
+	return in_cache;
+}
+
+void SerialLine::execRequest(Request& req)
+{
+	DEB_MEMBER_FUNCT();
+
+	try {
+		switch (req.m_type) {
+		case Request::FmtCmd:
+			execFmtCmd(req.m_cmd, req.m_resp, req.m_nb_bytes);
+			break;
+		case Request::MultiLine:
+			write(MultiLineCmdStrMap[req.m_ml_cmd]);
+			readLine(req.m_resp);
+			break;
+		case Request::WriteReg:
+			writeRegister(req.m_reg, req.m_val);
+			break;
+		case Request::ReadReg:
+			readCameraRegister(req.m_reg, req.m_val, 
+					   req.m_nb_bytes);
+			break;
+		case Request::ReadFloatReg:
+			readCameraRegister(req.m_reg, req.m_float_val,
+					   req.m_nb_bytes);
+			break;
+		}
+	} catch (Exception e) {
+		req.m_failed = true;
+		req.m_err_msg = e.getErrMsg();
+	} catch (...) {
+		req.m_failed = true;
+		req.m_err_msg = "Unknown exception";
+	}
+
+	if (req.m_failed)
+		DEB_TRACE() << "Request failed: " << req.m_err_msg;
+}
+
+void SerialLine::ioThreadFunction()
+{
+	DEB_MEMBER_FUNCT();
+
+	AutoMutex l(m_queue_cond.mutex());
+	while (true) {
+		Request *req;
+		while (!(req = getNextRequest()) && !m_io_quit)
+			m_queue_cond.wait();
+		if (!req)
+			break;
+
+		req->m_state = Request::Running;
+		m_io_curr_req = req;
+		{
+			AutoMutexUnlock u(l);
+			execRequest(*req);
+		}
+		m_io_curr_req = NULL;
+		addLatencySample(*req);
+		req->m_state = Request::Done;
+		m_queue_cond.broadcast();
+	}
+
+	DEB_TRACE() << "I/O thread finished";
+}
+
 ostream& lima::Frelon::operator <<(ostream& os, SerialLine::RegOp op)
 {
 	const char *name = "Unknown";
@@ -604,3 +1792,60 @@ ostream& lima::Frelon::operator <<(ostream& os, SerialLine::RegOp op)
 	return os << name;
 }
 
+ostream& lima::Frelon::operator <<(ostream& os, 
+				   SerialLine::Transaction::Result result)
+{
+	const char *name = "Unknown";
+	switch (result) {
+	case SerialLine::Transaction::Pending: name = "Pending"; break;
+	case SerialLine::Transaction::Skipped: name = "Skipped"; break;
+	case SerialLine::Transaction::Written: name = "Written"; break;
+	case SerialLine::Transaction::Failed:  name = "Failed";  break;
+	}
+	return os << name;
+}
+
+ostream& lima::Frelon::operator <<(ostream& os, 
+				   SerialLine::Request::Priority prio)
+{
+	const char *name = "Unknown";
+	switch (prio) {
+	case SerialLine::Request::High:   name = "High";   break;
+	case SerialLine::Request::Normal: name = "Normal"; break;
+	case SerialLine::Request::Low:    name = "Low";    break;
+	default: break;
+	}
+	return os << name;
+}
+
+ostream& lima::Frelon::operator <<(ostream& os, 
+				   const SerialLine::LatencyStats& stats)
+{
+	return os << "<"
+		  << "nb_samples=" << stats.nb_samples << ", "
+		  << "p50=" << stats.p50 << ", "
+		  << "p90=" << stats.p90 << ", "
+		  << "p99=" << stats.p99 << ", "
+		  << "max=" << stats.max
+		  << ">";
+}
+
+ostream& lima::Frelon::operator <<(ostream& os, 
+				   const SerialLine::CmdStats& stats)
+{
+	os << "<"
+	   << "nb_calls=" << stats.nb_calls << ", "
+	   << "nb_cache_hits=" << stats.nb_cache_hits << ", "
+	   << "nb_cache_misses=" << stats.nb_cache_misses << ", "
+	   << "nb_bytes_written=" << stats.nb_bytes_written << ", "
+	   << "nb_bytes_read=" << stats.nb_bytes_read << ", "
+	   << "ack_delay_hist=[";
+	for (int i = 0; i < SerialLine::CmdStats::NbAckDelayBins; ++i)
+		os << (i ? ", " : "") << stats.ack_delay_hist[i];
+	return os << "], "
+		  << "ack_delay_total=" << stats.ack_delay_total << ", "
+		  << "sleep_time=" << stats.sleep_time << ", "
+		  << "nb_busy_retries=" << stats.nb_busy_retries << ", "
+		  << "nb_fail_retries=" << stats.nb_fail_retries
+		  << ">";
+}
@@ -0,0 +1,863 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include "FrelonSimulator.h"
+#include "FrelonTimingCtrl.h"
+#include "lima/MiscUtils.h"
+#include <sstream>
+#include <cstdlib>
+#include <cctype>
+
+using namespace lima;
+using namespace lima::Frelon;
+using namespace std;
+
+// 19200 baud, 10 bits per byte: ~11 ms per register round-trip
+const double Simulator::DefByteTime     = 10 / 19200.0;
+const double Simulator::DefCmdDelay     = 2e-3;
+const double Simulator::DefLineDelay    = 1e-3;
+const double Simulator::DefReconfigTime = 0.5;
+const double Simulator::DefResetTime    = 1.0;
+
+// HD E2V 2k (SPB2), serial #1
+const int Simulator::DefComplexSerNb = 0x2101;
+const string Simulator::DefVersion = "3.1c";
+
+// CCD readout model, close to the initial TimingCtrl SeqTim measures
+// of a real Frelon 2k, plus a per-line overhead not in its model
+static const double SimPixelTime[2]  = {90e-9, 44e-9};
+static const double SimLineOverhead  = 2e-6;
+static const double SimLineShiftTime = 2.625e-6;
+static const double SimVertShiftTime = 1.36e-6;
+
+static const Reg ReadOnlyRegCList[] = {
+	Version,	CompSerNb,	LastWarn,	CcdModesAvail,
+	ReadoutTime,	TransferTime,	CamChar,
+	AoiImageHeight,	AoiImageWidth,
+	StatusSeqA,	StatusSeqB,
+	StatusAMTA,	StatusAMTB,	StatusAMTC,	StatusAMTD,
+	StatusAMTE,
+	SeqTimRdOutH,		SeqTimRdOutL,
+	SeqTimTransferH,	SeqTimTransferL,
+	SeqTimEShutH,		SeqTimEShutL,
+	SeqTimExposureH,	SeqTimExposureL,
+	SeqTimFramePeriodH,	SeqTimFramePeriodL,
+};
+
+Simulator::Simulator(int complex_ser_nb, const string& ver, int cam_char)
+	: HwSerialLine("\r\n"),
+	  m_ver(ver), m_byte_time(DefByteTime), m_cmd_delay(DefCmdDelay),
+	  m_line_delay(DefLineDelay), m_reconfig_time(DefReconfigTime),
+	  m_reset_time(DefResetTime), m_rx_end(0),
+	  m_nb_cmds(0), m_nb_written(0), m_nb_read(0)
+{
+	DEB_CONSTRUCTOR();
+	DEB_PARAM() << DEB_VAR3(DEB_HEX(complex_ser_nb), ver,
+				DEB_HEX(cam_char));
+
+	m_model.setVersionStr(ver);
+	m_model.setComplexSerialNb(complex_ser_nb);
+	m_model.setCamChar(cam_char);
+	DEB_TRACE() << "Simulating Frelon " << m_model.getName();
+
+	m_t0 = Timestamp::now();
+	resetRegs();
+}
+
+Simulator::~Simulator()
+{
+	DEB_DESTRUCTOR();
+}
+
+void Simulator::resetRegs()
+{
+	DEB_MEMBER_FUNCT();
+
+	int complex_ser_nb, cam_char;
+	m_model.getComplexSerialNb(complex_ser_nb);
+	m_model.getCamChar(cam_char);
+	Size ccd_size = ChipMaxFrameDimMap[m_model.getChipType()].getSize();
+
+	m_reg_val.clear();
+	m_reg_val[NbFrames] = 1;
+	m_reg_val[ExpTime] = 100;
+	m_reg_val[TimeUnit] = Milliseconds;
+	m_reg_val[ChanMode] = FTMChanRangeMap[FTM].first - 1;
+	m_reg_val[BinVert] = 1;
+	m_reg_val[BinHorz] = 1;
+	m_reg_val[RoiPixelWidth] = ccd_size.getWidth() / 2;
+	m_reg_val[RoiLineWidth] = ccd_size.getHeight() / 2;
+	m_reg_val[HardTrigDisable] = ExtSyncBoth;
+	m_reg_val[ImagesPerEOF] = 1;
+	m_reg_val[CcdModesAvail] = (1 << FTMChanRangeMap[FTM].second) - 1;
+	m_reg_val[SeqClockFreq] = 10;
+	m_reg_val[CompSerNb] = complex_ser_nb;
+	m_reg_val[CamChar] = cam_char;
+
+	m_reconfig_end = 0;
+	m_acq_running = false;
+	m_acq_start = m_acq_stop = 0;
+	m_acq_nb_frames = 0;
+	m_img_count = 0;
+	calcAcqTiming(m_acq_timing);
+}
+
+double Simulator::now()
+{
+	return Timestamp::now() - m_t0;
+}
+
+void Simulator::write(const string& buffer, bool no_wait)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(buffer, no_wait);
+
+	AutoMutex l(m_mutex);
+	double xfer_time = buffer.size() * m_byte_time;
+	m_rx_end = now() + xfer_time;
+	m_nb_written += buffer.size();
+
+	if (!no_wait) {
+		AutoMutexUnlock u(l);
+		Sleep(xfer_time);
+	}
+
+	string::size_type beg, end;
+	for (beg = 0; beg < buffer.size(); beg = end + 1) {
+		end = buffer.find_first_of("\r\n", beg);
+		if (end == string::npos)
+			end = buffer.size();
+		if (end > beg)
+			processCmd(buffer.substr(beg, end - beg));
+	}
+}
+
+void Simulator::sendResp(const string& resp, double delay, double line_delay)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(resp, delay, line_delay);
+
+	double t = max(now(), m_rx_end) + delay;
+	if (!m_out.empty()) {
+		const OutChunk& last = m_out.back();
+		t = max(t, last.t0 + last.data.size() * m_byte_time);
+	}
+
+	string::size_type beg, end;
+	for (beg = 0; beg < resp.size(); beg = end) {
+		end = resp.find('\n', beg);
+		end = (end == string::npos) ? resp.size() : end + 1;
+		OutChunk chunk;
+		chunk.data = resp.substr(beg, end - beg);
+		chunk.t0 = t;
+		m_out.push_back(chunk);
+		t += chunk.data.size() * m_byte_time + line_delay;
+	}
+}
+
+void Simulator::processCmd(const string& cmd_line)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(cmd_line);
+
+	++m_nb_cmds;
+
+	string::size_type pos = 0, beg, len = cmd_line.size();
+	if ((pos < len) && (cmd_line[pos] == '>'))
+		++pos;
+	for (beg = pos; (pos < len) && isalpha(cmd_line[pos]); ++pos)
+		;
+	string cmd = cmd_line.substr(beg, pos - beg);
+
+	string req, val;
+	if ((pos < len) && (cmd_line[pos] == '?')) {
+		req = cmd_line.substr(pos++, 1);
+	} else {
+		beg = pos;
+		if ((pos < len) && (cmd_line[pos] == '-'))
+			++pos;
+		while ((pos < len) && (isdigit(cmd_line[pos]) ||
+				       (cmd_line[pos] == '.')))
+			++pos;
+		val = cmd_line.substr(beg, pos - beg);
+	}
+
+	if (cmd.empty() || (pos != len)) {
+		DEB_WARNING() << "Invalid command: " << DEB_VAR1(cmd_line);
+		sendResp("!E:Invalid command\r\n", m_cmd_delay);
+		return;
+	}
+
+	Cmd seq_cmd;
+	if (FindCmdByStr(cmd, seq_cmd)) {
+		processSeqCmd(seq_cmd);
+		return;
+	}
+
+	MultiLineCmd ml_cmd;
+	if (FindMultiLineCmdByStr(cmd, ml_cmd)) {
+		processMultiLineCmd(ml_cmd);
+		return;
+	}
+
+	Reg reg;
+	if (FindRegByStr(cmd, reg)) {
+		processRegCmd(reg, req, val);
+		return;
+	}
+
+	DEB_WARNING() << "Unknown command: " << DEB_VAR1(cmd);
+	sendResp("!E:Unknown command\r\n", m_cmd_delay);
+}
+
+void Simulator::processRegCmd(Reg reg, const string& req, const string& val)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(reg, req, val);
+
+	double t = max(now(), m_rx_end);
+
+	if (!req.empty()) {
+		ostringstream os;
+		os << "!OK:";
+		if (reg == Version) {
+			os << m_ver;
+		} else if ((reg == ReadoutTime) || (reg == TransferTime)) {
+			double readout_time, xfer_time;
+			calcReadoutTime(readout_time, xfer_time);
+			bool readout = (reg == ReadoutTime);
+			os << (readout ? readout_time : xfer_time) * 1e6;
+		} else if ((reg == AoiImageWidth) || (reg == AoiImageHeight)) {
+			int width, height;
+			calcImageSize(width, height);
+			os << ((reg == AoiImageWidth) ? width : height);
+		} else {
+			os << getRegVal(reg, t);
+		}
+		os << "\r\n";
+		sendResp(os.str(), m_cmd_delay);
+		return;
+	}
+
+	RegErrMap::iterator eit = m_reg_err.find(reg);
+	if (eit != m_reg_err.end()) {
+		ErrCount& err_count = eit->second;
+		bool busy = (err_count.first == ErrBusy);
+		if (--err_count.second <= 0)
+			m_reg_err.erase(eit);
+		sendResp(busy ? "!E:BSY\r\n" : "!E:FAI\r\n", m_cmd_delay);
+		return;
+	}
+
+	bool is_signed = HasRegFlag(reg, RegSigned);
+	int reg_val = atoi(val.c_str());
+	bool bad_val = (val.empty() || (val.find('.') != string::npos) ||
+			(reg_val > MaxRegVal) || ((reg_val < 0) && !is_signed));
+	if (isRegReadOnly(reg)) {
+		sendResp("!E:Read-only register\r\n", m_cmd_delay);
+		return;
+	} else if (bad_val) {
+		sendResp("!E:Invalid value\r\n", m_cmd_delay);
+		return;
+	} else if (isReconfiguring(t)) {
+		DEB_TRACE() << "Camera busy reconfiguring";
+		sendResp("!E:BSY\r\n", m_cmd_delay);
+		return;
+	}
+
+	m_reg_val[reg] = reg_val;
+	if (GetRegProp(reg).sleep_time > 0) {
+		DEB_TRACE() << "Reconfiguring during " << m_reconfig_time;
+		m_reconfig_end = t + m_cmd_delay + m_reconfig_time;
+	}
+	sendResp("!OK\r\n", m_cmd_delay);
+}
+
+void Simulator::processSeqCmd(Cmd cmd)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(cmd);
+
+	double t = max(now(), m_rx_end);
+	updateAcq(t);
+
+	switch (cmd) {
+	case Start:
+		if (m_acq_running || isReconfiguring(t)) {
+			sendResp("!E:BSY\r\n", m_cmd_delay);
+			return;
+		}
+		calcAcqTiming(m_acq_timing);
+		m_acq_start = t + m_cmd_delay;
+		m_acq_nb_frames = m_reg_val[NbFrames];
+		m_acq_running = true;
+		m_img_count = 0;
+		DEB_TRACE() << "Starting " << DEB_VAR2(m_acq_nb_frames,
+						       m_acq_timing.frame_period);
+		break;
+
+	case Stop:
+		if (m_acq_running) {
+			DEB_TRACE() << "Aborting acquisition";
+			m_acq_running = false;
+			m_acq_stop = t;
+			latchSeqTim();
+		}
+		break;
+
+	case Reset: {
+		resetRegs();
+		ostringstream os;
+		os << "Frelon " << m_model.getName() << " reset\r\n"
+		   << "Firmware " << m_ver << "\r\n"
+		   << "Init done\r\n"
+		   << "!OK\r\n";
+		sendResp(os.str(), m_reset_time, m_line_delay);
+		return;
+	}
+
+	case Reload:
+		sendResp("!OK\r\n", m_reset_time);
+		return;
+
+	default:
+		break;
+	}
+
+	sendResp("!OK\r\n", m_cmd_delay);
+}
+
+void Simulator::processMultiLineCmd(MultiLineCmd cmd)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(cmd);
+
+	double t = max(now(), m_rx_end);
+
+	ostringstream os;
+	if (cmd == Help) {
+		CmdStrMapType::const_iterator cit, cend = CmdStrMap.end();
+		for (cit = CmdStrMap.begin(); cit != cend; ++cit)
+			os << cit->second << ": command\r\n";
+		MultiLineCmdStrMapType::const_iterator mit, mend;
+		mend = MultiLineCmdStrMap.end();
+		for (mit = MultiLineCmdStrMap.begin(); mit != mend; ++mit)
+			os << mit->second << ": multi-line dump\r\n";
+	} else if (cmd == Config) {
+		RegStrMapType::const_iterator it, end = RegStrMap.end();
+		for (it = RegStrMap.begin(); it != end; ++it)
+			if (!isRegReadOnly(it->first))
+				os << it->second << "=" << getRegVal(it->first, t)
+				   << "\r\n";
+	} else if (cmd == Timing) {
+		double readout_time, xfer_time;
+		calcReadoutTime(readout_time, xfer_time);
+		os << "TRD=" << readout_time * 1e6 << "\r\n"
+		   << "TTR=" << xfer_time * 1e6 << "\r\n";
+		typedef TimingCtrl::SeqTim::RegPairList RegPairList;
+		const RegPairList& l = TimingCtrl::SeqTim::RegList;
+		RegPairList::const_iterator it, end = l.end();
+		for (it = l.begin(); it != end; ++it)
+			os << GetRegProp(it->first).str << "="
+			   << getRegVal(it->first, t) << "\r\n"
+			   << GetRegProp(it->second).str << "="
+			   << getRegVal(it->second, t) << "\r\n";
+	} else if (cmd == StatusCam) {
+		os << "SSA=" << getRegVal(StatusSeqA, t) << "\r\n"
+		   << "SAA=" << getRegVal(StatusAMTA, t) << "\r\n"
+		   << "SAC=" << getRegVal(StatusAMTC, t) << "\r\n"
+		   << "SAD=" << getRegVal(StatusAMTD, t) << "\r\n";
+	} else {
+		const string& name = MultiLineCmdStrMap[cmd];
+		for (int i = 0; i < 4; ++i)
+			os << name << " #" << i << "\r\n";
+	}
+
+	sendResp(os.str(), m_cmd_delay, m_line_delay);
+}
+
+bool Simulator::findTerm(const string& term, int max_len,
+			 int& len, double& t_avail)
+{
+	len = 0;
+	t_avail = 0;
+	string::size_type match = 0;
+	OutChunkList::const_iterator it, end = m_out.end();
+	for (it = m_out.begin(); it != end; ++it) {
+		const string& data = it->data;
+		for (string::size_type i = 0; i < data.size(); ++i) {
+			++len;
+			t_avail = it->t0 + (i + 1) * m_byte_time;
+			if (term.empty() || (len == max_len))
+				return true;
+			match = (data[i] == term[match]) ? match + 1 :
+				(data[i] == term[0]) ? 1 : 0;
+			if (match == term.size())
+				return true;
+		}
+	}
+	return false;
+}
+
+void Simulator::extractOut(string& buffer, int len)
+{
+	buffer.clear();
+	while ((len > 0) && !m_out.empty()) {
+		OutChunk& chunk = m_out.front();
+		int n = min(len, int(chunk.data.size()));
+		buffer += chunk.data.substr(0, n);
+		len -= n;
+		if (n == int(chunk.data.size())) {
+			m_out.erase(m_out.begin());
+		} else {
+			chunk.data.erase(0, n);
+			chunk.t0 += n * m_byte_time;
+		}
+	}
+	m_nb_read += buffer.size();
+}
+
+void Simulator::readAvail(string& buffer, int max_len, const string& term,
+			  double timeout)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(max_len, term, timeout);
+
+	timeout = checkDefTimeout(timeout);
+
+	AutoMutex l(m_mutex);
+	int len;
+	double t_avail;
+	bool found = findTerm(term, max_len, len, t_avail);
+	double wait_time = t_avail - now();
+	bool forever = (timeout == TimeoutBlockForever);
+	if (!found || (!forever && (wait_time > timeout))) {
+		if (timeout > 0) {
+			AutoMutexUnlock u(l);
+			Sleep(timeout);
+		}
+		THROW_HW_ERROR(Error) << "Simulator: " 
+				      << Espia::StrError(SCDXIPCI_ERR_TIMEOUT);
+	}
+
+	if (wait_time > 0) {
+		AutoMutexUnlock u(l);
+		Sleep(wait_time);
+	}
+
+	if (term.empty())
+		len = min(max(countAvail(now()), 1), max_len);
+	extractOut(buffer, len);
+	DEB_RETURN() << DEB_VAR1(buffer);
+}
+
+void Simulator::read(string& buffer, int max_len, double timeout)
+{
+	DEB_MEMBER_FUNCT();
+	readAvail(buffer, max_len, "", timeout);
+}
+
+void Simulator::readStr(string& buffer, int max_len, const string& term, 
+			double timeout)
+{
+	DEB_MEMBER_FUNCT();
+	readAvail(buffer, max_len, term, timeout);
+}
+
+void Simulator::readLine(string& buffer, int max_len, double timeout)
+{
+	DEB_MEMBER_FUNCT();
+	string term;
+	getLineTerm(term);
+	readAvail(buffer, max_len, term, timeout);
+}
+
+void Simulator::flush()
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_mutex);
+	m_out.clear();
+}
+
+int Simulator::countAvail(double t)
+{
+	int avail = 0;
+	OutChunkList::const_iterator it, end = m_out.end();
+	for (it = m_out.begin(); (it != end) && (it->t0 < t); ++it) {
+		int n = int((t - it->t0) / m_byte_time);
+		avail += min(n, int(it->data.size()));
+	}
+	return avail;
+}
+
+void Simulator::getNbAvailBytes(int& avail)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_mutex);
+	avail = countAvail(now());
+	DEB_RETURN() << DEB_VAR1(avail);
+}
+
+bool Simulator::isReconfiguring(double t)
+{
+	return (t < m_reconfig_end);
+}
+
+bool Simulator::isRegReadOnly(Reg reg)
+{
+	const Reg *end = C_LIST_END(ReadOnlyRegCList);
+	return (find(ReadOnlyRegCList, end, reg) != end);
+}
+
+int Simulator::getRegVal(Reg reg, double t)
+{
+	updateAcq(t);
+
+	switch (reg) {
+	case StatusSeqA:
+		return getSeqStatus(t);
+	case StatusAMTA:
+		return getSPBStatusA(t);
+	case StatusAMTE:
+		return getSPBStatusE(t);
+	case StatusAMTC:
+		return (m_img_count >>  0) & MaxRegVal;
+	case StatusAMTD:
+		return (m_img_count >> 16) & MaxRegVal;
+	default:
+		RegValMap::const_iterator it = m_reg_val.find(reg);
+		return (it != m_reg_val.end()) ? it->second : 0;
+	}
+}
+
+double Simulator::getTimeUnit()
+{
+	bool us = (m_reg_val[TimeUnit] == Microseconds);
+	return TimeUnitFactorMap[us ? Microseconds : Milliseconds];
+}
+
+void Simulator::calcReadoutGeom(ReadoutGeom& geom)
+{
+	DEB_MEMBER_FUNCT();
+
+	int chan_mode = m_reg_val[ChanMode];
+	geom.ftm = (chan_mode >= FTMChanRangeMap[FTM].first);
+	FrameTransferMode ftm_mode = geom.ftm ? FTM : FFM;
+	const InputChanList& chan_list = FTMInputChanListMap[ftm_mode];
+	int idx = chan_mode - FTMChanRangeMap[ftm_mode].first;
+	bool valid_idx = ((idx >= 0) && (idx < int(chan_list.size())));
+	InputChan input_chan = valid_idx ? chan_list[idx] : Chan1234;
+
+	Size ccd_size = ChipMaxFrameDimMap[m_model.getChipType()].getSize();
+	geom.ccd_lines = ccd_size.getHeight();
+	if (geom.ftm && !m_model.has(Model::HamaChip))
+		geom.ccd_lines /= 2;
+	bool two_vchan = ((input_chan & Chan12) && (input_chan & Chan34));
+	bool two_hchan = ((input_chan & Chan13) && (input_chan & Chan24));
+	geom.nb_vchan = two_vchan ? 2 : 1;
+	geom.nb_hchan = two_hchan ? 2 : 1;
+	int chan_lines = geom.ccd_lines / geom.nb_vchan;
+	int chan_pixels = ccd_size.getWidth() / geom.nb_hchan;
+
+	bool roi_kin = m_reg_val[RoiKinetic];
+	bool roi_hw = m_reg_val[RoiEnable];
+	geom.lines = chan_lines;
+	geom.pixels = chan_pixels;
+	if (roi_hw || roi_kin)
+		geom.lines = min(max(m_reg_val[RoiLineWidth], 1), chan_lines);
+	if (roi_hw && m_reg_val[RoiFast])
+		geom.pixels = min(max(m_reg_val[RoiPixelWidth], 1), 
+				  chan_pixels);
+	geom.shift_lines = roi_kin ? geom.lines : chan_lines;
+
+	geom.bin_vert = max(m_reg_val[BinVert], 1);
+	geom.bin_horz = max(m_reg_val[BinHorz], 1);
+	geom.read_lines = (geom.lines + geom.bin_vert - 1) / geom.bin_vert;
+}
+
+void Simulator::calcReadoutTime(double& readout_time, double& xfer_time)
+{
+	DEB_MEMBER_FUNCT();
+
+	ReadoutGeom geom;
+	calcReadoutGeom(geom);
+
+	double pixel_time = SimPixelTime[m_reg_val[ConfigHD] ? 1 : 0];
+	double line_time = (geom.pixels / geom.bin_horz * pixel_time + 
+			    SimLineOverhead);
+
+	readout_time = (geom.read_lines * line_time + 
+			geom.shift_lines * SimLineShiftTime);
+	xfer_time = geom.ftm ? geom.ccd_lines * SimVertShiftTime : 0;
+	DEB_RETURN() << DEB_VAR2(readout_time, xfer_time);
+}
+
+void Simulator::calcImageSize(int& width, int& height)
+{
+	DEB_MEMBER_FUNCT();
+
+	ReadoutGeom geom;
+	calcReadoutGeom(geom);
+
+	width = geom.pixels / geom.bin_horz * geom.nb_hchan;
+	height = geom.read_lines * geom.nb_vchan;
+	DEB_RETURN() << DEB_VAR2(width, height);
+}
+
+void Simulator::calcAcqTiming(AcqTiming& timing)
+{
+	DEB_MEMBER_FUNCT();
+
+	double time_unit = getTimeUnit();
+	timing.exp_time = m_reg_val[ExpTime] * time_unit;
+	bool shut_ena = m_reg_val[ShutEnable];
+	timing.shut_time = shut_ena ? m_reg_val[ShutCloseTime] * time_unit : 0;
+	timing.lat_time = m_reg_val[LatencyTime] * time_unit;
+	calcReadoutTime(timing.readout_time, timing.transfer_time);
+
+	double exp_lat = timing.exp_time + timing.shut_time + timing.lat_time;
+	if (timing.transfer_time > 0)
+		timing.frame_period = (max(exp_lat, timing.readout_time) + 
+				       timing.transfer_time);
+	else
+		timing.frame_period = exp_lat + timing.readout_time;
+	DEB_RETURN() << DEB_VAR1(timing.frame_period);
+}
+
+double Simulator::getFirstFrameEnd()
+{
+	const AcqTiming& at = m_acq_timing;
+	if (at.transfer_time > 0)
+		return at.frame_period + at.readout_time;
+	return at.exp_time + at.shut_time + at.readout_time;
+}
+
+void Simulator::updateAcq(double t)
+{
+	if (!m_acq_running || (t < m_acq_start))
+		return;
+
+	const AcqTiming& at = m_acq_timing;
+	double first_end = getFirstFrameEnd();
+	double dt = t - m_acq_start;
+	unsigned int nb_frames = 0;
+	if (dt >= first_end)
+		nb_frames = (unsigned int) ((dt - first_end) / 
+					    at.frame_period) + 1;
+	bool finished = ((m_acq_nb_frames > 0) && 
+			 (nb_frames >= (unsigned int) m_acq_nb_frames));
+	if (finished)
+		nb_frames = m_acq_nb_frames;
+	m_img_count = nb_frames;
+
+	if (finished) {
+		m_acq_running = false;
+		m_acq_stop = m_acq_start + first_end + 
+			     (nb_frames - 1) * at.frame_period;
+		latchSeqTim();
+	}
+}
+
+int Simulator::getSeqStatus(double t)
+{
+	updateAcq(t);
+	if (!m_acq_running)
+		return Wait;
+	if (t < m_acq_start)
+		return Exposure;
+
+	const AcqTiming& at = m_acq_timing;
+	bool ftm = (at.transfer_time > 0);
+	double dt = t - m_acq_start;
+	int frame = int(dt / at.frame_period);
+	double o = dt - frame * at.frame_period;
+	bool in_seq = ((m_acq_nb_frames == 0) || (frame < m_acq_nb_frames));
+
+	int status = 0;
+	if (!in_seq)
+		status = 0;
+	else if (o < at.exp_time)
+		status = Exposure;
+	else if (o < at.exp_time + at.shut_time)
+		status = Shutter;
+	else if (ftm && (o >= at.frame_period - at.transfer_time))
+		status = Transfer;
+	else if (!ftm && (o < at.exp_time + at.shut_time + at.readout_time))
+		status = Readout;
+	else
+		status = Latency;
+
+	if (ftm && (frame > 0) && (o < at.readout_time))
+		status |= Readout;
+	return status;
+}
+
+int Simulator::getSPBStatusA(double t)
+{
+	bool reconfig = isReconfiguring(t);
+	bool xfer = ((getSeqStatus(t) & Readout) != 0);
+
+	int status;
+	if (m_model.has(Model::SPB8)) {
+		status = SPB8_SAA_TstInitGood;
+		if (reconfig)
+			status &= ~(SPB8_SAA_PLL1Locked | SPB8_SAA_PLL2Locked);
+	} else {
+		status = SPB2_SAA_FifoEmptyMask | SPB2_SAA_TstInitGood;
+		if (reconfig)
+			status &= ~(SPB2_SAA_DcmLocked | SPB2_SAA_EndInitRam);
+		if (xfer) {
+			status &= ~SPB2_SAA_FifoEmptyMask;
+			status |= SPB2_SAA_TstEnvMask;
+		}
+	}
+	return status;
+}
+
+int Simulator::getSPBStatusE(double t)
+{
+	bool xfer = ((getSeqStatus(t) & Readout) != 0);
+	int status = 0x0fff;
+	if (xfer)
+		status = SPB8_SAE_TstEnvMask;
+	return status;
+}
+
+void Simulator::latchSeqTim()
+{
+	DEB_MEMBER_FUNCT();
+
+	const AcqTiming& at = m_acq_timing;
+	double vals[] = {at.readout_time, at.transfer_time, 0, 
+			 at.exp_time, at.frame_period};
+
+	typedef TimingCtrl::SeqTim::RegPairList RegPairList;
+	const RegPairList& l = TimingCtrl::SeqTim::RegList;
+	const double& clock = TimingCtrl::SeqTim::ClockPeriod;
+	RegPairList::const_iterator it, end = l.end();
+	double *v = vals;
+	for (it = l.begin(); it != end; ++it, ++v) {
+		unsigned long ticks = (unsigned long) (*v / clock + 0.5);
+		m_reg_val[it->first] = (ticks >> 16) & MaxRegVal;
+		m_reg_val[it->second] = ticks & MaxRegVal;
+	}
+}
+
+void Simulator::setByteTime(double byte_time)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(byte_time);
+	if (byte_time < 0)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " 
+					     << DEB_VAR1(byte_time);
+	AutoMutex l(m_mutex);
+	m_byte_time = byte_time;
+}
+
+void Simulator::getByteTime(double& byte_time)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_mutex);
+	byte_time = m_byte_time;
+	DEB_RETURN() << DEB_VAR1(byte_time);
+}
+
+void Simulator::setCmdDelay(double cmd_delay)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(cmd_delay);
+	if (cmd_delay < 0)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " 
+					     << DEB_VAR1(cmd_delay);
+	AutoMutex l(m_mutex);
+	m_cmd_delay = cmd_delay;
+}
+
+void Simulator::getCmdDelay(double& cmd_delay)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_mutex);
+	cmd_delay = m_cmd_delay;
+	DEB_RETURN() << DEB_VAR1(cmd_delay);
+}
+
+void Simulator::setReconfigTime(double reconfig_time)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(reconfig_time);
+	if (reconfig_time < 0)
+		THROW_HW_ERROR(InvalidValue) << "Invalid " 
+					     << DEB_VAR1(reconfig_time);
+	AutoMutex l(m_mutex);
+	m_reconfig_time = reconfig_time;
+}
+
+void Simulator::getReconfigTime(double& reconfig_time)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_mutex);
+	reconfig_time = m_reconfig_time;
+	DEB_RETURN() << DEB_VAR1(reconfig_time);
+}
+
+void Simulator::injectError(Reg reg, ErrType err_type, int nb_times)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(reg, err_type, nb_times);
+	AutoMutex l(m_mutex);
+	if ((err_type == ErrNone) || (nb_times <= 0))
+		m_reg_err.erase(reg);
+	else
+		m_reg_err[reg] = ErrCount(err_type, nb_times);
+}
+
+void Simulator::setRegister(Reg reg, int val)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(reg, val);
+	AutoMutex l(m_mutex);
+	m_reg_val[reg] = val;
+}
+
+void Simulator::getRegister(Reg reg, int& val)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_mutex);
+	val = getRegVal(reg, now());
+	DEB_RETURN() << DEB_VAR1(val);
+}
+
+void Simulator::getNbCmds(int& nb_cmds)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_mutex);
+	nb_cmds = m_nb_cmds;
+	DEB_RETURN() << DEB_VAR1(nb_cmds);
+}
+
+void Simulator::getNbBytes(long& nb_written, long& nb_read)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_mutex);
+	nb_written = m_nb_written;
+	nb_read = m_nb_read;
+	DEB_RETURN() << DEB_VAR2(nb_written, nb_read);
+}
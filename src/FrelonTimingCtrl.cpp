@@ -24,6 +24,11 @@
 
 #include "lima/MiscUtils.h"
 
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
 using namespace lima;
 using namespace lima::Frelon;
 using namespace std;
@@ -59,7 +64,7 @@ SeqTimValues TimingCtrl::SeqTim::calcValues(const ValPairList& l)
 
 
 #define ConfigSeqTimVal(c, b, m, r, t)		\
-	{{c, b, m, 0, 0, 0, 0, 0, 0, 0}, {r / 1e6, t / 1e6, 0, 0, 0}}
+	{{c, b, 1, m, 0, 0, 0, 0, 0, 0, 0, 0}, {r / 1e6, t / 1e6, 0, 0, 0}}
 
 typedef TimingCtrl::ConfigTimingMeasureMap::value_type ConfigSeqTimPair;
 static ConfigSeqTimPair InitialTimingMeasureCacheCList[] = {
@@ -73,9 +78,56 @@ static ConfigSeqTimPair InitialTimingMeasureCacheCList[] = {
 	ConfigSeqTimVal(1, 2, 10, 13392, 1369),
 };
 
+// fitted on the initial measurements above (Frelon 2k, 4 channels)
+const double TimingCtrl::LineReadTime[2] = {94.125e-6, 47.0625e-6};
+const double TimingCtrl::LineShiftTime = 2.625e-6;
+const double TimingCtrl::LineXferTime = 1.36e-6;
+const int TimingCtrl::LineReadPixels = 1024;
+const double TimingCtrl::ChanModeDist = 100;
+
+// 99% prediction bound, below 1% of the estimated readout time
+const int TimingCtrl::EstimateMinMeasures = 5;
+const double TimingCtrl::EstimateMaxError = 0.01;
+
+// two-sided 99% Student t quantiles, by degrees of freedom (1-10):
+// the last one is kept (conservative) for more measures
+static const double EstimateTQuantileCList[] = {
+	63.657, 9.925, 5.841, 4.604, 4.032, 3.707, 3.499, 3.355, 3.250, 3.169,
+};
+
+const int TimingCtrl::MeasureFileFormat = 2;
+
+const double TimingCtrl::CalibIdleTime = 1.0;
+const double TimingCtrl::CalibPollTime = 10e-3;
+
+// the TimingCtrl whose calibration runs in the current thread, if any
+static __thread TimingCtrl *CurrCalibTimingCtrl = NULL;
+
+TimingCtrl::CalibThread::CalibThread(TimingCtrl& timing_ctrl)
+	: m_timing_ctrl(timing_ctrl)
+{
+	DEB_CONSTRUCTOR();
+}
+
+TimingCtrl::CalibThread::~CalibThread()
+{
+	DEB_DESTRUCTOR();
+}
+
+void TimingCtrl::CalibThread::threadFunction()
+{
+	DEB_MEMBER_FUNCT();
+	CurrCalibTimingCtrl = &m_timing_ctrl;
+	m_timing_ctrl.calibThreadFunction();
+}
+
 TimingCtrl::TimingCtrl(Camera& cam)
 	: m_cam(cam), m_model(cam.getModel()),
-	  m_timing_measure_cache(C_LIST_ITERS(InitialTimingMeasureCacheCList))
+	  m_timing_measure_cache(C_LIST_ITERS(InitialTimingMeasureCacheCList)),
+	  m_measure_gen(0), m_curr_config_valid(false), 
+	  m_curr_measure_valid(false), m_calib_thread(NULL), 
+	  m_calib_active(false), m_calib_quit(false),
+	  m_calib_measuring(false), m_calib_abort(false)
 {
 	DEB_CONSTRUCTOR();
 }
@@ -83,6 +135,18 @@ TimingCtrl::TimingCtrl(Camera& cam)
 TimingCtrl::~TimingCtrl()
 {
 	DEB_DESTRUCTOR();
+
+	if (!m_calib_thread)
+		return;
+
+	{
+		AutoMutex l(m_calib_cond.mutex());
+		m_calib_quit = true;
+		m_calib_abort = true;
+		m_calib_cond.broadcast();
+	}
+	m_calib_thread->join();
+	delete m_calib_thread;
 }
 
 void TimingCtrl::writeRegister(Reg reg, int val)
@@ -104,12 +168,11 @@ void TimingCtrl::getReadoutTime(double& readout_time)
 {
 	DEB_MEMBER_FUNCT();
 	if (m_model.has(Model::SeqTim)) {
-		if (needSeqTimMeasure()) {
+		SeqTimValues st;
+		if (!getCurrMeasure(st)) {
 			DEB_ERROR() << "Camera needs SeqTim measurement";
 			readout_time = -1;
 		} else {
-			Config config = getConfig();
-			const SeqTimValues& st = m_timing_measure_cache[config];
 			readout_time = st.readout_time;
 		}
 	} else if (m_model.has(Model::TimeCalc)) {
@@ -126,12 +189,11 @@ void TimingCtrl::getTransferTime(double& xfer_time)
 {
 	DEB_MEMBER_FUNCT();
 	if (m_model.has(Model::SeqTim)) {
-		if (needSeqTimMeasure()) {
+		SeqTimValues st;
+		if (!getCurrMeasure(st)) {
 			DEB_ERROR() << "Camera needs SeqTim measurement";
 			xfer_time = -1;
 		} else {
-			Config config = getConfig();
-			const SeqTimValues& st = m_timing_measure_cache[config];
 			xfer_time = st.transfer_time;
 		}
 	} else if (m_model.has(Model::TimeCalc)) {
@@ -153,6 +215,7 @@ void TimingCtrl::getDeadTime(double& dead_time)
 	DEB_RETURN() << DEB_VAR1(dead_time);
 }
 
+// the registers are read again only after a readout config change
 TimingCtrl::Config TimingCtrl::getConfig()
 {
 	DEB_MEMBER_FUNCT();
@@ -160,9 +223,19 @@ TimingCtrl::Config TimingCtrl::getConfig()
 		THROW_HW_ERROR(NotSupported) << "Camera does not have "
 					     << "sequencer timing feature";
 
+	unsigned long cfg_gen = m_cam.getSerialLine().getReadoutCfgGen();
+	{
+		AutoMutex l(m_curr_lock);
+		if (m_curr_config_valid && (cfg_gen == m_curr_cfg_gen)) {
+			DEB_RETURN() << "cached " << DEB_VAR1(m_curr_config);
+			return m_curr_config;
+		}
+	}
+
 	Config config;
 	readRegister(ConfigHD, config.config_hd);
 	readRegister(BinVert, config.bin_vert);
+	readRegister(BinHorz, config.bin_horz);
 	readRegister(ChanMode, config.chan_mode);
 	readRegister(NbLinesXfer, config.nb_lines_xfer);
 	readRegister(RoiEnable, config.roi_enable);
@@ -175,21 +248,80 @@ TimingCtrl::Config TimingCtrl::getConfig()
 		config.roi_line_begin = 0;
 		config.roi_line_width = 0;
 	}
+	if (config.roi_enable && config.roi_fast)
+		readRegister(RoiPixelWidth, config.roi_pixel_width);
+	else
+		config.roi_pixel_width = 0;
 	readRegister(ShutElecSelect, config.shut_elec_select);
+
+	AutoMutex l(m_curr_lock);
+	m_curr_config = config;
+	m_curr_cfg_gen = cfg_gen;
+	m_curr_config_valid = true;
+	m_curr_measure_valid = false;
 	DEB_RETURN() << DEB_VAR1(config);
 	return config;
 }
 
+bool TimingCtrl::getCurrMeasure(SeqTimValues& st)
+{
+	DEB_MEMBER_FUNCT();
+
+	Config config = getConfig();
+	AutoMutex l(m_curr_lock);
+	bool valid = (m_curr_measure_valid && 
+		      (m_curr_measure_gen == m_measure_gen) &&
+		      !(config < m_curr_config) && !(m_curr_config < config));
+	if (!valid) {
+		typedef ConfigTimingMeasureMap::const_iterator It;
+		It it = m_timing_measure_cache.find(config);
+		m_curr_measured = (it != m_timing_measure_cache.end());
+		double error;
+		if (m_curr_measured) {
+			m_curr_measure = it->second;
+		} else if (estimateMeasure(config, m_curr_measure, error)) {
+			// the dead time must not be underestimated
+			DEB_TRACE() << "Using estimate: " << DEB_VAR1(error);
+			m_curr_measure.readout_time += error;
+			if (m_curr_measure.transfer_time > 0)
+				m_curr_measure.transfer_time += error;
+			m_curr_measured = true;
+		}
+		m_curr_measure_gen = m_measure_gen;
+		m_curr_measure_valid = true;
+	}
+	if (m_curr_measured)
+		st = m_curr_measure;
+	DEB_RETURN() << DEB_VAR1(m_curr_measured);
+	return m_curr_measured;
+}
+
+void TimingCtrl::addMeasure(const Config& config, const SeqTimValues& st)
+{
+	AutoMutex l(m_curr_lock);
+	m_timing_measure_cache[config] = st;
+	++m_measure_gen;
+}
+
+bool TimingCtrl::hasMeasure(const Config& config)
+{
+	AutoMutex l(m_curr_lock);
+	return (m_timing_measure_cache.count(config) > 0);
+}
+
+void TimingCtrl::getMeasures(ConfigTimingMeasureMap& measure_map)
+{
+	AutoMutex l(m_curr_lock);
+	measure_map = m_timing_measure_cache;
+}
+
 bool TimingCtrl::needSeqTimMeasure()
 {
 	DEB_MEMBER_FUNCT();
 	bool need_measure;
 	if (m_model.has(Model::SeqTim)) {
-		Config config = getConfig();
-		DEB_TRACE() << DEB_VAR1(config);
-		typedef ConfigTimingMeasureMap::const_iterator It;
-		It it, end = m_timing_measure_cache.end();
-		need_measure = (m_timing_measure_cache.find(config) == end);
+		SeqTimValues st;
+		need_measure = !getCurrMeasure(st);
 	} else {
 		need_measure = false;
 	}
@@ -221,6 +353,16 @@ void TimingCtrl::measureSeqTimValues(SeqTimValues& st, double timeout)
 {
 	DEB_MEMBER_FUNCT();
 	DEB_PARAM() << DEB_VAR1(timeout);
+	yieldCalib();
+	doMeasure(st, timeout, false);
+	DEB_RETURN() << DEB_VAR1(st);
+}
+
+// an abortable measure returns false if the calibration must yield
+bool TimingCtrl::doMeasure(SeqTimValues& st, double timeout, bool abortable)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(timeout, abortable);
 
 	if (timeout == -1)
 		timeout = 5.0;
@@ -238,17 +380,751 @@ void TimingCtrl::measureSeqTimValues(SeqTimValues& st, double timeout)
 	Camera::TempRegVal u = m_cam.getTempRegVal(ShutEnable, 0);
 
 	Camera::AcqSeq acq = m_cam.startAcqSeq();
-	if (!acq.wait(timeout))
+	Timestamp t0 = Timestamp::now();
+	while (abortable) {
+		Status status;
+		m_cam.getStatus(status, false, false, true);
+		if ((status & StatusMask) == Wait)
+			break;
+		if (isCalibAborted()) {
+			DEB_TRACE() << "Measure aborted";
+			return false;
+		}
+		double elapsed = Timestamp::now() - t0;
+		if (elapsed > timeout)
+			THROW_HW_ERROR(Error) << "Camera not ready after "
+					      << timeout << " sec";
+		Sleep(CalibPollTime);
+	}
+	if (!abortable && !acq.wait(timeout))
 		THROW_HW_ERROR(Error) << "Camera not ready after "
 				      << timeout << " sec";
 	// Image xfer to Espia can take up to ~40 ms
 	// Camera will be ready to restore original sequencer config after
-	// reading (10) SeqTim registers, which takes ~110 ms
+	// reading (10) SeqTim registers, one round-trip each (~110 ms)
 	latchSeqTimValues(st);
 
 	DEB_TRACE() << DEB_VAR2(config, st);
-	m_timing_measure_cache[config] = st;
+	addMeasure(config, st);
+	if (!m_measure_file.empty())
+		saveMeasure(config, st);
 	DEB_RETURN() << DEB_VAR1(st);
+	return true;
+}
+
+void TimingCtrl::addCalibRange(const SeqTimCalibRange& range)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(range);
+
+	FrameTransferMode ftm;
+	InputChan input_chan;
+	Geometry& geom = m_cam.getGeometry();
+	geom.calcFTMInputChan(range.chan_mode, ftm, input_chan);
+	if (!geom.isInputChanAvail(ftm, input_chan))
+		THROW_HW_ERROR(InvalidValue) << "Channel mode not available: "
+					     << DEB_VAR1(range.chan_mode);
+
+	bool has_roi = (range.roi_mode != None);
+	int width_first = has_roi ? range.roi_line_width_first : 0;
+	int width_last = has_roi ? range.roi_line_width_last : 0;
+	int width_step = has_roi ? range.roi_line_width_step : 1;
+	if ((range.bin_vert_first < 1) || 
+	    (range.bin_vert_last < range.bin_vert_first) ||
+	    (has_roi && ((width_first < 1) || (width_last < width_first) ||
+			 (width_step < 1))))
+		THROW_HW_ERROR(InvalidValue) << "Invalid " << DEB_VAR1(range);
+
+	// the other sequencer settings are kept
+	Config config = getConfig();
+	config.chan_mode = range.chan_mode;
+	config.roi_enable = has_roi && (range.roi_mode != Kinetic);
+	config.roi_fast = (range.roi_mode == Fast);
+	config.roi_kinetic = (range.roi_mode == Kinetic);
+	config.roi_line_begin = has_roi ? range.roi_line_begin : 0;
+	// a fast ROI keeps the current pixel width, the full channel if none
+	if (!config.roi_fast) {
+		config.roi_pixel_width = 0;
+	} else if (config.roi_pixel_width == 0) {
+		ModelGeom model_geom;
+		calcModelGeom(config, model_geom);
+		config.roi_pixel_width = model_geom.chan_pixels;
+	}
+
+	AutoMutex l(m_calib_cond.mutex());
+	int nb_added = 0;
+	for (int b = range.bin_vert_first; b <= range.bin_vert_last; ++b) {
+		config.bin_vert = b;
+		for (int w = width_first; w <= width_last; w += width_step) {
+			config.roi_line_width = w;
+			if (hasMeasure(config))
+				continue;
+			ConfigList::const_iterator it, end = m_calib_list.end();
+			for (it = m_calib_list.begin(); it != end; ++it)
+				if (!(*it < config) && !(config < *it))
+					break;
+			if (it != end)
+				continue;
+			m_calib_list.push_back(config);
+			++nb_added;
+		}
+	}
+	m_calib_cond.broadcast();
+	DEB_TRACE() << "Added " << nb_added << " configs to calibrate";
+}
+
+void TimingCtrl::startCalib()
+{
+	DEB_MEMBER_FUNCT();
+
+	if (!m_model.has(Model::SeqTim))
+		THROW_HW_ERROR(NotSupported) << "Camera does not have "
+					     << "sequencer timing feature";
+
+	AutoMutex l(m_calib_cond.mutex());
+	m_calib_active = true;
+	m_calib_cond.broadcast();
+	if (!m_calib_thread) {
+		DEB_TRACE() << "Starting calibration thread";
+		m_calib_thread = new CalibThread(*this);
+		m_calib_thread->start();
+	}
+}
+
+void TimingCtrl::stopCalib()
+{
+	DEB_MEMBER_FUNCT();
+
+	AutoMutex l(m_calib_cond.mutex());
+	m_calib_active = false;
+	while (m_calib_measuring) {
+		m_calib_abort = true;
+		m_calib_cond.wait();
+	}
+}
+
+void TimingCtrl::getCalibPending(int& nb_pending)
+{
+	DEB_MEMBER_FUNCT();
+	AutoMutex l(m_calib_cond.mutex());
+	nb_pending = m_calib_list.size();
+	DEB_RETURN() << DEB_VAR1(nb_pending);
+}
+
+// any camera access from another thread pauses the calibration.
+// The measuring calib thread holds the camera lock and then takes the
+// SerialLine lock and waits for status reads: callers holding one of
+// them, or reading the status, must not wait (wait=false) but only
+// signal the calib thread, which aborts at its next poll
+void TimingCtrl::yieldCalib(bool wait)
+{
+	if (!m_calib_thread)
+		return;
+
+	AutoMutex l(m_calib_cond.mutex());
+	if (isCalibThread())
+		return;
+	m_calib_yield_ts = Timestamp::now();
+	if (m_calib_measuring)
+		m_calib_abort = true;
+	while (wait && m_calib_measuring)
+		m_calib_cond.wait();
+}
+
+bool TimingCtrl::isCalibThread()
+{
+	return (CurrCalibTimingCtrl == this);
+}
+
+bool TimingCtrl::isCalibAborted()
+{
+	AutoMutex l(m_calib_cond.mutex());
+	return m_calib_abort;
+}
+
+// the camera lock is taken first: threads holding it never wait for us
+bool TimingCtrl::calibConfig(const Config& config)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(config);
+
+	AutoMutex cam_lock = m_cam.lock();
+	{
+		AutoMutex l(m_calib_cond.mutex());
+		double idle = Timestamp::now() - m_calib_yield_ts;
+		bool yielded = (m_calib_yield_ts.isSet() && 
+				(idle < CalibIdleTime));
+		if (!m_calib_active || m_calib_quit || yielded)
+			return false;
+		if (m_cam.m_started) {
+			DEB_TRACE() << "Camera is running, retrying later";
+			m_calib_yield_ts = Timestamp::now();
+			return false;
+		}
+		m_calib_measuring = true;
+		m_calib_abort = false;
+	}
+
+	bool done;
+	try {
+		done = (hasMeasure(config) || measureCalibConfig(config));
+	} catch (Exception& e) {
+		DEB_WARNING() << "Could not calibrate " << DEB_VAR1(config) 
+			      << ": " << e.getErrMsg();
+		done = true;
+	}
+
+	AutoMutex l(m_calib_cond.mutex());
+	m_calib_measuring = false;
+	m_calib_cond.broadcast();
+	DEB_RETURN() << DEB_VAR1(done);
+	return done;
+}
+
+bool TimingCtrl::measureCalibConfig(const Config& config)
+{
+	DEB_MEMBER_FUNCT();
+
+	typedef Camera::TempRegVal TempRegVal;
+	TempRegVal c = m_cam.getTempRegVal(ConfigHD, config.config_hd);
+	TempRegVal b = m_cam.getTempRegVal(BinVert, config.bin_vert);
+	TempRegVal h = m_cam.getTempRegVal(BinHorz, config.bin_horz);
+	TempRegVal m = m_cam.getTempRegVal(ChanMode, config.chan_mode);
+	TempRegVal x = m_cam.getTempRegVal(NbLinesXfer, config.nb_lines_xfer);
+	TempRegVal e = m_cam.getTempRegVal(RoiEnable, config.roi_enable);
+	TempRegVal f = m_cam.getTempRegVal(RoiFast, config.roi_fast);
+	TempRegVal k = m_cam.getTempRegVal(RoiKinetic, config.roi_kinetic);
+	TempRegVal lb = m_cam.getTempRegVal(RoiLineBegin, 
+					    config.roi_line_begin);
+	TempRegVal lw = m_cam.getTempRegVal(RoiLineWidth, 
+					    config.roi_line_width);
+	int pixel_width = config.roi_pixel_width;
+	if (!config.roi_enable || !config.roi_fast)
+		m_cam.readRegister(RoiPixelWidth, pixel_width);
+	TempRegVal pw = m_cam.getTempRegVal(RoiPixelWidth, pixel_width);
+	TempRegVal s = m_cam.getTempRegVal(ShutElecSelect, 
+					   config.shut_elec_select);
+	if (isCalibAborted())
+		return false;
+
+	SeqTimValues st;
+	return doMeasure(st, -1, true);
+}
+
+void TimingCtrl::calibThreadFunction()
+{
+	DEB_MEMBER_FUNCT();
+
+	AutoMutex l(m_calib_cond.mutex());
+	while (!m_calib_quit) {
+		double wait_time = -1;
+		if (m_calib_active && !m_calib_list.empty()) {
+			wait_time = 0;
+			if (m_calib_yield_ts.isSet()) {
+				double idle = Timestamp::now() - m_calib_yield_ts;
+				wait_time = max(CalibIdleTime - idle, 0.0);
+			}
+		}
+		if (wait_time != 0) {
+			m_calib_cond.wait(wait_time);
+			continue;
+		}
+
+		Config config = m_calib_list.front();
+		bool done;
+		{
+			AutoMutexUnlock u(l);
+			done = calibConfig(config);
+		}
+		if (done)
+			m_calib_list.erase(m_calib_list.begin());
+	}
+
+	DEB_TRACE() << "Calibration thread finished";
+}
+
+void TimingCtrl::calcModelGeom(const Config& config, ModelGeom& geom)
+{
+	DEB_MEMBER_FUNCT();
+
+	FrameTransferMode ftm;
+	InputChan input_chan;
+	m_cam.getGeometry().calcFTMInputChan(config.chan_mode, ftm, 
+					     input_chan);
+
+	Size ccd_size = ChipMaxFrameDimMap[m_model.getChipType()].getSize();
+	geom.ftm = (ftm == FTM);
+	geom.ccd_lines = ccd_size.getHeight();
+	if (geom.ftm && !m_model.has(Model::HamaChip))
+		geom.ccd_lines /= 2;
+	bool two_vchan = ((input_chan & Chan12) && (input_chan & Chan34));
+	bool two_hchan = ((input_chan & Chan13) && (input_chan & Chan24));
+	geom.nb_vchan = two_vchan ? 2 : 1;
+	geom.chan_lines = geom.ccd_lines / geom.nb_vchan;
+	geom.chan_pixels = ccd_size.getWidth() / (two_hchan ? 2 : 1);
+
+	int lines = geom.chan_lines;
+	if (config.roi_enable || config.roi_kinetic)
+		lines = min(max(config.roi_line_width, 1), geom.chan_lines);
+	geom.shift_lines = config.roi_kinetic ? lines : geom.chan_lines;
+	int bin_vert = max(config.bin_vert, 1);
+	geom.read_lines = (lines + bin_vert - 1) / bin_vert;
+
+	// fast ROI skips the pixels outside, horz. binning sums them
+	int pixels = geom.chan_pixels;
+	if (config.roi_enable && config.roi_fast)
+		pixels = min(max(config.roi_pixel_width, 1), geom.chan_pixels);
+	int bin_horz = max(config.bin_horz, 1);
+	geom.read_pixels = (pixels + bin_horz - 1) / bin_horz;
+	DEB_RETURN() << DEB_VAR4(geom.ftm, geom.read_lines, geom.shift_lines,
+				 geom.read_pixels);
+}
+
+void TimingCtrl::calcModelTime(const Config& config, double& readout_time,
+			       double& xfer_time)
+{
+	DEB_MEMBER_FUNCT();
+
+	ModelGeom geom;
+	calcModelGeom(config, geom);
+	double line_time = (LineReadTime[config.config_hd ? 1 : 0] * 
+			    geom.read_pixels / LineReadPixels);
+	readout_time = (geom.read_lines * line_time + 
+			geom.shift_lines * LineShiftTime);
+	xfer_time = geom.ftm ? geom.ccd_lines * LineXferTime : 0;
+	DEB_RETURN() << DEB_VAR2(readout_time, xfer_time);
+}
+
+// configs only differing in their ROI lines and vertical binning
+bool TimingCtrl::isSameFamily(const Config& a, const Config& b)
+{
+	return ((a.config_hd == b.config_hd) && (a.bin_horz == b.bin_horz) &&
+		(a.chan_mode == b.chan_mode) &&
+		(a.roi_pixel_width == b.roi_pixel_width) &&
+		(a.nb_lines_xfer == b.nb_lines_xfer) &&
+		(a.roi_enable == b.roi_enable) && (a.roi_fast == b.roi_fast) &&
+		(a.roi_kinetic == b.roi_kinetic) &&
+		(a.shut_elec_select == b.shut_elec_select));
+}
+
+// linear fit of the family measured readout times on the model ones;
+// confident only inside the measured range and with a narrow bound
+bool TimingCtrl::estimateMeasure(const Config& config, SeqTimValues& st,
+				 double& error)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(config);
+
+	double model_readout, model_xfer;
+	calcModelTime(config, model_readout, model_xfer);
+
+	vector<double> x, y, xfer;
+	{
+		AutoMutex l(m_curr_lock);
+		typedef ConfigTimingMeasureMap::const_iterator It;
+		It it, end = m_timing_measure_cache.end();
+		for (it = m_timing_measure_cache.begin(); it != end; ++it) {
+			const SeqTimValues& ref_st = it->second;
+			if (!isSameFamily(it->first, config) || 
+			    (ref_st.readout_time <= 0))
+				continue;
+			double ref_readout, ref_xfer;
+			calcModelTime(it->first, ref_readout, ref_xfer);
+			x.push_back(ref_readout);
+			y.push_back(ref_st.readout_time);
+			xfer.push_back(ref_st.transfer_time);
+		}
+	}
+
+	int n = x.size();
+	error = -1;
+	if (n < EstimateMinMeasures) {
+		DEB_RETURN() << "not enough measures: " << DEB_VAR1(n);
+		return false;
+	}
+
+	double x_mean = 0, y_mean = 0, xfer_mean = 0;
+	double x_min = x[0], x_max = x[0];
+	for (int i = 0; i < n; ++i) {
+		x_mean += x[i] / n;
+		y_mean += y[i] / n;
+		xfer_mean += xfer[i] / n;
+		x_min = min(x_min, x[i]);
+		x_max = max(x_max, x[i]);
+	}
+	double sxx = 0, sxy = 0;
+	for (int i = 0; i < n; ++i) {
+		sxx += (x[i] - x_mean) * (x[i] - x_mean);
+		sxy += (x[i] - x_mean) * (y[i] - y_mean);
+	}
+	if (sxx <= 0) {
+		DEB_RETURN() << "measures with the same model time";
+		return false;
+	}
+
+	double slope = sxy / sxx;
+	double offset = y_mean - slope * x_mean;
+	double ssr = 0, xfer_err = 0;
+	for (int i = 0; i < n; ++i) {
+		double res = y[i] - (offset + slope * x[i]);
+		ssr += res * res;
+		xfer_err = max(xfer_err, fabs(xfer[i] - xfer_mean));
+	}
+	// the measures are not resolved below the sequencer clock
+	int dof = n - 2;
+	double res_std = max(sqrt(ssr / dof), SeqTim::ClockPeriod);
+	int nb_quantiles = C_LIST_SIZE(EstimateTQuantileCList);
+	double t = EstimateTQuantileCList[min(dof, nb_quantiles) - 1];
+	double dx = model_readout - x_mean;
+	double readout_err = t * res_std * sqrt(1 + 1.0 / n + dx * dx / sxx);
+
+	st.readout_time = offset + slope * model_readout;
+	st.transfer_time = xfer_mean;
+	st.electronic_shutter_time = 0;
+	st.exposure_time = 0;
+	st.frame_period = 0;
+	error = max(readout_err, xfer_err);
+
+	bool inside = ((model_readout >= x_min) && (model_readout <= x_max));
+	bool confident = (inside && (st.readout_time > 0) && 
+			  (error <= EstimateMaxError * st.readout_time));
+	DEB_RETURN() << DEB_VAR4(confident, st.readout_time, error, n);
+	return confident;
+}
+
+// scale the model with the closest measured config of the same kind
+bool TimingCtrl::calibrateModel(const Config& config, double& readout_factor,
+				double& xfer_factor)
+{
+	DEB_MEMBER_FUNCT();
+
+	ModelGeom geom;
+	calcModelGeom(config, geom);
+	double readout_time, xfer_time;
+	calcModelTime(config, readout_time, xfer_time);
+
+	bool found = false;
+	double best_dist = 0;
+	AutoMutex l(m_curr_lock);
+	typedef ConfigTimingMeasureMap::const_iterator It;
+	It it, end = m_timing_measure_cache.end();
+	for (it = m_timing_measure_cache.begin(); it != end; ++it) {
+		const Config& ref = it->first;
+		const SeqTimValues& st = it->second;
+		if ((ref.config_hd != config.config_hd) || 
+		    (st.readout_time <= 0))
+			continue;
+		ModelGeom ref_geom;
+		calcModelGeom(ref, ref_geom);
+		if (ref_geom.ftm != geom.ftm)
+			continue;
+		double ref_readout, ref_xfer;
+		calcModelTime(ref, ref_readout, ref_xfer);
+		// the same channel mode first, then the closest readout
+		double dist = fabs(log(ref_readout / readout_time));
+		if (ref.chan_mode != config.chan_mode)
+			dist += ChanModeDist;
+		if (found && (dist >= best_dist))
+			continue;
+		found = true;
+		best_dist = dist;
+		readout_factor = st.readout_time / ref_readout;
+		bool xfer_ok = ((ref_xfer > 0) && (st.transfer_time > 0));
+		xfer_factor = xfer_ok ? st.transfer_time / ref_xfer : 1;
+	}
+	if (!found)
+		readout_factor = xfer_factor = 1;
+	DEB_RETURN() << DEB_VAR3(found, readout_factor, xfer_factor);
+	return found;
+}
+
+void TimingCtrl::calcFramePeriod(double exp_time, double lat_time,
+				 FrameTiming& ft)
+{
+	double min_period;
+	if (ft.transfer_time > 0) {
+		ft.dead_time = ft.transfer_time;
+		ft.frame_period = (max(exp_time + lat_time, ft.readout_time) + 
+				   ft.transfer_time);
+		min_period = max(exp_time, ft.readout_time) + ft.transfer_time;
+	} else {
+		ft.dead_time = ft.readout_time;
+		ft.frame_period = exp_time + lat_time + ft.readout_time;
+		min_period = exp_time + ft.readout_time;
+	}
+	ft.max_frame_rate = (min_period > 0) ? 1 / min_period : 0;
+}
+
+TimingCtrl::Config TimingCtrl::calcConfig(int chan_mode, const Bin& bin,
+					  const Roi& chan_roi, 
+					  RoiMode roi_mode)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR4(chan_mode, bin, chan_roi, roi_mode);
+
+	Config config = {0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	if (m_model.has(Model::SeqTim))
+		config = getConfig();
+	config.chan_mode = chan_mode;
+	config.bin_vert = bin.getY();
+	config.bin_horz = bin.getX();
+
+	bool has_roi = ((roi_mode != None) && !chan_roi.isEmpty());
+	config.roi_enable = has_roi && (roi_mode != Kinetic);
+	config.roi_fast = has_roi && (roi_mode == Fast);
+	config.roi_kinetic = has_roi && (roi_mode == Kinetic);
+	// as written by Geometry::writeChanRoi
+	config.roi_line_begin = has_roi ? chan_roi.getTopLeft().y : 0;
+	config.roi_line_width = has_roi ? chan_roi.getSize().getHeight() : 0;
+	bool pixel_roi = has_roi && (roi_mode == Fast);
+	config.roi_pixel_width = pixel_roi ? chan_roi.getSize().getWidth() : 0;
+	DEB_RETURN() << DEB_VAR1(config);
+	return config;
+}
+
+void TimingCtrl::calcFrameTiming(const Config& config, double exp_time,
+				 double lat_time, FrameTiming& ft)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR3(config, exp_time, lat_time);
+
+	AutoMutex l(m_curr_lock);
+	typedef ConfigTimingMeasureMap::const_iterator It;
+	It it = m_timing_measure_cache.find(config);
+	ft.predicted = (it == m_timing_measure_cache.end());
+	SeqTimValues st;
+	if (!ft.predicted) {
+		ft.readout_time = it->second.readout_time;
+		ft.transfer_time = it->second.transfer_time;
+		ft.error = 0;
+	} else if (estimateMeasure(config, st, ft.error)) {
+		ft.readout_time = st.readout_time;
+		ft.transfer_time = st.transfer_time;
+	} else {
+		double readout_factor, xfer_factor;
+		calibrateModel(config, readout_factor, xfer_factor);
+		calcModelTime(config, ft.readout_time, ft.transfer_time);
+		ft.readout_time *= readout_factor;
+		ft.transfer_time *= xfer_factor;
+		ft.error = -1;
+	}
+	calcFramePeriod(exp_time, lat_time, ft);
+	DEB_RETURN() << DEB_VAR1(ft);
+}
+
+void TimingCtrl::getFrameTiming(double exp_time, double lat_time,
+				FrameTiming& ft)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(exp_time, lat_time);
+
+	if (m_model.has(Model::SeqTim)) {
+		calcFrameTiming(getConfig(), exp_time, lat_time, ft);
+		return;
+	}
+
+	getReadoutTime(ft.readout_time);
+	getTransferTime(ft.transfer_time);
+	ft.predicted = false;
+	ft.error = 0;
+	calcFramePeriod(exp_time, lat_time, ft);
+	DEB_RETURN() << DEB_VAR1(ft);
+}
+
+void TimingCtrl::setMeasureFile(const string& measure_file)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(measure_file);
+
+	m_measure_file = measure_file;
+	if (m_measure_file.empty())
+		return;
+
+	// measurements done on this camera supersede the initial table
+	ConfigTimingMeasureMap measure_map;
+	if (!readMeasureFile(m_measure_file, measure_map))
+		return;
+	typedef ConfigTimingMeasureMap::const_iterator It;
+	It it, end = measure_map.end();
+	for (it = measure_map.begin(); it != end; ++it)
+		addMeasure(it->first, it->second);
+	DEB_TRACE() << "Loaded " << measure_map.size() << " SeqTim measures";
+}
+
+void TimingCtrl::getMeasureFile(string& measure_file)
+{
+	DEB_MEMBER_FUNCT();
+	measure_file = m_measure_file;
+	DEB_RETURN() << DEB_VAR1(measure_file);
+}
+
+void TimingCtrl::exportMeasures(const string& fname)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(fname);
+	ConfigTimingMeasureMap measure_map;
+	getMeasures(measure_map);
+	writeMeasureFile(fname, measure_map);
+}
+
+void TimingCtrl::importMeasures(const string& fname)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(fname);
+
+	ConfigTimingMeasureMap measure_map;
+	if (!readMeasureFile(fname, measure_map))
+		THROW_HW_ERROR(InvalidValue) << "No SeqTim measures for this "
+					     << "camera in " << DEB_VAR1(fname);
+
+	typedef ConfigTimingMeasureMap::const_iterator It;
+	It it, end = measure_map.end();
+	for (it = measure_map.begin(); it != end; ++it)
+		addMeasure(it->first, it->second);
+
+	if (!m_measure_file.empty()) {
+		AutoMutex l(m_measure_file_lock);
+		ConfigTimingMeasureMap file_map;
+		readMeasureFile(m_measure_file, file_map);
+		for (it = measure_map.begin(); it != end; ++it)
+			file_map[it->first] = it->second;
+		writeMeasureFile(m_measure_file, file_map);
+	}
+	DEB_TRACE() << "Imported " << measure_map.size() << " SeqTim measures";
+}
+
+bool TimingCtrl::readMeasureFile(const string& fname, 
+				 ConfigTimingMeasureMap& measure_map)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR1(fname);
+
+	measure_map.clear();
+	ifstream is(fname.c_str());
+	if (!is) {
+		DEB_TRACE() << "No SeqTim measure file";
+		return false;
+	}
+
+	string ver;
+	m_model.getFirmware().getVersionStr(ver);
+	int complex_ser_nb;
+	m_model.getComplexSerialNb(complex_ser_nb);
+
+	int file_format = 0, file_ser_nb = 0;
+	string file_ver;
+	string line;
+	while (getline(is, line)) {
+		if (line.empty() || (line[0] == '#'))
+			continue;
+		istringstream line_is(line);
+		string key;
+		line_is >> key;
+		if (key == "Format") {
+			line_is >> file_format;
+		} else if (key == RegStrMap[Version]) {
+			line_is >> file_ver;
+		} else if (key == RegStrMap[CompSerNb]) {
+			line_is >> file_ser_nb;
+		} else {
+			Config c;
+			SeqTimValues st;
+			line_is.clear();
+			line_is.str(line);
+			line_is >> c.config_hd >> c.bin_vert >> c.bin_horz
+				>> c.chan_mode >> c.nb_lines_xfer 
+				>> c.roi_enable >> c.roi_fast >> c.roi_kinetic
+				>> c.roi_line_begin >> c.roi_line_width
+				>> c.roi_pixel_width >> c.shut_elec_select
+				>> st.readout_time >> st.transfer_time
+				>> st.electronic_shutter_time
+				>> st.exposure_time >> st.frame_period;
+			if (!line_is) {
+				DEB_WARNING() << "Invalid SeqTim measure line: "
+					      << DEB_VAR1(line);
+				measure_map.clear();
+				return false;
+			}
+			measure_map[c] = st;
+			continue;
+		}
+		if (!line_is) {
+			DEB_WARNING() << "Invalid SeqTim measure line: "
+				      << DEB_VAR1(line);
+			measure_map.clear();
+			return false;
+		}
+	}
+
+	if ((file_format != MeasureFileFormat) || (file_ver != ver) || 
+	    (file_ser_nb != complex_ser_nb)) {
+		DEB_TRACE() << "SeqTim measures from another camera/format: "
+			    << DEB_VAR3(file_format, file_ver, file_ser_nb);
+		measure_map.clear();
+		return false;
+	}
+	return true;
+}
+
+void TimingCtrl::writeMeasureFile(const string& fname, 
+				  const ConfigTimingMeasureMap& measure_map)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(fname, measure_map.size());
+
+	string ver;
+	m_model.getFirmware().getVersionStr(ver);
+	int complex_ser_nb;
+	m_model.getComplexSerialNb(complex_ser_nb);
+
+	// written aside and renamed, so readers never see half a file
+	string tmp_file = fname + ".tmp";
+	ofstream os(tmp_file.c_str());
+	os.precision(15);
+	os << "# Frelon SeqTim measures" << endl
+	   << "Format " << MeasureFileFormat << endl
+	   << RegStrMap[Version] << " " << ver << endl
+	   << RegStrMap[CompSerNb] << " " << complex_ser_nb << endl
+	   << "# config_hd bin_vert bin_horz chan_mode nb_lines_xfer "
+	   << "roi_enable roi_fast roi_kinetic roi_line_begin roi_line_width "
+	   << "roi_pixel_width shut_elec_select: readout transfer eshut exposure "
+	   << "frame_period [s]" << endl;
+	typedef ConfigTimingMeasureMap::const_iterator It;
+	It it, end = measure_map.end();
+	for (it = measure_map.begin(); it != end; ++it) {
+		const Config& c = it->first;
+		const SeqTimValues& st = it->second;
+		os << c.config_hd << " " << c.bin_vert << " " 
+		   << c.bin_horz << " " << c.chan_mode << " " 
+		   << c.nb_lines_xfer << " " << c.roi_enable << " " 
+		   << c.roi_fast << " " << c.roi_kinetic << " " 
+		   << c.roi_line_begin << " " << c.roi_line_width << " " 
+		   << c.roi_pixel_width << " " << c.shut_elec_select << " "
+		   << st.readout_time << " " << st.transfer_time << " "
+		   << st.electronic_shutter_time << " " 
+		   << st.exposure_time << " " << st.frame_period << endl;
+	}
+	os.close();
+	if (!os || (rename(tmp_file.c_str(), fname.c_str()) != 0))
+		THROW_HW_ERROR(Error) << "Error writing " << DEB_VAR1(fname);
+}
+
+// merged with the file contents, which other sessions may have updated
+void TimingCtrl::saveMeasure(const Config& config, const SeqTimValues& st)
+{
+	DEB_MEMBER_FUNCT();
+	DEB_PARAM() << DEB_VAR2(config, st);
+
+	AutoMutex l(m_measure_file_lock);
+	try {
+		ConfigTimingMeasureMap measure_map;
+		readMeasureFile(m_measure_file, measure_map);
+		measure_map[config] = st;
+		writeMeasureFile(m_measure_file, measure_map);
+	} catch (Exception e) {
+		DEB_WARNING() << "Could not save SeqTim measure: "
+			      << e.getErrMsg();
+	}
 }
 
 std::ostream& lima::Frelon::operator <<(std::ostream& os,
@@ -257,6 +1133,7 @@ std::ostream& lima::Frelon::operator <<(std::ostream& os,
 	return os << '<'
 		  << config.config_hd << ", "
 		  << config.bin_vert << ", "
+		  << config.bin_horz << ", "
 		  << config.chan_mode << ", "
 		  << config.nb_lines_xfer << ", "
 		  << config.roi_enable << ", "
@@ -264,6 +1141,7 @@ std::ostream& lima::Frelon::operator <<(std::ostream& os,
 		  << config.roi_kinetic << ", "
 		  << config.roi_line_begin << ", "
 		  << config.roi_line_width << ", "
+		  << config.roi_pixel_width << ", "
 		  << config.shut_elec_select << '>';
 }
 
@@ -282,6 +1160,7 @@ bool lima::Frelon::operator <(const TimingCtrl::Config& a,
 
 	check(config_hd);
 	check(bin_vert);
+	check(bin_horz);
 	check(chan_mode);
 	check(nb_lines_xfer);
 	check(roi_enable);
@@ -289,6 +1168,7 @@ bool lima::Frelon::operator <(const TimingCtrl::Config& a,
 	check(roi_kinetic);
 	check(roi_line_begin);
 	check(roi_line_width);
+	check(roi_pixel_width);
 	check(shut_elec_select);
 
 #undef check
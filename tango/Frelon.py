@@ -124,6 +124,11 @@ class Frelon(PyTango.Device_4Impl):
         edev.resetLink()
         time.sleep(self.ResetLinkWaitTime)
 
+    @Core.DEB_MEMBER_FUNCT
+    def resetSerialLineStats(self) :
+        cam = _FrelonAcq.getFrelonCamera()
+        cam.getSerialLine().resetStats()
+
     @Core.DEB_MEMBER_FUNCT
     def latchSeqTimValues(self) :
         cam = _FrelonAcq.getFrelonCamera()
@@ -197,6 +202,38 @@ class Frelon(PyTango.Device_4Impl):
         reset_trace_log = ser_line.getResetTraceLog()
         attr.set_value(reset_trace_log)
 
+    ## @brief one line per register/command used since the last reset
+    #
+    def read_serial_line_stats(self,attr):
+        cam = _FrelonAcq.getFrelonCamera()
+        ser_line = cam.getSerialLine()
+        stats_list = []
+        for name_map, enum_type, get_stats in \
+                [(FrelonHw.Global.RegStrMap(), FrelonHw.Reg,
+                  ser_line.getRegStats),
+                 (FrelonHw.Global.CmdStrMap(), FrelonHw.Cmd,
+                  ser_line.getCmdStats),
+                 (FrelonHw.Global.MultiLineCmdStrMap(), FrelonHw.MultiLineCmd,
+                  ser_line.getMultiLineCmdStats)]:
+            for val, name in sorted(name_map.items()):
+                stats = get_stats(enum_type(val))
+                if stats.nb_calls == 0:
+                    continue
+                hist = ','.join(map(str, stats.getAckDelayHist()))
+                stats_list.append('%s: calls=%d cache_hits=%d '
+                                  'cache_misses=%d bytes_written=%d '
+                                  'bytes_read=%d ack_delay_total=%.6f '
+                                  'ack_delay_hist=%s sleep_time=%.6f '
+                                  'busy_retries=%d fail_retries=%d' %
+                                  (name, stats.nb_calls, stats.nb_cache_hits,
+                                   stats.nb_cache_misses,
+                                   stats.nb_bytes_written,
+                                   stats.nb_bytes_read,
+                                   stats.ack_delay_total, hist,
+                                   stats.sleep_time, stats.nb_busy_retries,
+                                   stats.nb_fail_retries))
+        attr.set_value(stats_list)
+
     def read_readout_time(self,attr):
         cam = _FrelonAcq.getFrelonCamera()
         if cam.needSeqTimMeasure():
@@ -231,6 +268,9 @@ class FrelonClass(PyTango.DeviceClass):
         'espia_drv_debug_level':
         [PyTango.DevLong,
          "Espia driver debug level",[-1]],
+        'status_max_age':
+        [PyTango.DevDouble,
+         "Max. age [s] of the cached camera status",[0.1]],
         }
 
     cmd_list = {
@@ -241,6 +281,9 @@ class FrelonClass(PyTango.DeviceClass):
         [[PyTango.DevString,"command"],
          [PyTango.DevString,"return command"]],
         'resetLink':
+        [[PyTango.DevVoid,""],
+         [PyTango.DevVoid,""]],
+        'resetSerialLineStats':
         [[PyTango.DevVoid,""],
          [PyTango.DevVoid,""]],
         'latchSeqTimValues':
@@ -314,6 +357,10 @@ class FrelonClass(PyTango.DeviceClass):
         [[PyTango.DevBoolean,
           PyTango.SCALAR,
           PyTango.READ_WRITE]],
+        'status_max_age' :
+        [[PyTango.DevDouble,
+          PyTango.SCALAR,
+          PyTango.READ_WRITE]],
         'image_count' :
         [[PyTango.DevLong,
           PyTango.SCALAR,
@@ -327,6 +374,10 @@ class FrelonClass(PyTango.DeviceClass):
           PyTango.SCALAR,
           PyTango.READ]],
         'reset_trace_log' :
+        [[PyTango.DevString,
+          PyTango.SPECTRUM,
+          PyTango.READ, 65535]],
+        'serial_line_stats' :
         [[PyTango.DevString,
           PyTango.SPECTRUM,
           PyTango.READ, 65535]],
@@ -548,12 +599,14 @@ _FrelonAcq = None
 
 def get_control(espia_dev_nb = 0, espia_dev_nb2 = EspiaDevNbInvalid,
                 espia_lib_debug_level = -1, espia_drv_debug_level = -1,
-                **keys) :
+                status_max_age = 0.1, **keys) :
     global _FrelonAcq
     if _FrelonAcq is None:
        _FrelonAcq = FrelonHw.FrelonAcq(int(espia_dev_nb), int(espia_dev_nb2),
                                        int(espia_lib_debug_level),
                                        int(espia_drv_debug_level))
+       cam = _FrelonAcq.getFrelonCamera()
+       cam.setStatusMaxAge(float(status_max_age))
     return _FrelonAcq.getGlobalControl() 
 
 def get_tango_specific_class_n_device():
@@ -0,0 +1,254 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include "FrelonSerialLine.h"
+#include "FrelonSimulator.h"
+#include "lima/RegExUtils.h"
+#include "lima/MiscUtils.h"
+
+#include <iostream>
+#include <stdlib.h>
+
+using namespace lima;
+using namespace std;
+
+DEB_GLOBAL(DebModTest);
+
+typedef Frelon::SerialLine::MsgPartStrMapType MsgPartStrMapType;
+
+
+// Reference RegEx-based implementation, used before the hand-written parser
+bool regex_split_msg(const string& msg, MsgPartStrMapType& msg_parts)
+{
+	const static RegEx re("^(?P<sync>>)?"
+			      "(?P<cmd>[A-Za-z]+)"
+			      "((?P<req>\\?)|"
+			      "(?P<val>(?P<sign>-?)[0-9]+"
+			      "(\\.(?P<dec>[0-9]+))?))?"
+			      "(?P<term>[\r\n]+)?$");
+
+	msg_parts.clear();
+	RegEx::FullNameMatchType match;
+	if (!re.matchName(msg, match))
+		return false;
+
+	typedef pair<Frelon::SerialLine::MsgPart, string> KeyPair;
+	static const KeyPair key_list[] = {
+		KeyPair(Frelon::SerialLine::MsgSync, "sync"),
+		KeyPair(Frelon::SerialLine::MsgCmd,  "cmd"),
+		KeyPair(Frelon::SerialLine::MsgVal,  "val"),
+		KeyPair(Frelon::SerialLine::MsgDec,  "dec"),
+		KeyPair(Frelon::SerialLine::MsgReq,  "req"),
+		KeyPair(Frelon::SerialLine::MsgTerm, "term"),
+		KeyPair(Frelon::SerialLine::MsgSign, "sign"),
+	};
+	const KeyPair *it, *end = C_LIST_END(key_list);
+	for (it = key_list; it != end; ++it)
+		msg_parts[it->first] = match[it->second];
+	return true;
+}
+
+bool regex_decode_resp(const string& ans, string& fmt_resp)
+{
+	const static RegEx re("!(OK(:(?P<resp>[^\r]+))?|"
+			        "W\a?:(?P<warn>[^\r]+)|"
+			        "E\a?:(?P<err>[^\r]+))\r\n");
+
+	fmt_resp.clear();
+	RegEx::FullNameMatchType match;
+	if (!re.matchName(ans, match) || match["err"].found())
+		return false;
+	fmt_resp = match["resp"];
+	return true;
+}
+
+const char *msg_list[] = {
+	">I?\r\n", "I?", ">I100\r\n", "I100", ">I1.5\r\n", "U-32\r\n",
+	">S\r\n", ">H", ">IMC?\r\n", ">RLW2048\r\n",
+	"", ">", "?", "I-", "I1.", "I1.5.3", "I?1", ">I 100", "1I",
+};
+
+const char *ans_list[] = {
+	"!OK\r\n", "!OK:100\r\n", "!OK:3.1c\r\n", "!W:1\r\n", "!W\a:12\r\n",
+	"!E:BSY\r\n", "!E\a:FAI\r\n", "garbage!OK:5\r\n", "!OK:\r\n",
+	"!OK:5", "!X\r\n", "", "!E\r\n",
+};
+
+bool new_split_msg(Frelon::SerialLine& ser_line, const string& msg,
+		   MsgPartStrMapType& msg_parts)
+{
+	try {
+		ser_line.splitMsg(msg, msg_parts);
+		return true;
+	} catch (Exception e) {
+		msg_parts.clear();
+		return false;
+	}
+}
+
+bool new_decode_resp(Frelon::SerialLine& ser_line, const string& ans,
+		     string& fmt_resp)
+{
+	try {
+		ser_line.decodeFmtResp(ans, fmt_resp);
+		return true;
+	} catch (Exception e) {
+		fmt_resp.clear();
+		return false;
+	}
+}
+
+void check_parsers(Frelon::SerialLine& ser_line)
+{
+	DEB_GLOBAL_FUNCT();
+
+	const char **it, **end = C_LIST_END(msg_list);
+	for (it = msg_list; it != end; ++it) {
+		MsgPartStrMapType ref_parts, new_parts;
+		bool ref_ok = regex_split_msg(*it, ref_parts);
+		bool new_ok = new_split_msg(ser_line, *it, new_parts);
+		if ((ref_ok != new_ok) || (ref_parts != new_parts))
+			THROW_HW_ERROR(Error) << "splitMsg mismatch: "
+					      << DEB_VAR3(*it, ref_ok, new_ok);
+	}
+
+	end = C_LIST_END(ans_list);
+	for (it = ans_list; it != end; ++it) {
+		string ref_resp, new_resp;
+		bool ref_ok = regex_decode_resp(*it, ref_resp);
+		bool new_ok = new_decode_resp(ser_line, *it, new_resp);
+		// warnings are reported through getLastWarning
+		ser_line.getLastWarning();
+		if ((ref_ok != new_ok) || (ref_resp != new_resp))
+			THROW_HW_ERROR(Error) << "decodeFmtResp mismatch: "
+					      << DEB_VAR3(*it, ref_ok, new_ok);
+	}
+
+	cout << "Parsers agree on " << C_LIST_SIZE(msg_list) << " messages "
+	     << "and " << C_LIST_SIZE(ans_list) << " answers" << endl;
+}
+
+void check_reg_lookup()
+{
+	DEB_GLOBAL_FUNCT();
+
+	const Frelon::RegStrMapType& reg_map = Frelon::RegStrMap;
+	Frelon::RegStrMapType::const_iterator it, end = reg_map.end();
+	for (it = reg_map.begin(); it != end; ++it) {
+		Frelon::Reg reg;
+		if (!Frelon::FindRegByStr(it->second, reg) || 
+		    (reg != it->first))
+			THROW_HW_ERROR(Error) << "FindRegByStr mismatch: "
+					      << DEB_VAR1(it->second);
+	}
+
+	Frelon::Reg reg;
+	if (Frelon::FindRegByStr("XYZ", reg) || 
+	    Frelon::FindRegByStr("SETAB", reg))
+		THROW_HW_ERROR(Error) << "FindRegByStr found invalid mnemonic";
+
+	cout << "FindRegByStr agrees on " << Frelon::RegStrMap.size() 
+	     << " registers" << endl;
+}
+
+void print_rate(const string& desc, int nb_msgs, Timestamp t0)
+{
+	double elapsed = Timestamp::now() - t0;
+	cout << desc << ": " << int(nb_msgs / elapsed) << " msg/s" << endl;
+}
+
+void bench_parsers(Frelon::SerialLine& ser_line, int nb_loops)
+{
+	const string msg = ">I100\r\n";
+	const string ans = "!OK:100\r\n";
+	MsgPartStrMapType msg_parts;
+	Frelon::SerialLine::MsgPartPos msg_pos;
+	string fmt_resp;
+	Timestamp t0;
+
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_loops; ++i)
+		regex_split_msg(msg, msg_parts);
+	print_rate("RegEx  splitMsg     ", nb_loops, t0);
+
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_loops; ++i)
+		ser_line.splitMsg(msg, msg_parts);
+	print_rate("Parser splitMsg     ", nb_loops, t0);
+
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_loops; ++i)
+		ser_line.parseMsg(msg, msg_pos);
+	print_rate("Parser parseMsg     ", nb_loops, t0);
+
+	const string reg_str = "SETJ";
+	Frelon::Reg reg;
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_loops; ++i)
+		FindMapValue(Frelon::RegStrMap, reg_str);
+	print_rate("Map    reg lookup   ", nb_loops, t0);
+
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_loops; ++i)
+		Frelon::FindRegByStr(reg_str, reg);
+	print_rate("Index  reg lookup   ", nb_loops, t0);
+
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_loops; ++i)
+		regex_decode_resp(ans, fmt_resp);
+	print_rate("RegEx  decodeFmtResp", nb_loops, t0);
+
+	t0 = Timestamp::now();
+	for (int i = 0; i < nb_loops; ++i)
+		ser_line.decodeFmtResp(ans, fmt_resp);
+	print_rate("Parser decodeFmtResp", nb_loops, t0);
+}
+
+int main(int argc, char *argv[])
+{
+	DEB_GLOBAL_FUNCT();
+
+	try {
+		char *endp;
+
+		int nb_loops = 100000;
+		if ((argc > 1) && argv[1]) {
+			nb_loops = strtol(argv[1], &endp, 0);
+			if (*endp)
+				THROW_HW_ERROR(InvalidValue)
+					<< "Invalid " << DEB_VAR1(argv[1]);
+		}
+
+		Frelon::Simulator sim;
+		Frelon::SerialLine ser_line(sim);
+		check_parsers(ser_line);
+		check_reg_lookup();
+		bench_parsers(ser_line, nb_loops);
+	} catch (Exception e) {
+		DEB_ERROR() << "LIMA Exception: " << e;
+		return 1;
+	} catch (...) {
+		DEB_ERROR() << "Unkown exception!";
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,1394 @@
+//###########################################################################
+// This file is part of LImA, a Library for Image Acquisition
+//
+// Copyright (C) : 2009-2011
+// European Synchrotron Radiation Facility
+// BP 220, Grenoble 38043
+// FRANCE
+//
+// This is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, see <http://www.gnu.org/licenses/>.
+//###########################################################################
+#include "FrelonCamera.h"
+#include "FrelonSimulator.h"
+#include "lima/MiscUtils.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <stdlib.h>
+
+using namespace lima;
+using namespace std;
+
+DEB_GLOBAL(DebModTest);
+
+
+void check_val(const string& desc, int val, int exp_val)
+{
+	DEB_GLOBAL_FUNCT();
+	cout << desc << ": " << val << endl;
+	if (val != exp_val)
+		THROW_HW_ERROR(Error) << desc << ": " << DEB_VAR2(val, exp_val);
+}
+
+void test_ser_line(Frelon::Simulator& sim)
+{
+	DEB_GLOBAL_FUNCT();
+
+	Frelon::SerialLine frelon_ser_line(sim);
+
+	string resp;
+	frelon_ser_line.sendFmtCmd("I?", resp);
+	cout << "ExpTime: \"" << resp << "\"" << endl;
+
+	frelon_ser_line.write(">H\r\n");
+	frelon_ser_line.readLine(resp);
+	cout << "Help: " << resp.size() << " bytes" << endl;
+	if (resp.empty())
+		THROW_HW_ERROR(Error) << "Empty multi-line response";
+}
+
+void test_regs(Frelon::Camera& frelon_cam, Frelon::Simulator& sim)
+{
+	DEB_GLOBAL_FUNCT();
+
+	Timestamp t0 = Timestamp::now();
+	int val;
+	frelon_cam.readRegister(Frelon::ExpTime, val);
+	DEB_TRACE() << "Read elapsed " << (Timestamp::now() - t0) << " sec";
+
+	frelon_cam.writeRegister(Frelon::ExpTime, 200);
+	frelon_cam.readRegister(Frelon::ExpTime, val);
+	check_val("ExpTime", val, 200);
+
+	// the Camera must retry transparently on BSY
+	sim.injectError(Frelon::ExpTime, Frelon::Simulator::ErrBusy, 2);
+	frelon_cam.writeRegister(Frelon::ExpTime, 100);
+	sim.getRegister(Frelon::ExpTime, val);
+	check_val("ExpTime after BSY", val, 100);
+
+	Frelon::Model& model = frelon_cam.getModel();
+	string ver;
+	model.getFirmware().getVersionStr(ver);
+	cout << "Firmware: " << ver << ", Name: " << model.getName() << endl;
+}
+
+void test_readout_time_cache(Frelon::Camera& frelon_cam, 
+			     Frelon::Simulator& sim)
+{
+	DEB_GLOBAL_FUNCT();
+
+	double readout_time, new_readout_time;
+	int nb_cmds, new_nb_cmds;
+	frelon_cam.readFloatRegister(Frelon::ReadoutTime, readout_time);
+	sim.getNbCmds(nb_cmds);
+	frelon_cam.readFloatRegister(Frelon::ReadoutTime, new_readout_time);
+	sim.getNbCmds(new_nb_cmds);
+	cout << "ReadoutTime: " << readout_time << endl;
+	check_val("Cached ReadoutTime cmds", new_nb_cmds - nb_cmds, 0);
+	if (new_readout_time != readout_time)
+		THROW_HW_ERROR(Error) << "Cached ReadoutTime truncated: "
+				      << DEB_VAR2(readout_time, 
+						  new_readout_time);
+
+	int bin_vert;
+	frelon_cam.readRegister(Frelon::BinVert, bin_vert);
+	frelon_cam.writeRegister(Frelon::BinVert, 2 * bin_vert);
+	frelon_cam.readFloatRegister(Frelon::ReadoutTime, new_readout_time);
+	cout << "ReadoutTime (BinVert=" << 2 * bin_vert << "): " 
+	     << new_readout_time << endl;
+	if (new_readout_time >= readout_time)
+		THROW_HW_ERROR(Error) << "ReadoutTime not invalidated: "
+				      << DEB_VAR2(readout_time, 
+						  new_readout_time);
+	frelon_cam.writeRegister(Frelon::BinVert, bin_vert);
+}
+
+void test_reg_depend(Frelon::Camera& frelon_cam, Frelon::Simulator& sim)
+{
+	DEB_GLOBAL_FUNCT();
+
+	int width, height, val, nb_cmds, new_nb_cmds;
+	double readout_time;
+	frelon_cam.readRegister(Frelon::AoiImageWidth, width);
+	frelon_cam.readRegister(Frelon::AoiImageHeight, height);
+	frelon_cam.readFloatRegister(Frelon::ReadoutTime, readout_time);
+	cout << "AoiImage: " << width << "x" << height << endl;
+
+	// ExpTime is not an input of the derived registers
+	int exp_time;
+	frelon_cam.readRegister(Frelon::ExpTime, exp_time);
+	frelon_cam.writeRegister(Frelon::ExpTime, exp_time + 1);
+	sim.getNbCmds(nb_cmds);
+	frelon_cam.readRegister(Frelon::AoiImageWidth, val);
+	frelon_cam.readFloatRegister(Frelon::ReadoutTime, readout_time);
+	sim.getNbCmds(new_nb_cmds);
+	check_val("Cached AoiImage/ReadoutTime cmds", 
+		  new_nb_cmds - nb_cmds, 0);
+	frelon_cam.writeRegister(Frelon::ExpTime, exp_time);
+
+	// NbLinesXfer only affects the readout timing
+	int nb_lines_xfer;
+	frelon_cam.readRegister(Frelon::NbLinesXfer, nb_lines_xfer);
+	frelon_cam.writeRegister(Frelon::NbLinesXfer, nb_lines_xfer + 1);
+	sim.getNbCmds(nb_cmds);
+	frelon_cam.readRegister(Frelon::AoiImageHeight, val);
+	sim.getNbCmds(new_nb_cmds);
+	check_val("Cached AoiImageHeight cmds", new_nb_cmds - nb_cmds, 0);
+	frelon_cam.readFloatRegister(Frelon::ReadoutTime, readout_time);
+	sim.getNbCmds(nb_cmds);
+	check_val("Invalidated ReadoutTime cmds", nb_cmds - new_nb_cmds, 1);
+	frelon_cam.writeRegister(Frelon::NbLinesXfer, nb_lines_xfer);
+
+	int bin_vert;
+	frelon_cam.readRegister(Frelon::BinVert, bin_vert);
+	frelon_cam.writeRegister(Frelon::BinVert, 2 * bin_vert);
+	frelon_cam.readRegister(Frelon::AoiImageHeight, val);
+	cout << "AoiImageHeight (BinVert=" << 2 * bin_vert << "): " 
+	     << val << endl;
+	check_val("Binned AoiImageHeight", val, height / 2);
+	frelon_cam.writeRegister(Frelon::BinVert, bin_vert);
+	frelon_cam.readRegister(Frelon::AoiImageHeight, val);
+	check_val("AoiImageHeight", val, height);
+}
+
+void test_reconfig_wait(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	// readiness is polled instead of the fixed reconfiguration sleep
+	double sleep_time = Frelon::GetRegProp(Frelon::BinHorz).sleep_time;
+	int bin_horz;
+	frelon_cam.readRegister(Frelon::BinHorz, bin_horz);
+	Timestamp t0 = Timestamp::now();
+	frelon_cam.writeRegister(Frelon::BinHorz, 2 * bin_horz);
+	double elapsed = Timestamp::now() - t0;
+	frelon_cam.writeRegister(Frelon::BinHorz, bin_horz);
+	cout << "BinHorz reconfiguration: " << elapsed << " s "
+	     << "(fixed sleep " << sleep_time << " s)" << endl;
+	if (elapsed >= sleep_time)
+		THROW_HW_ERROR(Error) << "Reconfiguration not polled: "
+				      << DEB_VAR2(elapsed, sleep_time);
+}
+
+struct RegVal {
+	Frelon::Reg reg;
+	int val;
+};
+
+const RegVal base_preset[] = {
+	{Frelon::ConfigHD, 0}, {Frelon::BinHorz, 1}, {Frelon::BinVert, 1},
+	{Frelon::RoiEnable, 0}, {Frelon::RoiFast, 0}, {Frelon::ChanMode, 6},
+	{Frelon::RoiPixelBegin, 0}, {Frelon::RoiPixelWidth, 2048},
+	{Frelon::RoiLineBegin, 0}, {Frelon::RoiLineWidth, 2048},
+	{Frelon::ExpTime, 100},
+};
+
+const RegVal bin_preset[] = {
+	{Frelon::BinHorz, 2}, {Frelon::BinVert, 2}, {Frelon::RoiEnable, 0},
+	{Frelon::RoiFast, 0}, {Frelon::ExpTime, 50},
+};
+
+const RegVal roi_preset[] = {
+	{Frelon::RoiEnable, 1}, {Frelon::RoiFast, 1},
+	{Frelon::RoiPixelBegin, 512}, {Frelon::RoiPixelWidth, 1024},
+	{Frelon::RoiLineBegin, 896}, {Frelon::RoiLineWidth, 256},
+	{Frelon::ExpTime, 10},
+};
+
+const RegVal speed_preset[] = {
+	{Frelon::BinHorz, 2}, {Frelon::ChanMode, 10}, {Frelon::ConfigHD, 1},
+	{Frelon::BinVert, 2}, {Frelon::ExpTime, 20},
+};
+
+double write_preset(Frelon::Camera& frelon_cam, const RegVal *preset,
+		    int nb_regs, bool use_trans)
+{
+	DEB_GLOBAL_FUNCT();
+
+	Timestamp t0 = Timestamp::now();
+	if (use_trans) {
+		Frelon::SerialLine::Transaction trans(
+						frelon_cam.getSerialLine());
+		for (int i = 0; i < nb_regs; ++i)
+			trans.writeRegister(preset[i].reg, preset[i].val);
+		frelon_cam.commitTransaction(trans);
+		if (!trans.isDone())
+			THROW_HW_ERROR(Error) << "Transaction not done";
+	} else {
+		for (int i = 0; i < nb_regs; ++i)
+			frelon_cam.writeRegister(preset[i].reg, preset[i].val);
+	}
+	return Timestamp::now() - t0;
+}
+
+void test_transaction(Frelon::Camera& frelon_cam, Frelon::Simulator& sim)
+{
+	DEB_GLOBAL_FUNCT();
+
+	struct Preset {
+		const char *name;
+		const RegVal *regs;
+		int nb_regs;
+	} preset_list[] = {
+		{"Bin 2x2",  bin_preset,   int(C_LIST_SIZE(bin_preset))},
+		{"Fast ROI", roi_preset,   int(C_LIST_SIZE(roi_preset))},
+		{"Speed",    speed_preset, int(C_LIST_SIZE(speed_preset))},
+	};
+	const int nb_base_regs = C_LIST_SIZE(base_preset);
+
+	for (unsigned int i = 0; i < C_LIST_SIZE(preset_list); ++i) {
+		const Preset& p = preset_list[i];
+		double elapsed[2];
+		for (int use_trans = 0; use_trans < 2; ++use_trans) {
+			write_preset(frelon_cam, base_preset, nb_base_regs, 
+				     true);
+			elapsed[use_trans] = write_preset(frelon_cam, p.regs,
+							  p.nb_regs, 
+							  use_trans);
+			for (int j = 0; j < p.nb_regs; ++j) {
+				int val;
+				sim.getRegister(p.regs[j].reg, val);
+				if (val != p.regs[j].val)
+					THROW_HW_ERROR(Error) 
+						<< p.name << ": " 
+						<< DEB_VAR2(p.regs[j].reg, val);
+			}
+		}
+		cout << p.name << ": single writes " << elapsed[0] << " s, "
+		     << "transaction " << elapsed[1] << " s" << endl;
+	}
+
+	// a BSY answer after a reconfiguration is retried after the sleep,
+	// inside the transaction
+	const RegVal busy_preset[] = {
+		{Frelon::BinHorz, 2}, {Frelon::ConfigHD, 1},
+	};
+	Frelon::SerialLine& ser_line = frelon_cam.getSerialLine();
+	Frelon::SerialLine::CmdStats stats[2];
+	write_preset(frelon_cam, base_preset, nb_base_regs, true);
+	ser_line.getRegStats(Frelon::ConfigHD, stats[0]);
+	sim.injectError(Frelon::ConfigHD, Frelon::Simulator::ErrBusy);
+	write_preset(frelon_cam, busy_preset, C_LIST_SIZE(busy_preset), true);
+	ser_line.getRegStats(Frelon::ConfigHD, stats[1]);
+	check_val("Transaction BSY camera retries", 
+		  int(stats[1].nb_busy_retries - stats[0].nb_busy_retries), 0);
+
+	write_preset(frelon_cam, base_preset, nb_base_regs, true);
+}
+
+void test_async_queue(Frelon::Camera& frelon_cam, Frelon::Simulator& sim)
+{
+	DEB_GLOBAL_FUNCT();
+
+	typedef Frelon::SerialLine::Request Request;
+	Frelon::SerialLine& ser_line = frelon_cam.getSerialLine();
+
+	const int nb_writes = 10;
+	Request write_req[nb_writes], read_req, status_req;
+	Timestamp t0 = Timestamp::now();
+	for (int i = 0; i < nb_writes; ++i)
+		ser_line.queueWriteRegister(Frelon::ExpTime, 101 + i, 
+					    write_req[i]);
+	// not cacheable: must be answered after the writes
+	ser_line.queueReadRegister(Frelon::StatusSeqA, status_req);
+	ser_line.queueReadRegister(Frelon::ExpTime, read_req);
+	double queue_time = Timestamp::now() - t0;
+	read_req.wait();
+	double exec_time = Timestamp::now() - t0;
+	for (int i = 0; i < nb_writes; ++i)
+		if (!write_req[i].isDone())
+			THROW_HW_ERROR(Error) << "Write not done: " 
+					      << DEB_VAR1(i);
+	status_req.wait();
+	check_val("Queued ExpTime", read_req.getVal(), 100 + nb_writes);
+	int val;
+	sim.getRegister(Frelon::ExpTime, val);
+	check_val("Simulator ExpTime", val, 100 + nb_writes);
+	cout << "Queued " << nb_writes + 2 << " requests in " << queue_time 
+	     << " s, executed in " << exec_time << " s" << endl;
+
+	// errors are reported by wait
+	sim.injectError(Frelon::ExpTime, Frelon::Simulator::ErrFail);
+	Request fail_req;
+	ser_line.queueWriteRegister(Frelon::ExpTime, 100, fail_req);
+	bool failed = false;
+	try {
+		fail_req.wait();
+	} catch (Exception e) {
+		failed = true;
+	}
+	if (!failed)
+		THROW_HW_ERROR(Error) << "Queued write error not reported";
+	frelon_cam.writeRegister(Frelon::ExpTime, 100);
+}
+
+void test_prio_lanes(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	typedef Frelon::SerialLine::Request Request;
+	Frelon::SerialLine& ser_line = frelon_cam.getSerialLine();
+	ser_line.resetLatencyStats();
+
+	// low priority dumps are deferred during the acquisition
+	ser_line.setDeferLowPrio(true);
+	Request dump_req;
+	ser_line.queueMultiLineCmd(Frelon::Config, dump_req);
+
+	const int nb_writes = 10;
+	Request write_req[nb_writes], status_req;
+	for (int i = 0; i < nb_writes; ++i)
+		ser_line.queueWriteRegister(Frelon::ExpTime, 101 + i, 
+					    write_req[i]);
+	ser_line.queueReadRegister(Frelon::StatusSeqA, status_req, 
+				   Request::High);
+	status_req.wait();
+	if (write_req[nb_writes - 1].isDone())
+		THROW_HW_ERROR(Error) << "Status read not prioritized";
+	write_req[nb_writes - 1].wait();
+	if (dump_req.getState() != Request::Queued)
+		THROW_HW_ERROR(Error) << "Low priority request not deferred";
+	ser_line.setDeferLowPrio(false);
+	dump_req.wait();
+	cout << "Config dump: " << dump_req.getResp().size() << " bytes"
+	     << endl;
+	frelon_cam.writeRegister(Frelon::ExpTime, 100);
+
+	for (int i = 0; i < 50; ++i) {
+		Frelon::Status status;
+		frelon_cam.getStatus(status, true);
+	}
+
+	for (int i = 0; i < Request::NbPriorities; ++i) {
+		Request::Priority prio = Request::Priority(i);
+		Frelon::SerialLine::LatencyStats stats;
+		ser_line.getLatencyStats(prio, stats);
+		cout << prio << " latency: " << stats << endl;
+	}
+}
+
+class CachePoller : public Thread
+{
+public:
+	CachePoller(Frelon::Camera& frelon_cam, volatile bool& quit)
+		: m_nb_polls(0), m_max_latency(0),
+		  m_cam(frelon_cam), m_quit(quit)
+	{}
+
+	~CachePoller()
+	{ join(); }
+
+	int m_nb_polls;
+	double m_max_latency;
+
+protected:
+	virtual void threadFunction()
+	{
+		int time_unit;
+		while (!m_quit) {
+			Timestamp t0 = Timestamp::now();
+			m_cam.readRegister(Frelon::TimeUnit, time_unit);
+			double latency = Timestamp::now() - t0;
+			m_max_latency = max(m_max_latency, latency);
+			++m_nb_polls;
+		}
+	}
+
+private:
+	Frelon::Camera& m_cam;
+	volatile bool& m_quit;
+};
+
+void test_cache_contention(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	Frelon::SerialLine& ser_line = frelon_cam.getSerialLine();
+	int time_unit;
+	frelon_cam.readRegister(Frelon::TimeUnit, time_unit);
+
+	const int nb_pollers = 4;
+	volatile bool quit = false;
+	CachePoller *poller[nb_pollers];
+	for (int i = 0; i < nb_pollers; ++i) {
+		poller[i] = new CachePoller(frelon_cam, quit);
+		poller[i]->start();
+	}
+
+	// the Config dump keeps the line busy for a long time
+	Timestamp t0 = Timestamp::now();
+	string resp;
+	ser_line.write(Frelon::MultiLineCmdStrMap[Frelon::Config]);
+	ser_line.readLine(resp);
+	double slow_time = Timestamp::now() - t0;
+	for (int i = 0; i < 10; ++i)
+		frelon_cam.writeRegister(Frelon::ExpTime, 101 + i);
+	frelon_cam.writeRegister(Frelon::ExpTime, 100);
+	double elapsed = Timestamp::now() - t0;
+
+	quit = true;
+	int nb_polls = 0;
+	double max_latency = 0;
+	for (int i = 0; i < nb_pollers; ++i) {
+		poller[i]->join();
+		nb_polls += poller[i]->m_nb_polls;
+		max_latency = max(max_latency, poller[i]->m_max_latency);
+		delete poller[i];
+	}
+	cout << nb_pollers << " pollers: " << int(nb_polls / elapsed) 
+	     << " cache reads/s, max latency " << max_latency << " s "
+	     << "(Config dump " << slow_time << " s)" << endl;
+	if (max_latency > slow_time / 2)
+		THROW_HW_ERROR(Error) << "Cache reads blocked by the line: "
+				      << DEB_VAR2(max_latency, slow_time);
+}
+
+void test_ser_line_stats(Frelon::Camera& frelon_cam, Frelon::Simulator& sim)
+{
+	DEB_GLOBAL_FUNCT();
+
+	Frelon::SerialLine& ser_line = frelon_cam.getSerialLine();
+	ser_line.resetStats();
+
+	int val;
+	frelon_cam.writeRegister(Frelon::ExpTime, 200);
+	frelon_cam.readRegister(Frelon::ExpTime, val);
+	frelon_cam.writeRegister(Frelon::ExpTime, 200);
+	sim.injectError(Frelon::ExpTime, Frelon::Simulator::ErrBusy, 2);
+	frelon_cam.writeRegister(Frelon::ExpTime, 100);
+	for (int i = 0; i < 3; ++i)
+		frelon_cam.readRegister(Frelon::StatusSeqA, val);
+
+	Frelon::SerialLine::CmdStats stats;
+	ser_line.getRegStats(Frelon::ExpTime, stats);
+	cout << "ExpTime stats: " << stats << endl;
+	check_val("ExpTime calls", stats.nb_calls, 6);
+	check_val("ExpTime cache hits", stats.nb_cache_hits, 2);
+	check_val("ExpTime busy retries", stats.nb_busy_retries, 2);
+
+	ser_line.getRegStats(Frelon::StatusSeqA, stats);
+	cout << "StatusSeqA stats: " << stats << endl;
+	check_val("StatusSeqA calls", stats.nb_calls, 3);
+	check_val("StatusSeqA cache hits", stats.nb_cache_hits, 0);
+	if (stats.nb_bytes_read == 0)
+		THROW_HW_ERROR(Error) << "No bytes read from StatusSeqA";
+}
+
+void test_multi_line(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	Frelon::SerialLine& ser_line = frelon_cam.getSerialLine();
+	const string& cmd = Frelon::MultiLineCmdStrMap[Frelon::Timing];
+
+	// the response end is learned after the first reads
+	const int nb_reads = 4;
+	double elapsed[nb_reads];
+	string resp[nb_reads];
+	for (int i = 0; i < nb_reads; ++i) {
+		Timestamp t0 = Timestamp::now();
+		ser_line.write(cmd);
+		ser_line.readLine(resp[i]);
+		elapsed[i] = Timestamp::now() - t0;
+		cout << cmd << " #" << i << ": " << resp[i].size() 
+		     << " bytes in " << elapsed[i] << " s" << endl;
+		if (resp[i] != resp[0])
+			THROW_HW_ERROR(Error) << "Truncated " << cmd 
+					      << " response: " << DEB_VAR1(i);
+	}
+	if (elapsed[nb_reads - 1] > elapsed[0] / 2)
+		THROW_HW_ERROR(Error) << "Multi-line read not faster: " 
+				      << DEB_VAR2(elapsed[0], 
+						  elapsed[nb_reads - 1]);
+
+	int exp_time;
+	frelon_cam.readRegister(Frelon::ExpTime, exp_time);
+}
+
+class StatusPoller : public Thread
+{
+public:
+	StatusPoller(Frelon::Camera& frelon_cam, int nb_reads)
+		: m_cam(frelon_cam), m_nb_reads(nb_reads)
+	{}
+
+	~StatusPoller()
+	{ join(); }
+
+protected:
+	virtual void threadFunction()
+	{
+		Frelon::Status status;
+		for (int i = 0; i < m_nb_reads; ++i)
+			m_cam.getStatus(status, true);
+	}
+
+private:
+	Frelon::Camera& m_cam;
+	int m_nb_reads;
+};
+
+void test_wait_status(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	// the bytes of a single status read: idle, the first poll matches
+	Frelon::Camera::WaitStatusStats stats;
+	Frelon::Status status = Frelon::Wait;
+	frelon_cam.waitStatus(status, Frelon::StatusMask, 1, true);
+	frelon_cam.getWaitStatusStats(stats);
+	check_val("Idle wait polls", stats.nb_polls, 1);
+	unsigned long read_bytes = stats.nb_bytes;
+
+	int nb_frames = 10;
+	frelon_cam.setTrigMode(IntTrig);
+	frelon_cam.setExpTime(0.05);
+	frelon_cam.setNbFrames(nb_frames);
+
+	frelon_cam.prepare();
+	Timestamp t0 = Timestamp::now();
+	frelon_cam.start();
+	// concurrent serial traffic must not be accounted to the wait
+	StatusPoller poller(frelon_cam, 50);
+	poller.start();
+	status = Frelon::Wait;
+	bool idle = frelon_cam.waitStatus(status, Frelon::StatusMask, 5, true);
+	double acq_time = Timestamp::now() - t0;
+	frelon_cam.stop();
+	if (!idle)
+		THROW_HW_ERROR(Error) << "Acquisition did not finish: " 
+				      << DEB_VAR1(DEB_HEX(status));
+
+	frelon_cam.getWaitStatusStats(stats);
+	cout << "Acq. " << acq_time << " s: " << stats.nb_polls << " polls, "
+	     << "slept " << stats.sleep_time << " s, "
+	     << "wake latency " << stats.wake_latency << " s, "
+	     << "CPU " << stats.cpu_time << " s, " 
+	     << stats.nb_bytes << " serial bytes" << endl;
+	if ((stats.sleep_time == 0) || (stats.nb_polls > 20))
+		THROW_HW_ERROR(Error) << "Status wait not predicted: " 
+				      << DEB_VAR2(stats.sleep_time, 
+						  stats.nb_polls);
+	if (stats.nb_bytes > stats.nb_polls * read_bytes)
+		THROW_HW_ERROR(Error) << "Status wait bytes not its own: "
+				      << DEB_VAR3(stats.nb_bytes, 
+						  stats.nb_polls, read_bytes);
+
+	unsigned int img_count;
+	frelon_cam.getImageCount(img_count);
+	check_val("ImageCount", img_count, nb_frames);
+}
+
+void test_status_cache(Frelon::Camera& frelon_cam, Frelon::Simulator& sim)
+{
+	DEB_GLOBAL_FUNCT();
+
+	Frelon::Status status;
+	int nb_cmds, new_nb_cmds;
+	frelon_cam.setStatusMaxAge(0.1);
+	frelon_cam.getStatus(status, true);
+	sim.getNbCmds(nb_cmds);
+	frelon_cam.getStatus(status, true);
+	sim.getNbCmds(new_nb_cmds);
+	check_val("Cached status cmds", new_nb_cmds - nb_cmds, 0);
+	frelon_cam.getStatus(status, true, false, true);
+	sim.getNbCmds(nb_cmds);
+	check_val("Forced status cmds", nb_cmds - new_nb_cmds, 1);
+	frelon_cam.setStatusMaxAge(0);
+
+	// concurrent callers share the read in progress
+	const int nb_pollers = 8, nb_reads = 20;
+	StatusPoller *poller[nb_pollers];
+	for (int i = 0; i < nb_pollers; ++i) {
+		poller[i] = new StatusPoller(frelon_cam, nb_reads);
+		poller[i]->start();
+	}
+	for (int i = 0; i < nb_pollers; ++i)
+		delete poller[i];
+	sim.getNbCmds(new_nb_cmds);
+	int nb_calls = nb_pollers * nb_reads;
+	cout << nb_calls << " concurrent getStatus: " 
+	     << new_nb_cmds - nb_cmds << " serial reads" << endl;
+	if (new_nb_cmds - nb_cmds >= nb_calls / 2)
+		THROW_HW_ERROR(Error) << "Status reads not coalesced: "
+				      << DEB_VAR2(nb_calls, 
+						  new_nb_cmds - nb_cmds);
+
+	// a read in progress when the cache is invalidated (Start/Stop) 
+	// is neither published nor joined
+	double cmd_delay;
+	sim.getCmdDelay(cmd_delay);
+	sim.setCmdDelay(0.2);
+	frelon_cam.setStatusMaxAge(10);
+	frelon_cam.invalidateStatusCache();
+	sim.getNbCmds(nb_cmds);
+	{
+		StatusPoller poller(frelon_cam, 1);
+		poller.start();
+		Sleep(0.05);
+		frelon_cam.invalidateStatusCache();
+		frelon_cam.getStatus(status, true);
+	}
+	sim.getNbCmds(new_nb_cmds);
+	check_val("Status reads after invalidation", new_nb_cmds - nb_cmds, 2);
+	sim.setCmdDelay(cmd_delay);
+	frelon_cam.setStatusMaxAge(0);
+}
+
+void test_acq(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	int nb_frames = 5;
+	frelon_cam.setTrigMode(IntTrig);
+	frelon_cam.setExpTime(0.01);
+	frelon_cam.setNbFrames(nb_frames);
+
+	frelon_cam.start();
+	Frelon::Status status;
+	do {
+		Sleep(0.05);
+		frelon_cam.getStatus(status);
+	} while (!(status & Frelon::Wait));
+	frelon_cam.stop();
+
+	unsigned int img_count;
+	frelon_cam.getImageCount(img_count);
+	check_val("ImageCount", img_count, nb_frames);
+
+	Frelon::SeqTimValues st;
+	frelon_cam.latchSeqTimValues(st);
+	DEB_TRACE() << "SeqTim " << st;
+}
+
+void test_image_count(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	int nb_frames = 3;
+	frelon_cam.setTrigMode(IntTrig);
+	frelon_cam.setExpTime(0.01);
+	frelon_cam.setNbFrames(nb_frames);
+
+	Timestamp t0 = Timestamp::now();
+	frelon_cam.start();
+	Frelon::Status status = Frelon::Wait;
+	frelon_cam.waitStatus(status, Frelon::StatusMask, 5, true);
+	frelon_cam.stop();
+
+	Frelon::Camera::ImageCountSample sample;
+	frelon_cam.getImageCountSample(sample);
+	check_val("ImageCountSample", int(sample.count), nb_frames);
+	if (!sample.timestamp.isSet() || (sample.timestamp < t0) || 
+	    (sample.timestamp > Timestamp::now()))
+		THROW_HW_ERROR(Error) << "Invalid image count timestamp";
+
+	unsigned int img_count;
+	frelon_cam.getImageCount(img_count);
+	check_val("ImageCount", img_count, nb_frames);
+
+	// IntTrigMult restarts, no sample taken between the triggers
+	frelon_cam.setTrigMode(IntTrigMult);
+	frelon_cam.prepare();
+	for (int i = 0; i < nb_frames; ++i) {
+		do {
+			frelon_cam.getStatus(status, true, false, true);
+		} while (!(status & Frelon::Wait));
+		frelon_cam.start();
+	}
+	frelon_cam.waitStatus(status, Frelon::StatusMask, 5, true);
+	frelon_cam.stop();
+	frelon_cam.setTrigMode(IntTrig);
+	frelon_cam.getImageCountSample(sample);
+	check_val("IntTrigMult ImageCountSample", int(sample.count), 
+		  nb_frames);
+}
+
+// predicted before being set, then measured: must agree within 5%
+double check_frame_timing(Frelon::Camera& frelon_cam, const Bin& bin, 
+			  const Roi& roi, Frelon::RoiMode roi_mode)
+{
+	DEB_GLOBAL_FUNCT();
+
+	Frelon::FrameTransferMode ftm;
+	Frelon::InputChan input_chan;
+	frelon_cam.getFrameTransferMode(ftm);
+	frelon_cam.getInputChan(input_chan);
+	Frelon::FrameTiming pred;
+	frelon_cam.calcFrameTiming(ftm, input_chan, bin, roi, roi_mode,
+				   0.01, 0, pred);
+	check_val("Candidate config predicted", pred.predicted, true);
+
+	frelon_cam.setBin(bin);
+	frelon_cam.setRoiMode(roi_mode);
+	frelon_cam.setRoi(roi);
+	frelon_cam.prepare();
+	Frelon::FrameTiming meas;
+	frelon_cam.getFrameTiming(meas);
+	frelon_cam.setRoi(Roi());
+	frelon_cam.setRoiMode(Frelon::None);
+	frelon_cam.setBin(Bin(1, 1));
+	cout << "Bin " << bin << ", Roi " << roi << " RoiMode=" << roi_mode 
+	     << ": predicted " << pred.readout_time * 1e3 << " ms readout, "
+	     << pred.max_frame_rate << " fps, "
+	     << "measured " << meas.readout_time * 1e3 << " ms, " 
+	     << meas.max_frame_rate << " fps" << endl;
+	double err = fabs(pred.readout_time / meas.readout_time - 1);
+	if (meas.predicted || (err > 0.05))
+		THROW_HW_ERROR(Error) << "Bad readout time prediction: "
+				      << DEB_VAR2(pred, meas);
+	return pred.readout_time;
+}
+
+void test_frame_timing(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	frelon_cam.setTrigMode(IntTrig);
+	frelon_cam.setExpTime(0.01);
+	frelon_cam.setNbFrames(1);
+	frelon_cam.prepare();
+
+	Frelon::FrameTiming ft;
+	frelon_cam.getFrameTiming(ft);
+	check_val("Measured config predicted", ft.predicted, false);
+
+	check_frame_timing(frelon_cam, Bin(1, 2), Roi(), Frelon::None);
+	check_frame_timing(frelon_cam, Bin(2, 1), Roi(), Frelon::None);
+
+	// only the fast ROI skips the pixels outside
+	FrameDim max_frame_dim;
+	frelon_cam.getMaxFrameDim(max_frame_dim);
+	Size frame_size = max_frame_dim.getSize();
+	int width = frame_size.getWidth();
+	int height = frame_size.getHeight();
+	Roi roi(Point(width / 4, height / 4), Size(width / 2, height / 2));
+	double slow_readout, fast_readout;
+	slow_readout = check_frame_timing(frelon_cam, Bin(1, 1), roi, 
+					  Frelon::Slow);
+	fast_readout = check_frame_timing(frelon_cam, Bin(1, 1), roi, 
+					  Frelon::Fast);
+	if (fast_readout >= slow_readout)
+		THROW_HW_ERROR(Error) << "Fast ROI not faster than slow ROI: "
+				      << DEB_VAR2(slow_readout, fast_readout);
+}
+
+void test_readout_cfg_cache(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	// both configs were measured in test_frame_timing
+	Frelon::SerialLine& ser_line = frelon_cam.getSerialLine();
+	double readout_time, bin_readout_time;
+	frelon_cam.getReadoutTime(readout_time);
+	ser_line.resetStats();
+	for (int i = 0; i < 100; ++i)
+		frelon_cam.getDeadTime(readout_time);
+	Frelon::SerialLine::CmdStats stats;
+	ser_line.getRegStats(Frelon::BinVert, stats);
+	check_val("BinVert reads for dead time", stats.nb_calls, 0);
+
+	frelon_cam.setBin(Bin(1, 2));
+	frelon_cam.getReadoutTime(bin_readout_time);
+	frelon_cam.setBin(Bin(1, 1));
+	frelon_cam.getReadoutTime(readout_time);
+	cout << "Readout time: " << readout_time * 1e3 << " ms, "
+	     << "Bin <1,2>: " << bin_readout_time * 1e3 << " ms" << endl;
+	if ((bin_readout_time <= 0) || (bin_readout_time >= readout_time))
+		THROW_HW_ERROR(Error) << "Config not updated on bin change: "
+				      << DEB_VAR2(readout_time, 
+						  bin_readout_time);
+}
+
+void test_seqtim_estimate(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	FrameDim max_frame_dim;
+	frelon_cam.getMaxFrameDim(max_frame_dim);
+	Size frame_size = max_frame_dim.getSize();
+	int width = frame_size.getWidth();
+	int height = frame_size.getHeight();
+
+	// measure ROIs of the same family around the estimated one,
+	// centered so that their lines are not rounded to the channels
+	frelon_cam.setRoiMode(Frelon::Slow);
+	const int nb_measures = 5;
+	int meas_height[nb_measures] = {height / 32, height / 8, height / 4, 
+					3 * height / 8, height / 2};
+	Roi est_roi(Point(0, 15 * height / 32), Size(width, height / 16));
+	Frelon::SeqTimValues st;
+	bool few_need_measure = false;
+	for (int i = 0; i < nb_measures; ++i) {
+		// a 2 parameter fit on 3 measures is not trusted
+		if (i == 3) {
+			frelon_cam.setRoi(est_roi);
+			few_need_measure = frelon_cam.needSeqTimMeasure();
+		}
+		int h = meas_height[i];
+		frelon_cam.setRoi(Roi(Point(0, (height - h) / 2), 
+				      Size(width, h)));
+		if (frelon_cam.needSeqTimMeasure())
+			frelon_cam.measureSeqTimValues(st);
+	}
+
+	// beyond the measured range: not trusted
+	frelon_cam.setRoi(Roi(Point(0, height / 8), 
+			      Size(width, 3 * height / 4)));
+	bool extrap_need_measure = frelon_cam.needSeqTimMeasure();
+	Frelon::FrameTiming extrap;
+	frelon_cam.getFrameTiming(extrap);
+
+	frelon_cam.setRoi(est_roi);
+	bool need_measure = frelon_cam.needSeqTimMeasure();
+	Frelon::FrameTiming est;
+	frelon_cam.getFrameTiming(est);
+	frelon_cam.measureSeqTimValues(st);
+	frelon_cam.setRoi(Roi());
+	frelon_cam.setRoiMode(Frelon::None);
+
+	cout << "Estimated readout: " << est.readout_time * 1e3 << " ms "
+	     << "+/- " << est.error * 1e3 << " ms, measured " 
+	     << st.readout_time * 1e3 << " ms" << endl;
+	check_val("Few measures config needs measure", few_need_measure, 
+		  true);
+	check_val("Extrapolated config needs measure", extrap_need_measure, 
+		  true);
+	check_val("Extrapolated config error known", extrap.error >= 0, 
+		  false);
+	check_val("Estimated config needs measure", need_measure, false);
+	// never below the SeqTim clock resolution
+	double min_err = Frelon::TimingCtrl::SeqTim::ClockPeriod;
+	double err = fabs(est.readout_time - st.readout_time);
+	double max_err = Frelon::TimingCtrl::EstimateMaxError * st.readout_time;
+	if (!est.predicted || (est.error < min_err) || (err > max_err))
+		THROW_HW_ERROR(Error) << "Bad readout time estimate: " 
+				      << DEB_VAR2(est, st);
+}
+
+void test_geometry_state(Frelon::Camera& frelon_cam, 
+			 Frelon::Simulator& sim)
+{
+	DEB_GLOBAL_FUNCT();
+
+	Frelon::GeometryState state;
+	frelon_cam.getGeometryState(state);
+	cout << "GeometryState: " << state << endl;
+
+	// the dry-run must agree with the camera and not use the serial line
+	Size ccd_size = state.ccd_size / state.bin;
+	const int nb_steps = 8;
+	Point step = ccd_size / nb_steps;
+	typedef vector<Roi> RoiList;
+	RoiList roi_list;
+	for (int x0 = 0; x0 < nb_steps; ++x0) {
+		for (int y0 = 0; y0 < nb_steps; ++y0) {
+			Point tl = step * Point(x0, y0);
+			Size size = (Point(nb_steps) - Point(x0, y0)) * step;
+			roi_list.push_back(Roi(tl, size));
+			roi_list.push_back(Roi(tl, step / 2 + 1));
+		}
+	}
+
+	RoiList hw_roi_list;
+	RoiList::const_iterator it, end = roi_list.end();
+	for (it = roi_list.begin(); it != end; ++it) {
+		Roi hw_roi;
+		frelon_cam.checkRoi(*it, hw_roi);
+		hw_roi_list.push_back(hw_roi);
+	}
+
+	int nb_cmds_start, nb_cmds_end;
+	sim.getNbCmds(nb_cmds_start);
+	Timestamp t0 = Timestamp::now();
+	RoiList::const_iterator hit = hw_roi_list.begin();
+	for (it = roi_list.begin(); it != end; ++it, ++hit) {
+		Roi hw_roi;
+		state.checkRoi(*it, hw_roi);
+		if (hw_roi != *hit)
+			THROW_HW_ERROR(Error) << "GeometryState mismatch: " 
+					      << DEB_VAR3(*it, hw_roi, *hit);
+	}
+	double elapsed = Timestamp::now() - t0;
+	sim.getNbCmds(nb_cmds_end);
+	cout << "Dry-run checked " << roi_list.size() << " rois: " 
+	     << int(roi_list.size() / elapsed) << " roi/s" << endl;
+	check_val("Dry-run serial line cmds", nb_cmds_end - nb_cmds_start, 0);
+
+	// the ChanXform table must match the transform calculated on the fly
+	Flip flip;
+	frelon_cam.getFlip(flip);
+	for (int flip_mode = 0; flip_mode < 4; ++flip_mode) {
+		Flip f((flip_mode >> 1) & 1, (flip_mode >> 0) & 1);
+		frelon_cam.setFlip(f);
+		Frelon::GeometryState dry_state = state;
+		dry_state.flip = f;
+		for (it = roi_list.begin(); it != end; ++it) {
+			Roi cam_hw_roi, dry_hw_roi;
+			frelon_cam.checkRoi(*it, cam_hw_roi);
+			dry_state.checkRoi(*it, dry_hw_roi);
+			if (cam_hw_roi != dry_hw_roi)
+				THROW_HW_ERROR(Error) << "ChanXform mismatch: "
+						      << DEB_VAR3(f, *it, 
+								  dry_state);
+		}
+	}
+	frelon_cam.setFlip(flip);
+	cout << "ChanXform table agrees on " << roi_list.size() 
+	     << " rois x 4 flips" << endl;
+}
+
+void test_fastest_readout_mode(Frelon::Camera& frelon_cam, 
+			       Frelon::Simulator& sim)
+{
+	DEB_GLOBAL_FUNCT();
+
+	Frelon::FrameTransferMode ftm;
+	Frelon::InputChan input_chan;
+	frelon_cam.getFrameTransferMode(ftm);
+	frelon_cam.getInputChan(input_chan);
+	double rate;
+	frelon_cam.getMaxFrameRate(rate);
+
+	FrameDim max_frame_dim;
+	frelon_cam.getMaxFrameDim(max_frame_dim);
+	Size frame_size = max_frame_dim.getSize();
+	Roi roi(Point(0, frame_size.getHeight() / 16), 
+		Size(frame_size.getWidth(), frame_size.getHeight() / 8));
+	Frelon::Camera::ReadoutMode mode;
+	frelon_cam.calcFastestReadoutMode(roi, mode);
+	Roi hw_roi;
+
+	// a failed write restores the previous mode
+	sim.injectError(Frelon::RoiPixelWidth, Frelon::Simulator::ErrFail, 2);
+	bool failed = false;
+	try {
+		frelon_cam.setFastestReadoutMode(roi, hw_roi);
+	} catch (Exception& e) {
+		failed = true;
+	}
+	Frelon::FrameTransferMode fail_ftm;
+	Frelon::InputChan fail_input_chan;
+	frelon_cam.getFrameTransferMode(fail_ftm);
+	frelon_cam.getInputChan(fail_input_chan);
+	frelon_cam.getRoi(hw_roi);
+	if (!failed || (fail_ftm != ftm) || (fail_input_chan != input_chan) ||
+	    hw_roi.isActive())
+		THROW_HW_ERROR(Error) << "Readout mode not restored: " 
+				      << DEB_VAR4(failed, fail_ftm, 
+						  fail_input_chan, hw_roi);
+
+	frelon_cam.setFastestReadoutMode(roi, hw_roi);
+	frelon_cam.prepare();
+	Frelon::FrameTiming meas;
+	frelon_cam.getFrameTiming(meas);
+	cout << "Roi " << roi << ": " 
+	     << frelon_cam.getInputChanModeName(mode.ftm, mode.input_chan)
+	     << " RoiMode=" << mode.roi_mode << ", HW " << hw_roi << ", "
+	     << "predicted " << mode.timing.max_frame_rate << " fps, "
+	     << "measured " << meas.max_frame_rate << " fps "
+	     << "(full frame " << rate << " fps)" << endl;
+
+	// the ROI config is predicted as read from the camera
+	Frelon::FrameTiming cand;
+	frelon_cam.calcFrameTiming(mode.ftm, mode.input_chan, Bin(1, 1), roi,
+				   mode.roi_mode, 0.01, 0, cand);
+	check_val("Measured ROI config predicted", cand.predicted, false);
+
+	frelon_cam.setRoi(Roi());
+	frelon_cam.setFrameTransferMode(ftm);
+	frelon_cam.setInputChan(input_chan);
+
+	if (!hw_roi.containsRoi(roi))
+		THROW_HW_ERROR(Error) << "HW roi does not cover the roi: "
+				      << DEB_VAR2(roi, hw_roi);
+	double err = fabs(mode.timing.max_frame_rate / meas.max_frame_rate
+			  - 1);
+	if ((meas.max_frame_rate <= rate) || (err > 0.05))
+		THROW_HW_ERROR(Error) << "Bad readout mode: " 
+				      << DEB_VAR2(mode.timing, meas);
+}
+
+void test_fastest_measured_mode(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	Frelon::FrameTransferMode ftm;
+	Frelon::InputChan input_chan;
+	Frelon::RoiMode roi_mode;
+	frelon_cam.getFrameTransferMode(ftm);
+	frelon_cam.getInputChan(input_chan);
+	frelon_cam.getRoiMode(roi_mode);
+
+	FrameDim max_frame_dim;
+	frelon_cam.getMaxFrameDim(max_frame_dim);
+	Size frame_size = max_frame_dim.getSize();
+	Roi roi(Point(0, frame_size.getHeight() / 16), 
+		Size(frame_size.getWidth(), frame_size.getHeight() / 8));
+	Frelon::Camera::ReadoutMode mode;
+	frelon_cam.calcFastestReadoutMode(roi, mode);
+
+	// measure all the ROI modes of the chosen channels
+	static const Frelon::RoiMode RoiModeList[] = {
+		Frelon::Slow, Frelon::Fast, Frelon::Kinetic,
+	};
+	frelon_cam.setFrameTransferMode(mode.ftm);
+	frelon_cam.setInputChan(mode.input_chan);
+	double best_rate = 0;
+	Frelon::RoiMode best_mode = Frelon::None;
+	for (unsigned int i = 0; i < C_LIST_SIZE(RoiModeList); ++i) {
+		frelon_cam.setRoiMode(RoiModeList[i]);
+		frelon_cam.setRoi(roi);
+		frelon_cam.prepare();
+		Frelon::FrameTiming meas;
+		frelon_cam.getFrameTiming(meas);
+		frelon_cam.setRoi(Roi());
+		if (meas.max_frame_rate > best_rate) {
+			best_rate = meas.max_frame_rate;
+			best_mode = RoiModeList[i];
+		}
+	}
+	frelon_cam.setRoiMode(roi_mode);
+	frelon_cam.setFrameTransferMode(ftm);
+	frelon_cam.setInputChan(input_chan);
+
+	Frelon::Camera::ReadoutMode fastest;
+	frelon_cam.calcFastestReadoutMode(roi, fastest);
+	double rate = fastest.timing.max_frame_rate;
+	bool measured = (fastest.timing.error == 0);
+	cout << "Roi " << roi << ": fastest measured RoiMode=" << best_mode 
+	     << " " << best_rate << " fps, chosen " 
+	     << frelon_cam.getInputChanModeName(fastest.ftm, 
+						fastest.input_chan)
+	     << " RoiMode=" << fastest.roi_mode << " " << rate << " fps "
+	     << (measured ? "measured" : "predicted") << endl;
+	// only a clearly (5%) faster prediction beats the measures
+	double min_rate = measured ? best_rate / 1.01 : best_rate * 1.05;
+	if (rate < min_rate)
+		THROW_HW_ERROR(Error) << "Not the fastest measured mode: "
+				      << DEB_VAR3(best_mode, best_rate, 
+						  fastest.timing);
+}
+
+double trigger_latency(Frelon::Camera& frelon_cam, bool trig_ack, 
+		       int nb_trigs)
+{
+	DEB_GLOBAL_FUNCT();
+
+	frelon_cam.setTrigAck(trig_ack);
+	frelon_cam.setNbFrames(nb_trigs);
+	frelon_cam.prepare();
+
+	vector<double> lat_list;
+	Frelon::Status status;
+	for (int i = 0; i < nb_trigs; ++i) {
+		// wait for the previous frame: it reads the pending ack.
+		do {
+			frelon_cam.getStatus(status, true, false, true);
+		} while (!(status & Frelon::Wait));
+		Timestamp t0 = Timestamp::now();
+		frelon_cam.start();
+		if (i > 0)
+			lat_list.push_back(Timestamp::now() - t0);
+	}
+	frelon_cam.stop();
+
+	sort(lat_list.begin(), lat_list.end());
+	int n = lat_list.size();
+	double p50 = lat_list[n / 2] * 1e3;
+	double p90 = lat_list[n * 9 / 10] * 1e3;
+	double p99 = lat_list[n * 99 / 100] * 1e3;
+	double max = lat_list.back() * 1e3;
+	cout << "Trigger " << (trig_ack ? "with" : "without") << " ack [ms]: "
+	     << "p50=" << p50 << ", p90=" << p90 << ", p99=" << p99 
+	     << ", max=" << max << endl;
+	return p50;
+}
+
+void test_seqtim_calib(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	int chan_mode, bin_vert;
+	frelon_cam.readRegister(Frelon::ChanMode, chan_mode);
+	frelon_cam.readRegister(Frelon::BinVert, bin_vert);
+	Frelon::SeqTimCalibRange range = {chan_mode, 5, 7, Frelon::None, 
+					  0, 0, 0, 0};
+	frelon_cam.addSeqTimCalibRange(range);
+	int nb_pending;
+	frelon_cam.getSeqTimCalibPending(nb_pending);
+	check_val("Calib. pending configs", nb_pending, 3);
+	frelon_cam.startSeqTimCalib();
+
+	// claim the camera back in the middle of the second measure
+	Timestamp t0 = Timestamp::now();
+	do {
+		Sleep(0.01);
+		frelon_cam.getSeqTimCalibPending(nb_pending);
+		double elapsed = Timestamp::now() - t0;
+		if (elapsed > 10)
+			THROW_HW_ERROR(Error) << "Calibration not started";
+	} while (nb_pending == 3);
+	Sleep(0.1);
+	t0 = Timestamp::now();
+	int val;
+	frelon_cam.readRegister(Frelon::BinVert, val);
+	double yield_time = Timestamp::now() - t0;
+	cout << "SeqTim calibration yielded in " << yield_time * 1e3 
+	     << " ms" << endl;
+	check_val("BinVert during calib.", val, bin_vert);
+	if (yield_time > 0.5)
+		THROW_HW_ERROR(Error) << "Calibration did not yield: "
+				      << DEB_VAR1(yield_time);
+	frelon_cam.getSeqTimCalibPending(nb_pending);
+	check_val("Calib. pending after yield", nb_pending, 2);
+
+	t0 = Timestamp::now();
+	do {
+		Sleep(0.1);
+		frelon_cam.getSeqTimCalibPending(nb_pending);
+		double elapsed = Timestamp::now() - t0;
+		if (elapsed > 30)
+			THROW_HW_ERROR(Error) << "Calibration not finished: "
+					      << DEB_VAR1(nb_pending);
+	} while (nb_pending > 0);
+	frelon_cam.stopSeqTimCalib();
+	double calib_time = Timestamp::now() - t0;
+	cout << "SeqTim calibration finished in " << calib_time << " s" 
+	     << endl;
+
+	frelon_cam.readRegister(Frelon::BinVert, val);
+	check_val("BinVert after calib.", val, bin_vert);
+	for (int b = range.bin_vert_first; b <= range.bin_vert_last; ++b) {
+		frelon_cam.writeRegister(Frelon::BinVert, b);
+		check_val("Calibrated config needs measure", 
+			  frelon_cam.needSeqTimMeasure(), false);
+	}
+	frelon_cam.writeRegister(Frelon::BinVert, bin_vert);
+}
+
+void test_trigger_latency(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	frelon_cam.setTrigMode(IntTrigMult);
+	frelon_cam.setExpTime(0.001);
+
+	const int nb_trigs = 21;
+	double ack_p50 = trigger_latency(frelon_cam, true, nb_trigs);
+	double no_ack_p50 = trigger_latency(frelon_cam, false, nb_trigs);
+	frelon_cam.setTrigAck(true);
+	frelon_cam.setTrigMode(IntTrig);
+	if (no_ack_p50 >= ack_p50)
+		THROW_HW_ERROR(Error) << "Trigger without ack not faster: "
+				      << DEB_VAR2(ack_p50, no_ack_p50);
+}
+
+void test_pending_ack_err(Frelon::Camera& frelon_cam)
+{
+	DEB_GLOBAL_FUNCT();
+
+	frelon_cam.setTrigMode(IntTrigMult);
+	frelon_cam.setExpTime(0.1);
+	frelon_cam.setNbFrames(2);
+	frelon_cam.setTrigAck(false);
+	frelon_cam.prepare();
+	frelon_cam.start();
+
+	// re-trigger while exposing: the camera answers BSY
+	frelon_cam.start();
+	bool err_reported = false;
+	try {
+		Frelon::Status status;
+		frelon_cam.getStatus(status, true, false, true);
+	} catch (Exception& e) {
+		err_reported = true;
+	}
+	frelon_cam.setTrigAck(true);
+	frelon_cam.stop();
+	frelon_cam.setTrigMode(IntTrig);
+	if (!err_reported)
+		THROW_HW_ERROR(Error) << "Un-acknowledged Start error "
+				      << "not reported by the status";
+}
+
+double start_camera(Frelon::Simulator& sim, const string& cache_file,
+		    int& nb_cmds)
+{
+	DEB_GLOBAL_FUNCT();
+
+	int nb_cmds0;
+	sim.getNbCmds(nb_cmds0);
+	Timestamp t0 = Timestamp::now();
+	Frelon::Camera frelon_cam(sim, cache_file);
+	double elapsed = Timestamp::now() - t0;
+	sim.getNbCmds(nb_cmds);
+	nb_cmds -= nb_cmds0;
+	return elapsed;
+}
+
+void test_warm_start()
+{
+	DEB_GLOBAL_FUNCT();
+
+	Frelon::Simulator sim(Frelon::Simulator::DefComplexSerNb, "4.1b");
+	const string cache_file = "/tmp/test_frelon_simulator.cache";
+	remove(cache_file.c_str());
+
+	int cold_cmds, warm_cmds, stale_cmds;
+	double cold_time = start_camera(sim, cache_file, cold_cmds);
+	double warm_time = start_camera(sim, cache_file, warm_cmds);
+	cout << "Cold start: " << cold_cmds << " cmds in " << cold_time 
+	     << " s, warm start: " << warm_cmds << " cmds in " << warm_time
+	     << " s" << endl;
+	if (warm_cmds >= cold_cmds)
+		THROW_HW_ERROR(Error) << "Register cache not used: " 
+				      << DEB_VAR2(cold_cmds, warm_cmds);
+
+	// a register changed behind our back invalidates the cache
+	sim.setRegister(Frelon::ExpTime, 1234);
+	start_camera(sim, cache_file, stale_cmds);
+	check_val("Stale cache start cmds", stale_cmds, cold_cmds);
+
+	remove(cache_file.c_str());
+}
+
+bool need_seqtim_measure(Frelon::Camera& frelon_cam, const Bin& bin)
+{
+	frelon_cam.setBin(bin);
+	bool need_measure = frelon_cam.needSeqTimMeasure();
+	frelon_cam.setBin(Bin(1, 1));
+	return need_measure;
+}
+
+void test_seqtim_measure_file()
+{
+	DEB_GLOBAL_FUNCT();
+
+	Frelon::Simulator sim(Frelon::Simulator::DefComplexSerNb, "4.1b");
+	const string cache_file = "/tmp/test_frelon_simulator_seqtim.cache";
+	const string measure_file = cache_file + ".seqtim";
+	const string export_file = "/tmp/test_frelon_simulator.seqtim";
+	remove(cache_file.c_str());
+	remove(measure_file.c_str());
+	remove(export_file.c_str());
+
+	Bin bin(1, 4);
+	{
+		Frelon::Camera frelon_cam(sim, cache_file);
+		check_val("New config needs measure", 
+			  need_seqtim_measure(frelon_cam, bin), true);
+		frelon_cam.setBin(bin);
+		frelon_cam.prepare();
+		frelon_cam.setBin(Bin(1, 1));
+		frelon_cam.exportSeqTimMeasures(export_file);
+	}
+	{
+		Frelon::Camera frelon_cam(sim, cache_file);
+		check_val("Saved config needs measure", 
+			  need_seqtim_measure(frelon_cam, bin), false);
+	}
+
+	remove(measure_file.c_str());
+	{
+		Frelon::Camera frelon_cam(sim, cache_file);
+		check_val("Lost config needs measure", 
+			  need_seqtim_measure(frelon_cam, bin), true);
+		frelon_cam.importSeqTimMeasures(export_file);
+		check_val("Imported config needs measure", 
+			  need_seqtim_measure(frelon_cam, bin), false);
+	}
+	{
+		// the import was also saved in the measure file
+		Frelon::Camera frelon_cam(sim, cache_file);
+		check_val("Reloaded config needs measure", 
+			  need_seqtim_measure(frelon_cam, bin), false);
+	}
+
+	remove(cache_file.c_str());
+	remove(measure_file.c_str());
+	remove(export_file.c_str());
+}
+
+void test_frelon_simulator()
+{
+	DEB_GLOBAL_FUNCT();
+
+	// SeqTim registers are available from firmware 4.1
+	Frelon::Simulator sim(Frelon::Simulator::DefComplexSerNb, "4.1b");
+	test_ser_line(sim);
+
+	Frelon::Camera frelon_cam(sim);
+	test_regs(frelon_cam, sim);
+	test_readout_time_cache(frelon_cam, sim);
+	test_reg_depend(frelon_cam, sim);
+	test_reconfig_wait(frelon_cam);
+	test_transaction(frelon_cam, sim);
+	test_async_queue(frelon_cam, sim);
+	test_prio_lanes(frelon_cam);
+	test_cache_contention(frelon_cam);
+	test_ser_line_stats(frelon_cam, sim);
+	test_multi_line(frelon_cam);
+	test_status_cache(frelon_cam, sim);
+	test_acq(frelon_cam);
+	test_wait_status(frelon_cam);
+	test_image_count(frelon_cam);
+	test_trigger_latency(frelon_cam);
+	test_pending_ack_err(frelon_cam);
+	test_frame_timing(frelon_cam);
+	test_readout_cfg_cache(frelon_cam);
+	test_seqtim_estimate(frelon_cam);
+	test_geometry_state(frelon_cam, sim);
+	test_fastest_readout_mode(frelon_cam, sim);
+	test_fastest_measured_mode(frelon_cam);
+	test_seqtim_calib(frelon_cam);
+
+	int nb_cmds;
+	long nb_written, nb_read;
+	sim.getNbCmds(nb_cmds);
+	sim.getNbBytes(nb_written, nb_read);
+	DEB_TRACE() << DEB_VAR3(nb_cmds, nb_written, nb_read);
+
+	test_warm_start();
+	test_seqtim_measure_file();
+}
+
+
+int main(int argc, char *argv[])
+{
+	DEB_GLOBAL_FUNCT();
+
+	try {
+		char *endp;
+
+		if ((argc > 1) && argv[1]) {
+			int deb_flags = strtol(argv[1], &endp, 0);
+			if (*endp)
+				THROW_HW_ERROR(InvalidValue)
+					<< "Invalid " << DEB_VAR1(argv[1]);
+			DebParams::setTypeFlags(deb_flags);
+		}
+
+		test_frelon_simulator();
+	} catch (Exception e) {
+		DEB_ERROR() << "LIMA Exception: " << e;
+		return 1;
+	} catch (...) {
+		DEB_ERROR() << "Unkown exception!";
+		return 1;
+	}
+
+	return 0;
+}